@@ -0,0 +1,433 @@
+// Benchmarks each phase of the compiler on generated lcl programs.
+//
+// The generator builds a program from a handful of shape parameters, so that a change to one part of the compiler can
+// be measured on the kind of input that stresses it (deep nesting for the parser, many locals for the symbol table,
+// long expressions for the emitter, ...). Every phase is then run over the same source a number of times, and the
+// median and 99th percentile throughput of each phase is reported.
+//
+// Build with build.bat, or e.g. `cc -O2 -o bench bench/bench.c -lpthread`, and run `bench --help` for the options.
+
+#define LCOM_NO_MAIN
+#include "../lcom.c"
+
+///////////////////
+// Generator API //
+///////////////////
+
+typedef struct {
+    int functions;
+    int statements;     // Statements in each function body. Nested scopes get half as many as their parent.
+    int nestingDepth;   // How deeply `if`s and `while`s may nest
+    int expressionDepth;
+    int locals;         // Integer locals declared at the top of each scope
+    int arrays;         // Arrays declared at the top of each scope
+    int comments;       // Comments before each statement, alternating between `//` and `/* */` comments
+    int literalDigits;  // Literal operands have up to this many digits, like the constants in generated tables
+    unsigned int seed;
+} Workload_Params;
+
+typedef struct {
+    Workload_Params params;
+    String_Builder* out;
+    unsigned int rngState;
+    int loopCount; // Used to give each loop's counter a unique name
+} Generator;
+
+unsigned int genRandom(Generator* gen) {
+    // xorshift32, so the generated program only depends on the seed and not on the platform's `rand`
+    unsigned int x = gen->rngState;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    gen->rngState = x;
+    return x;
+}
+
+inline int genBelow(Generator* gen, int bound) {
+    return (int)(genRandom(gen) % (unsigned int)bound);
+}
+
+#define GEN_ARRAY_SIZE 8
+
+// Appends an operand that is visible at `depth`: a literal, a parameter, a local or an array element.
+void genOperand(Generator* gen, int depth) {
+    Workload_Params* params = &gen->params;
+    int choice = genBelow(gen, 8);
+    int scope = genBelow(gen, depth + 1);
+    if (choice < 2 || (params->locals == 0 && params->arrays == 0)) {
+        int bound = 1;
+        for (int i = 0; i < params->literalDigits; ++i) {
+            bound *= 10;
+        }
+        sbPrintf(gen->out, "%d", genBelow(gen, bound));
+    }
+    else if (choice < 3) {
+        sbAppend(gen->out, "n");
+    }
+    else if (choice < 6 || params->arrays == 0) {
+        if (params->locals == 0) {
+            sbAppend(gen->out, "n");
+        }
+        else {
+            sbPrintf(gen->out, "v%d_%d", scope, genBelow(gen, params->locals));
+        }
+    }
+    else {
+        sbPrintf(gen->out, "a%d_%d[%d]", scope, genBelow(gen, params->arrays), genBelow(gen, GEN_ARRAY_SIZE));
+    }
+}
+
+// Expressions nest to the right, e.g. `a + (b * (c - 2))`, since a parenthesized expression has to end the expression
+// it appears in.
+void genExpr(Generator* gen, int depth, int exprDepth) {
+    genOperand(gen, depth);
+    if (exprDepth <= 1) {
+        return;
+    }
+
+    static char* operators[] = {" + ", " - ", " * ", " / "};
+    int op = genBelow(gen, 4);
+    sbAppend(gen->out, operators[op]);
+    if (op == 3) {
+        // Only divide by nonzero literals, so the generated program can also be run.
+        sbPrintf(gen->out, "%d", 1 + genBelow(gen, 9));
+        return;
+    }
+    sbAppend(gen->out, "(");
+    genExpr(gen, depth, exprDepth - 1);
+    sbAppend(gen->out, ")");
+}
+
+void genScope(Generator* gen, int indent, int depth, int statements, int loop);
+
+void genComments(Generator* gen, int indent) {
+    for (int i = 0; i < gen->params.comments; ++i) {
+        if (i % 2 == 0) {
+            sbAppendIndented(indent, gen->out, "// Explains what the next statement is for, as comments tend to.\n");
+        }
+        else {
+            sbAppendIndented(indent, gen->out, "/* A block comment, which may also go on\n");
+            sbAppendIndented(indent, gen->out, "   for more than a single line. */\n");
+        }
+    }
+}
+
+void genStatement(Generator* gen, int indent, int depth, int statements) {
+    Workload_Params* params = &gen->params;
+    genComments(gen, indent);
+    int choice = depth < params->nestingDepth ? genBelow(gen, 8) : 0;
+    if (choice == 6) {
+        sbAppendIndented(indent, gen->out, "if ");
+        if (genBelow(gen, 4) == 0) {
+            sbAppend(gen->out, "flag");
+        }
+        else {
+            genOperand(gen, depth);
+            sbAppend(gen->out, " == ");
+            genExpr(gen, depth, params->expressionDepth);
+        }
+        sbAppend(gen->out, " ");
+        genScope(gen, indent, depth + 1, statements / 2, -1);
+        if (genBelow(gen, 2) == 0) {
+            sbAppendIndented(indent, gen->out, "else ");
+            genScope(gen, indent, depth + 1, statements / 2, -1);
+        }
+    }
+    else if (choice == 7) {
+        // Loops run a few times and stop, using a flag since the only comparison is `==`.
+        int loop = gen->loopCount++;
+        sbPrintfIndented(indent, gen->out, "i%d: int;\n", loop);
+        sbPrintfIndented(indent, gen->out, "done%d: bool;\n", loop);
+        sbPrintfIndented(indent, gen->out, "i%d = 0;\n", loop);
+        sbPrintfIndented(indent, gen->out, "done%d = false;\n", loop);
+        sbPrintfIndented(indent, gen->out, "while done%d == false ", loop);
+        genScope(gen, indent, depth + 1, statements / 2, loop);
+    }
+    else if (params->locals > 0) {
+        sbPrintfIndented(indent, gen->out, "v%d_%d = ", genBelow(gen, depth + 1), genBelow(gen, params->locals));
+        genExpr(gen, depth, params->expressionDepth);
+        sbAppend(gen->out, ";\n");
+    }
+    else {
+        sbAppendIndented(indent, gen->out, "n = ");
+        genExpr(gen, depth, params->expressionDepth);
+        sbAppend(gen->out, ";\n");
+    }
+}
+
+// Appends a braced scope. The opening brace goes on the current line. If `loop` isn't -1, the scope is the body of that
+// loop and starts by counting its iterations.
+void genScope(Generator* gen, int indent, int depth, int statements, int loop) {
+    Workload_Params* params = &gen->params;
+    sbAppend(gen->out, "{\n");
+    // Every scope level has its own names, so locals never shadow each other.
+    for (int i = 0; i < params->locals; ++i) {
+        sbPrintfIndented(indent + 1, gen->out, "v%d_%d: int;\n", depth, i);
+    }
+    for (int i = 0; i < params->arrays; ++i) {
+        sbPrintfIndented(indent + 1, gen->out, "a%d_%d: [%d] int;\n", depth, i, GEN_ARRAY_SIZE);
+    }
+    for (int i = 0; i < params->locals; ++i) {
+        sbPrintfIndented(indent + 1, gen->out, "v%d_%d = %d;\n", depth, i, genBelow(gen, 100));
+    }
+    if (loop != -1) {
+        sbPrintfIndented(indent + 1, gen->out, "i%d = i%d + 1;\n", loop, loop);
+        sbPrintfIndented(indent + 1, gen->out, "if i%d == %d {\n", loop, 2 + genBelow(gen, 8));
+        sbPrintfIndented(indent + 2, gen->out, "done%d = true;\n", loop);
+        sbAppendIndented(indent + 1, gen->out, "}\n");
+    }
+    if (statements < 1) {
+        statements = 1;
+    }
+    for (int i = 0; i < statements; ++i) {
+        genStatement(gen, indent + 1, depth, statements);
+    }
+    if (depth == 0) {
+        sbAppendIndented(indent + 1, gen->out, "return ");
+        genExpr(gen, depth, params->expressionDepth);
+        sbAppend(gen->out, ";\n");
+    }
+    sbAppendIndented(indent, gen->out, "}\n");
+}
+
+void generateWorkload(Workload_Params params, String_Builder* out) {
+    Generator gen = {
+        .params = params,
+        .out = out,
+        .rngState = params.seed != 0 ? params.seed : 1,
+        .loopCount = 0,
+    };
+    for (int i = 0; i < params.functions; ++i) {
+        gen.loopCount = 0;
+        sbPrintf(out, "f%d :: func(n: int, flag: bool) -> int ", i);
+        genScope(&gen, 0, 0, params.statements, -1);
+        sbAppend(out, "\n");
+    }
+    // So that the emitted C links into a program.
+    sbAppend(out, "main :: func() -> int {\n    return 0;\n}\n");
+}
+
+
+
+///////////////////
+// Benchmark API //
+///////////////////
+
+typedef enum {
+    BENCH_LEX,
+    BENCH_PARSE,
+    BENCH_SYMBOLS,
+    BENCH_VERIFY,
+    BENCH_TYPE_CHECK,
+    BENCH_EMIT,
+
+    // Used for static asserts
+    BENCH_PHASE_COUNT,
+} Bench_Phase;
+
+char* benchPhaseName(Bench_Phase phase) {
+    switch (phase) {
+        case BENCH_LEX: return "lex";
+        case BENCH_PARSE: return "parse";
+        case BENCH_SYMBOLS: return "symbols";
+        case BENCH_VERIFY: return "verify";
+        case BENCH_TYPE_CHECK: return "typeCheck";
+        case BENCH_EMIT: return "emit";
+    }
+    static_assert(BENCH_PHASE_COUNT == 6, "Non-exhaustive cases (benchPhaseName)");
+    assert(false && "Unreachable (benchPhaseName)");
+    return NULL;
+}
+
+int compareNanos(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+// `samples` must be sorted.
+inline uint64_t percentile(uint64_t* samples, int length, int percent) {
+    int index = (length * percent + 99) / 100 - 1;
+    return samples[index < 0 ? 0 : index];
+}
+
+// Runs every phase over `code` once, adding each phase's time to `nanos`. Exits if the program doesn't compile, since
+// that means the generator is broken.
+int runPhases(Compiler* compiler, char* code, uint64_t nanos[BENCH_PHASE_COUNT]) {
+    resetCompiler(compiler);
+
+    uint64_t start = monotonicNanos();
+    Lexer lexer = makeLexer(code, "<generated>");
+    while (getToken(&lexer).type != TOKEN_EOF);
+    uint64_t end = monotonicNanos();
+    nanos[BENCH_LEX] = end - start;
+
+    start = end;
+    lexer = makeLexer(code, "<generated>");
+    bool success;
+    compiler->program = parseProgram(&compiler->list, &lexer, &success);
+    end = monotonicNanos();
+    nanos[BENCH_PARSE] = end - start;
+
+    start = end;
+    initSymbolTable(&compiler->table, compiler->program);
+    end = monotonicNanos();
+    nanos[BENCH_SYMBOLS] = end - start;
+
+    start = end;
+    success = success && verifyProgram(&compiler->table, compiler->program);
+    end = monotonicNanos();
+    nanos[BENCH_VERIFY] = end - start;
+
+    start = end;
+    success = success && typeCheckProgram(&compiler->table, compiler->program);
+    end = monotonicNanos();
+    nanos[BENCH_TYPE_CHECK] = end - start;
+
+    start = end;
+    emitProgram(&compiler->out, compiler->program);
+    end = monotonicNanos();
+    nanos[BENCH_EMIT] = end - start;
+
+    if (!success) {
+        fprintf(stderr, "ERROR! The generated program doesn't compile\n");
+        exit(1);
+    }
+
+    int nodes = 0;
+    for (int i = 0; i < NODE_COUNT; ++i) {
+        nodes += compiler->list.nodeCounts[i];
+    }
+    return nodes;
+}
+
+void printBenchUsage(FILE* stream) {
+    fprintf(stream,
+        "Usage: bench [options]\n"
+        "\n"
+        "Options:\n"
+        "  --functions=<n>        Functions in the generated program (default: 20)\n"
+        "  --statements=<n>       Statements in each function body (default: 16)\n"
+        "  --depth=<n>            How deeply ifs and whiles may nest (default: 3)\n"
+        "  --expr-depth=<n>       Operands in each expression (default: 4)\n"
+        "  --locals=<n>           Integer locals declared in each scope (default: 4)\n"
+        "  --arrays=<n>           Arrays declared in each scope (default: 1)\n"
+        "  --comments=<n>         Comments before each statement (default: 0)\n"
+        "  --literal-digits=<n>   Digits in literal operands, from 1 to 9 (default: 2)\n"
+        "  --seed=<n>             Seed for the generator (default: 1)\n"
+        "  --iterations=<n>       Times to run each phase (default: 10)\n"
+        "  --write=<path>         Write the generated program to <path> and exit.\n"
+        "  -h, --help             Print this message.\n");
+}
+
+// Parses the value of `--<name>=<n>` into `value`. Returns false if `arg` is some other option.
+bool parseIntOption(char* arg, char* name, int* value) {
+    size_t length = strlen(name);
+    if (strncmp(arg, name, length) != 0 || arg[length] != '=') {
+        return false;
+    }
+    char* end;
+    long parsed = strtol(arg + length + 1, &end, 10);
+    if (*end != '\0' || parsed < 0 || parsed > 1000000000) {
+        fprintf(stderr, "ERROR! Invalid value in \"%s\"\n", arg);
+        exit(1);
+    }
+    *value = (int)parsed;
+    return true;
+}
+
+int main(int argc, char** argv) {
+    Workload_Params params = {
+        .functions = 20,
+        .statements = 16,
+        .nestingDepth = 3,
+        .expressionDepth = 4,
+        .locals = 4,
+        .arrays = 1,
+        .comments = 0,
+        .literalDigits = 2,
+        .seed = 1,
+    };
+    int iterations = 10;
+    int seed = 1;
+    char* writePath = NULL;
+
+    for (int i = 1; i < argc; ++i) {
+        char* arg = argv[i];
+        if (parseIntOption(arg, "--functions", &params.functions)
+            || parseIntOption(arg, "--statements", &params.statements)
+            || parseIntOption(arg, "--depth", &params.nestingDepth)
+            || parseIntOption(arg, "--expr-depth", &params.expressionDepth)
+            || parseIntOption(arg, "--locals", &params.locals)
+            || parseIntOption(arg, "--arrays", &params.arrays)
+            || parseIntOption(arg, "--comments", &params.comments)
+            || parseIntOption(arg, "--literal-digits", &params.literalDigits)
+            || parseIntOption(arg, "--seed", &seed)
+            || parseIntOption(arg, "--iterations", &iterations)) {
+            continue;
+        }
+        if (strncmp(arg, "--write=", 8) == 0) {
+            writePath = arg + 8;
+        }
+        else if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
+            printBenchUsage(stdout);
+            return 0;
+        }
+        else {
+            fprintf(stderr, "ERROR! Unknown option \"%s\"\n", arg);
+            printBenchUsage(stderr);
+            return 1;
+        }
+    }
+    params.seed = (unsigned int)seed;
+    if (params.functions < 1 || params.expressionDepth < 1 || iterations < 1) {
+        fprintf(stderr, "ERROR! --functions, --expr-depth and --iterations must be at least 1\n");
+        return 1;
+    }
+    if (params.literalDigits < 1 || params.literalDigits > 9) {
+        fprintf(stderr, "ERROR! --literal-digits must be from 1 to 9\n");
+        return 1;
+    }
+
+    String_Builder source = {0};
+    generateWorkload(params, &source);
+    if (writePath != NULL) {
+        FILE* file = tryFOpen(writePath, "wb");
+        sbTryFWrite(&source, file);
+        fclose(file);
+        return 0;
+    }
+
+    uint64_t* samples[BENCH_PHASE_COUNT];
+    for (int i = 0; i < BENCH_PHASE_COUNT; ++i) {
+        samples[i] = malloc(iterations * sizeof(uint64_t));
+    }
+
+    // One untimed run warms the caches and grows the compiler's buffers to their final size.
+    Compiler compiler = makeCompiler();
+    uint64_t nanos[BENCH_PHASE_COUNT];
+    int nodes = runPhases(&compiler, source.data, nanos);
+    for (int i = 0; i < iterations; ++i) {
+        runPhases(&compiler, source.data, nanos);
+        for (int phase = 0; phase < BENCH_PHASE_COUNT; ++phase) {
+            samples[phase][i] = nanos[phase];
+        }
+    }
+
+    double megabytes = source.length / 1e6;
+    printf("Source: %.2f MB, %d nodes, %d functions, %d iterations\n", megabytes, nodes, params.functions, iterations);
+    printf("%-10s %12s %12s %12s %12s %14s %14s\n", "phase", "median ms", "p99 ms", "median MB/s", "p99 MB/s", "median nodes/s", "p99 nodes/s");
+    for (int phase = 0; phase < BENCH_PHASE_COUNT; ++phase) {
+        qsort(samples[phase], iterations, sizeof(uint64_t), compareNanos);
+        // The p99 time is the slow tail, so it gives the p99 (lowest) throughput.
+        double medianSeconds = percentile(samples[phase], iterations, 50) / 1e9;
+        double p99Seconds = percentile(samples[phase], iterations, 99) / 1e9;
+        if (medianSeconds <= 0) medianSeconds = 1e-9;
+        if (p99Seconds <= 0) p99Seconds = 1e-9;
+        printf("%-10s %12.3f %12.3f %12.1f %12.1f %14.0f %14.0f\n", benchPhaseName(phase),
+            medianSeconds * 1e3, p99Seconds * 1e3,
+            megabytes / medianSeconds, megabytes / p99Seconds,
+            nodes / medianSeconds, nodes / p99Seconds);
+    }
+    return 0;
+}
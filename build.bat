@@ -5,4 +5,5 @@ if not exist build (
     mkdir build
 )
 cl -Zi -W4 -WX -wd4201 -wd4701 -wd4703 -wd4715 -fsanitize=address -Fe:build\ -Fo:build\ -Fd:build\ lcom.c
+cl -O2 -W4 -WX -wd4201 -wd4701 -wd4703 -wd4715 -Fe:build\ -Fo:build\ bench\bench.c
 popd
@@ -1,4 +1,8 @@
 #include <stdbool.h>
+#include <stdint.h>
+
+int main();
+int func2(bool bool_val, int int_val);
 
 int main() {
     bool a[8];
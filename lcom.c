@@ -1,4 +1,5 @@
 #define _CRT_SECURE_NO_WARNINGS
+#define _POSIX_C_SOURCE 200809L // clock_gettime and friends under strict C modes
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,21 +8,205 @@
 #include <stdbool.h>
 #include <stdarg.h>
 #include <assert.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <limits.h>
+#include <stddef.h>
+#include <time.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <direct.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // IMPORTANT:
 // None
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL _Thread_local
+#endif
+
+// SSE2 is part of x86-64, so it is used whenever the target has it, and plain loops are used otherwise.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LCOM_SSE2
+#include <emmintrin.h>
+#endif
+
+// Eight digits of an integer literal are parsed as one word, which assumes the first byte is the lowest. Compilers that
+// don't say what the byte order is are taken to be little-endian, as MSVC only targets little-endian machines.
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define LCOM_LITTLE_ENDIAN
+#endif
+
+// Index of the lowest set bit of `mask`, which must not be zero.
+inline int lowestSetBit(unsigned int mask) {
+    assert(mask != 0);
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (int)index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+////////////////
+// Memory API //
+////////////////
+
+// The compiler's large allocations go through `memAlloc` and friends, which record how many bytes each subsystem has
+// allocated, so `--mem-stats` can tell which structure dominates on a huge input. Each block starts with a small header
+// holding its size and subsystem, so `memFree` doesn't need to be told either.
+
+typedef enum {
+    MEM_SOURCE,  // Source files read by `readEntireFile`
+    MEM_AST,     // Node buckets
+    MEM_PROGRAM, // `Program` function arrays
+    MEM_SYMBOLS, // Symbol table entries
+    MEM_SCOPES,  // Symbol table `Scope_Entry` array
+
+    // Used for static asserts
+    MEM_SUBSYSTEM_COUNT,
+} Mem_Subsystem;
+
+typedef struct {
+    size_t currentBytes[MEM_SUBSYSTEM_COUNT];
+    size_t peakBytes[MEM_SUBSYSTEM_COUNT];
+    size_t allocations[MEM_SUBSYSTEM_COUNT]; // Calls to `memAlloc` and `memRealloc`
+    size_t totalCurrentBytes;
+    size_t totalPeakBytes; // Peak of the sum over all subsystems, which can be less than the sum of their peaks
+} Memory_Stats;
+
+// Counted per thread, so the allocator never needs a lock.
+THREAD_LOCAL Memory_Stats memoryStats;
+
+typedef union {
+    struct {
+        size_t size;
+        Mem_Subsystem subsystem;
+    };
+    max_align_t align; // Keeps the memory after the header aligned for any type
+} Mem_Header;
+
+void memRecord(Mem_Subsystem subsystem, size_t oldSize, size_t newSize) {
+    memoryStats.currentBytes[subsystem] += newSize - oldSize;
+    memoryStats.totalCurrentBytes += newSize - oldSize;
+    if (memoryStats.currentBytes[subsystem] > memoryStats.peakBytes[subsystem]) {
+        memoryStats.peakBytes[subsystem] = memoryStats.currentBytes[subsystem];
+    }
+    if (memoryStats.totalCurrentBytes > memoryStats.totalPeakBytes) {
+        memoryStats.totalPeakBytes = memoryStats.totalCurrentBytes;
+    }
+}
+
+void* memAlloc(Mem_Subsystem subsystem, size_t size) {
+    Mem_Header* header = malloc(sizeof(Mem_Header) + size);
+    if (header == NULL) {
+        fprintf(stderr, "[ERROR]: Out of memory!\n");
+        exit(1);
+    }
+    header->size = size;
+    header->subsystem = subsystem;
+    ++memoryStats.allocations[subsystem];
+    memRecord(subsystem, 0, size);
+    return header + 1;
+}
+
+// Like `realloc`, `memory` may be NULL.
+void* memRealloc(Mem_Subsystem subsystem, void* memory, size_t size) {
+    if (memory == NULL) {
+        return memAlloc(subsystem, size);
+    }
+    Mem_Header* header = (Mem_Header*)memory - 1;
+    size_t oldSize = header->size;
+    assert(header->subsystem == subsystem);
+    header = realloc(header, sizeof(Mem_Header) + size);
+    if (header == NULL) {
+        fprintf(stderr, "[ERROR]: Out of memory!\n");
+        exit(1);
+    }
+    header->size = size;
+    ++memoryStats.allocations[subsystem];
+    memRecord(subsystem, oldSize, size);
+    return header + 1;
+}
+
+void memFree(void* memory) {
+    if (memory == NULL) {
+        return;
+    }
+    Mem_Header* header = (Mem_Header*)memory - 1;
+    memRecord(header->subsystem, header->size, 0);
+    free(header);
+}
+
+// Adds the counts from another thread's `stats` into this thread's. The peaks are added too, which overestimates the
+// combined peak if the threads didn't peak at the same time.
+void memMergeStats(Memory_Stats* stats) {
+    for (int i = 0; i < MEM_SUBSYSTEM_COUNT; ++i) {
+        memoryStats.currentBytes[i] += stats->currentBytes[i];
+        memoryStats.peakBytes[i] += stats->peakBytes[i];
+        memoryStats.allocations[i] += stats->allocations[i];
+    }
+    memoryStats.totalCurrentBytes += stats->totalCurrentBytes;
+    memoryStats.totalPeakBytes += stats->totalPeakBytes;
+}
+
+char* memSubsystemName(Mem_Subsystem subsystem) {
+    switch (subsystem) {
+        case MEM_SOURCE: return "source";
+        case MEM_AST: return "AST nodes";
+        case MEM_PROGRAM: return "programs";
+        case MEM_SYMBOLS: return "symbols";
+        case MEM_SCOPES: return "scopes";
+    }
+    static_assert(MEM_SUBSYSTEM_COUNT == 5, "Non-exhaustive cases (memSubsystemName)");
+    assert(false && "Unreachable (memSubsystemName)");
+    return NULL;
+}
+
+void printMemoryStats(FILE* stream) {
+    fprintf(stream, "Memory:\n");
+    fprintf(stream, "  %-14s %14s %14s %12s\n", "subsystem", "peak bytes", "live bytes", "allocations");
+    for (int i = 0; i < MEM_SUBSYSTEM_COUNT; ++i) {
+        fprintf(stream, "  %-14s %14zu %14zu %12zu\n", memSubsystemName(i), memoryStats.peakBytes[i], memoryStats.currentBytes[i], memoryStats.allocations[i]);
+    }
+    fprintf(stream, "  %-14s %14zu %14zu\n", "total", memoryStats.totalPeakBytes, memoryStats.totalCurrentBytes);
+}
+
+
+
 //////////////
 // File API //
 //////////////
 
+void diagnosticf(char* fmt, ...); // Defined in the error API
+
+// Set while a fatal error should only abandon the current compile instead of exiting (see the compile server).
+THREAD_LOCAL jmp_buf* fatalErrorJump = NULL;
+
+void fatalExit(void) {
+    if (fatalErrorJump != NULL) {
+        longjmp(*fatalErrorJump, 1);
+    }
+    exit(1);
+}
+
 FILE* tryFOpen(char* filePath, char* mode) {
     FILE* file = fopen(filePath, mode);
     if (!file) {
-        fprintf(stderr, "[ERROR]: Could not open file %s in mode \"rb\".\nReason: %s\n", filePath, strerror(errno));
-        exit(1);
+        diagnosticf("[ERROR]: Could not open file %s in mode \"rb\".\nReason: %s\n", filePath, strerror(errno));
+        fatalExit();
     }
     return file;
 }
@@ -29,16 +214,16 @@ FILE* tryFOpen(char* filePath, char* mode) {
 void tryFSeek(FILE* file, long offset, int origin) {
     int res = fseek(file, offset, origin);
     if (res) {
-        fprintf(stderr, "[ERROR]: Seek failed!\nReason: %s\n", strerror(errno));
-        exit(1);
+        diagnosticf("[ERROR]: Seek failed!\nReason: %s\n", strerror(errno));
+        fatalExit();
     }
 }
 
 long tryFTell(FILE* file) {
     long pos = ftell(file);
     if (pos < 0) {
-        fprintf(stderr, "[ERROR]: Tell failed!\nReason: %s\n", strerror(errno));
-        exit(1);
+        diagnosticf("[ERROR]: Tell failed!\nReason: %s\n", strerror(errno));
+        fatalExit();
     }
     return pos;
 }
@@ -46,16 +231,16 @@ long tryFTell(FILE* file) {
 void tryFRead(void* buffer, size_t size, size_t count, FILE* stream) {
     fread(buffer, size, count, stream);
     if (ferror(stream)) {
-        fprintf(stderr, "[ERROR]: Could not read from file!\nReason: %s\n", strerror(errno));
-        exit(1);
+        diagnosticf("[ERROR]: Could not read from file!\nReason: %s\n", strerror(errno));
+        fatalExit();
     }
 }
 
 void tryFPuts(char* str, FILE* file) {
     fputs(str, file);
     if (ferror(file)) {
-        fprintf(stderr, "[ERROR]: Could not write to file!\nReason: %s\n", strerror(errno));
-        exit(1);
+        diagnosticf("[ERROR]: Could not write to file!\nReason: %s\n", strerror(errno));
+        fatalExit();
     }
 }
 
@@ -69,8 +254,8 @@ void tryFPutsIndented(int indent, char* str, FILE* file) {
 void tryFWrite(void* buffer, size_t size, size_t count, FILE* stream) {
     fwrite(buffer, size, count, stream);
     if (ferror(stream)) {
-        fprintf(stderr, "[ERROR]: Could not write to file!\nReason: %s\n", strerror(errno));
-        exit(1);
+        diagnosticf("[ERROR]: Could not write to file!\nReason: %s\n", strerror(errno));
+        fatalExit();
     }
 }
 
@@ -83,8 +268,8 @@ void tryFWriteIndented(int indent, void* buffer, size_t size, size_t count, FILE
 
 void vTryFPrintf(FILE* stream, char* fmt, va_list args) {
     if(vfprintf(stream, fmt, args) < 0) {
-        fprintf(stderr, "[ERROR]: Could not write to file!\nReason: %s\n", strerror(errno));
-        exit(1);
+        diagnosticf("[ERROR]: Could not write to file!\nReason: %s\n", strerror(errno));
+        fatalExit();
     }
 }
 
@@ -115,7 +300,7 @@ long getFileSize(FILE* file) {
 char* readEntireFile(char* filePath) {
     FILE* file = tryFOpen(filePath, "rb");
     long fileSize = getFileSize(file);
-    char* contents = malloc(fileSize + 1);
+    char* contents = memAlloc(MEM_SOURCE, fileSize + 1);
     tryFRead(contents, 1, fileSize, file);
     contents[fileSize] = '\0';
     fclose(file);
@@ -168,16 +353,145 @@ String_View svUntil(char delim, char* cstr) {
     return (String_View){cstr, length};
 }
 
+// 64-bit FNV-1a
+uint64_t hashBytes(char* data, size_t length) {
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= (uint8_t)data[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// A checksum for large buffers, such as cache files. It reads words rather than bytes, and keeps four independent
+// lanes so that the multiplies don't wait on each other. It only has to catch damage, so it mixes less than `hashBytes`.
+uint64_t checksumBytes(char* data, size_t length) {
+    uint64_t lanes[4] = {1, 2, 3, 4};
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        for (int lane = 0; lane < 4; ++lane) {
+            uint64_t word;
+            memcpy(&word, data + i + lane * 8, 8);
+            lanes[lane] = (lanes[lane] ^ word) * 0x9e3779b97f4a7c15ull;
+        }
+    }
+    uint64_t hash = hashBytes(data + i, length - i);
+    for (int lane = 0; lane < 4; ++lane) {
+        hash = (hash ^ lanes[lane] ^ (lanes[lane] >> 32)) * 1099511628211ull;
+    }
+    return hash;
+}
+
 inline void svTryFWrite(String_View sv, FILE* file) {
     tryFWrite(sv.start, 1, sv.length, file);
 }
 
 
 
+////////////////////////
+// String Builder API //
+////////////////////////
+
+typedef struct {
+    char* data;
+    int length;
+    int capacity;
+} String_Builder;
+
+void sbReserve(String_Builder* sb, int extra) {
+    if (sb->length + extra + 1 > sb->capacity) {
+        int capacity = sb->capacity == 0 ? 256 : sb->capacity;
+        while (sb->length + extra + 1 > capacity) {
+            capacity *= 2;
+        }
+        sb->data = realloc(sb->data, capacity);
+        sb->capacity = capacity;
+    }
+}
+
+void sbAppendBytes(String_Builder* sb, char* bytes, int length) {
+    sbReserve(sb, length);
+    memcpy(sb->data + sb->length, bytes, length);
+    sb->length += length;
+    sb->data[sb->length] = '\0';
+}
+
+inline void sbAppend(String_Builder* sb, char* cstr) {
+    sbAppendBytes(sb, cstr, (int)strlen(cstr));
+}
+
+void sbAppendIndented(int indent, String_Builder* sb, char* cstr) {
+    for (int i = 0; i < indent; ++i) {
+        sbAppendBytes(sb, "    ", 4);
+    }
+    sbAppend(sb, cstr);
+}
+
+void vSbPrintf(String_Builder* sb, char* fmt, va_list args) {
+    va_list argsCopy;
+    va_copy(argsCopy, args);
+    int length = vsnprintf(NULL, 0, fmt, argsCopy);
+    va_end(argsCopy);
+    assert(length >= 0);
+
+    sbReserve(sb, length);
+    vsnprintf(sb->data + sb->length, length + 1, fmt, args);
+    sb->length += length;
+}
+
+void sbPrintf(String_Builder* sb, char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    vSbPrintf(sb, fmt, args);
+    va_end(args);
+}
+
+void sbPrintfIndented(int indent, String_Builder* sb, char* fmt, ...) {
+    for (int i = 0; i < indent; ++i) {
+        sbAppendBytes(sb, "    ", 4);
+    }
+    va_list args;
+    va_start(args, fmt);
+    vSbPrintf(sb, fmt, args);
+    va_end(args);
+}
+
+inline void sbReset(String_Builder* sb) {
+    sb->length = 0;
+    if (sb->data != NULL) {
+        sb->data[0] = '\0';
+    }
+}
+
+void sbTryFWrite(String_Builder* sb, FILE* file) {
+    tryFWrite(sb->data, 1, sb->length, file);
+}
+
+
+
 ///////////////
 // Error API //
 ///////////////
 
+// When set, diagnostics are collected here instead of being printed, e.g. so the compile server can send them back.
+THREAD_LOCAL String_Builder* diagnosticsBuffer = NULL;
+
+void vDiagnosticf(char* fmt, va_list args) {
+    if (diagnosticsBuffer != NULL) {
+        vSbPrintf(diagnosticsBuffer, fmt, args);
+    }
+    else {
+        vfprintf(stderr, fmt, args);
+    }
+}
+
+void diagnosticf(char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    vDiagnosticf(fmt, args);
+    va_end(args);
+}
+
 typedef struct {
     int lineNumStart;
     int charNumStart;
@@ -189,45 +503,119 @@ typedef struct {
 
 void printScope(Lex_Scope scope) {
     if (scope.lineNumStart == scope.lineNumEnd) {
-        printf("  "SV_FMT"\n", SV_ARG(scope.lineStart));
-        printf("  ");
+        diagnosticf("  "SV_FMT"\n", SV_ARG(scope.lineStart));
+        diagnosticf("  ");
         for (int i = 0; i < scope.charNumStart; ++i) {
-            printf(" ");
+            diagnosticf(" ");
         }
         for (int i = 0; i < scope.charNumEnd - scope.charNumStart; ++i) {
-            printf("^");
+            diagnosticf("^");
         }
     }
     else {
-        printf("  Line %5d: "SV_FMT"\n", scope.lineNumStart + 1, SV_ARG(scope.lineStart));
-        printf("   ...         ");
+        diagnosticf("  Line %5d: "SV_FMT"\n", scope.lineNumStart + 1, SV_ARG(scope.lineStart));
+        diagnosticf("   ...         ");
         for (int i = 0; i < scope.charNumStart; ++i) {
-            printf(" ");
+            diagnosticf(" ");
         }
         for (int i = scope.charNumStart; i < scope.lineStart.length; ++i) {
-            printf("^");
+            diagnosticf("^");
         }
-        printf("  Line %5d: "SV_FMT"\n", scope.lineNumEnd + 1, SV_ARG(scope.lineEnd));
-        printf("               ");
+        diagnosticf("  Line %5d: "SV_FMT"\n", scope.lineNumEnd + 1, SV_ARG(scope.lineEnd));
+        diagnosticf("               ");
         for (size_t i = 0; i < scope.charNumEnd; ++i) {
-            printf("^");
+            diagnosticf("^");
         }
     }
-    printf("\n");
+    diagnosticf("\n");
 }
 
 void printErrorMessage(char* fileName, Lex_Scope scope, char* fmt, ...) {
-    printf("%s:%d:%d: ERROR! ", fileName, scope.lineNumStart + 1, scope.charNumStart + 1);
+    diagnosticf("%s:%d:%d: ERROR! ", fileName, scope.lineNumStart + 1, scope.charNumStart + 1);
     va_list args;
     va_start(args, fmt);
-    vprintf(fmt, args);
+    vDiagnosticf(fmt, args);
     va_end(args);
-    printf(":\n");
+    diagnosticf(":\n");
     printScope(scope);
 }
 
 
 
+///////////////
+// Trace API //
+///////////////
+
+// `--trace` records when each phase, and each function within a phase, begins and ends, in the Chrome trace event
+// format, so a slow compile can be opened in a trace viewer (chrome://tracing or Perfetto). Each thread records into
+// its own `Trace`, and the driver writes them all out at the end.
+
+typedef struct {
+    String_Builder events; // Comma-separated trace events
+    int threadId;
+} Trace;
+
+// NULL unless this thread is tracing.
+THREAD_LOCAL Trace* activeTrace = NULL;
+// Timestamps are relative to this, so all threads share a timeline.
+uint64_t traceStartNanos = 0;
+
+uint64_t monotonicNanos(void) {
+#ifdef _WIN32
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (uint64_t)((double)counter.QuadPart * 1e9 / (double)frequency.QuadPart);
+#else
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t)time.tv_sec * 1000000000ull + (uint64_t)time.tv_nsec;
+#endif
+}
+
+void traceEvent(char phase, char* category, String_View name) {
+    if (activeTrace == NULL) {
+        return;
+    }
+
+    String_Builder* events = &activeTrace->events;
+    if (events->length > 0) {
+        sbAppend(events, ",\n");
+    }
+    sbAppend(events, "{\"name\": \"");
+    // Names are identifiers or file paths. Windows paths are full of backslashes, which need escaping in JSON.
+    for (int i = 0; i < name.length; ++i) {
+        if (name.start[i] == '"' || name.start[i] == '\\') {
+            sbAppendBytes(events, "\\", 1);
+        }
+        sbAppendBytes(events, &name.start[i], 1);
+    }
+    double micros = (monotonicNanos() - traceStartNanos) / 1e3;
+    sbPrintf(events, "\", \"cat\": \"%s\", \"ph\": \"%c\", \"ts\": %.3f, \"pid\": 1, \"tid\": %d}", category, phase, micros, activeTrace->threadId);
+}
+
+inline void traceBegin(char* category, String_View name) {
+    traceEvent('B', category, name);
+}
+
+inline void traceEnd(char* category, String_View name) {
+    traceEvent('E', category, name);
+}
+
+// Writes the events from `trace` to `path` as a Chrome trace file. Returns false if the file couldn't be written.
+bool writeTraceFile(char* path, Trace* trace) {
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        return false;
+    }
+    bool written = fputs("{\"traceEvents\": [\n", file) >= 0
+        && fwrite(trace->events.data, 1, trace->events.length, file) == (size_t)trace->events.length
+        && fputs("\n]}\n", file) >= 0;
+    return fclose(file) == 0 && written;
+}
+
+
+
 ///////////////
 // Lexer API //
 ///////////////
@@ -277,7 +665,8 @@ typedef enum {
     TOKEN_INT,
     TOKEN_BOOL,
 
-    // Used to communicate that a token tried to be constructed, but was not of the expected type.
+    // Used to communicate that a token tried to be constructed, but was not of the expected type. `getToken` also
+    // returns it for a block comment that is never closed.
     TOKEN_ERROR,
 
     // Used for static asserts
@@ -291,9 +680,10 @@ typedef struct {
     String_View line;
     String_View text;
     union {
-        int intValue;
+        uint64_t intValue; // A `-` is lexed as an operator, so literals are never negative
         bool boolValue;
     };
+    bool intOverflow; // The TOKEN_INT doesn't fit in 64 bits, so `intValue` is meaningless
 } Token;
 
 bool isOperator(Token_Type type) {
@@ -345,6 +735,9 @@ typedef struct {
     int lineNum;
     int charNum;
     String_View line;
+
+    int tokensLexed; // Tokens returned by `getToken`. Peeks lex on a copy of the lexer, so they aren't included.
+    int peeks;
 } Lexer;
 
 inline Token makeToken(Lexer* lexer, Token_Type type, int textLength) {
@@ -363,7 +756,9 @@ inline Lexer makeLexer(char* code, char* fileName) {
         .fileName = fileName,
         .lineNum = 0,
         .charNum = 0,
-        .line = svUntil('\n', code)
+        .line = svUntil('\n', code),
+        .tokensLexed = 0,
+        .peeks = 0,
     };
 }
 
@@ -379,7 +774,56 @@ inline void lexerAdvance(Lexer* lexer, size_t steps) {
     }
 }
 
-inline bool isLexemeTerminator(char c) {
+// Moves the lexer forward to `end`, finding the newlines in between with `memchr` rather than looking at every byte.
+void lexerSkipTo(Lexer* lexer, char* end) {
+    assert(end >= lexer->code);
+    char* lineStart = NULL;
+    for (char* p = memchr(lexer->code, '\n', end - lexer->code); p != NULL; p = memchr(p + 1, '\n', end - p - 1)) {
+        lexer->lineNum++;
+        lineStart = p + 1;
+    }
+    if (lineStart != NULL) {
+        lexer->line = svUntil('\n', lineStart);
+        lexer->charNum = (int)(end - lineStart);
+    }
+    else {
+        lexer->charNum += (int)(end - lexer->code);
+    }
+    lexer->code = end;
+}
+
+// Skips whitespace and comments. Returns false, leaving the lexer at the "/*", if a block comment is never closed.
+bool lexerSkipTrivia(Lexer* lexer) {
+    while (true) {
+        while (isspace(*lexer->code)) {
+            lexerAdvance(lexer, 1);
+        }
+        if (lexer->code[0] != '/') {
+            return true;
+        }
+        if (lexer->code[1] == '/') {
+            // The end of the current line is already known, so a line comment is skipped without scanning it.
+            char* lineEnd = lexer->line.start + lexer->line.length;
+            assert(lineEnd >= lexer->code);
+            lexer->charNum += (int)(lineEnd - lexer->code);
+            lexer->code = lineEnd;
+        }
+        else if (lexer->code[1] == '*') {
+            char* end = strstr(lexer->code + 2, "*/");
+            if (end == NULL) {
+                return false;
+            }
+            lexerSkipTo(lexer, end + 2);
+        }
+        else {
+            return true;
+        }
+    }
+}
+
+// Whether the lexeme ends before `*code`. A comment ends it too, so it needs the byte after.
+inline bool isLexemeTerminator(char* code) {
+    char c = *code;
     return isspace(c)
         || c == '\0'
         || c == ','
@@ -390,46 +834,78 @@ inline bool isLexemeTerminator(char c) {
         || c == ';'
         || c == ':'
         || c == '['
-        || c == ']';
+        || c == ']'
+        || (c == '/' && (code[1] == '/' || code[1] == '*'));
 }
 
+#ifdef LCOM_LITTLE_ENDIAN
+// Whether all eight bytes of `word` are ASCII digits. Adding 6 carries a digit past '9' into the high nibble.
+inline bool isEightDigits(uint64_t word) {
+    return ((word & 0xF0F0F0F0F0F0F0F0) | (((word + 0x0606060606060606) & 0xF0F0F0F0F0F0F0F0) >> 4)) == 0x3333333333333333;
+}
+
+// The value of the eight digits in `word`. Each step combines neighbouring pairs of numbers into one, so 8 digits
+// become 4 two-digit numbers, then 2 four-digit numbers and then the result.
+inline uint64_t parseEightDigits(uint64_t word) {
+    word = (word & 0x0F0F0F0F0F0F0F0F) * (1 + (10 << 8)) >> 8;
+    word = (word & 0x00FF00FF00FF00FF) * (1 + (100 << 16)) >> 16;
+    return (word & 0x0000FFFF0000FFFF) * (1 + (10000ULL << 32)) >> 32;
+}
+#endif
+
+// Called when `getToken` sees a digit. Long literals, like the ones in generated tables, are parsed eight digits at a
+// time. A literal that doesn't fit in 64 bits is still a TOKEN_INT, but with `intOverflow` set, so the parser can say
+// what is wrong with it.
 Token getIntToken(Lexer* lexer) {
-    int intLength = 0;
-    bool negative = false;
-    if (*lexer->code == '+') {
-        intLength++;
-    }
-    else if (*lexer->code == '-') {
-        negative = true;
-        intLength++;
+    char* code = lexer->code;
+    uint64_t value = 0;
+    bool overflow = false;
+#ifdef LCOM_LITTLE_ENDIAN
+    // Everything up to the end of the line is in the buffer, so words are only read before it.
+    char* lineEnd = lexer->line.start + lexer->line.length;
+    while (lineEnd - code >= 8) {
+        uint64_t word;
+        memcpy(&word, code, 8);
+        if (!isEightDigits(word)) {
+            break;
+        }
+        uint64_t digits = parseEightDigits(word);
+        // UINT64_MAX is 184467440737'09551615
+        overflow |= value > 184467440737ULL || (value == 184467440737ULL && digits > 9551615);
+        value = value * 100000000 + digits;
+        code += 8;
     }
-    bool zero = lexer->code[intLength] == '0' && isLexemeTerminator(lexer->code[intLength + 1]);
-    if (!zero && (lexer->code[intLength] < '1' || lexer->code[intLength] > '9')) {
-        return (Token){TOKEN_ERROR};
+#endif
+    for (; *code >= '0' && *code <= '9'; ++code) {
+        uint64_t digit = (uint64_t)(*code - '0');
+        overflow |= value > UINT64_MAX / 10 || (value == UINT64_MAX / 10 && digit > UINT64_MAX % 10);
+        value = value * 10 + digit;
     }
-    int value = lexer->code[intLength] - '0';
-    intLength++;
-    for (; !isLexemeTerminator(lexer->code[intLength]); ++intLength) {
-        if (lexer->code[intLength] < '0' || lexer->code[intLength] > '9') {
-            return (Token){TOKEN_ERROR};
-        }
-        value *= 10;
-        value += lexer->code[intLength] - '0';
+
+    int intLength = (int)(code - lexer->code);
+    bool leadingZero = lexer->code[0] == '0' && intLength > 1;
+    if (leadingZero || !isLexemeTerminator(code)) {
+        // Something like `08` or `12ab`. The whole lexeme goes into the error token.
+        for (; !isLexemeTerminator(&lexer->code[intLength]); ++intLength);
+        Token result = makeToken(lexer, TOKEN_ERROR, intLength);
+        lexerAdvance(lexer, intLength);
+        return result;
     }
     Token result = makeToken(lexer, TOKEN_INT, intLength);
     lexerAdvance(lexer, intLength);
-    result.intValue = negative ? -value : value;
+    result.intValue = value;
+    result.intOverflow = overflow;
     return result;
 }
 
 Token getBoolToken(Lexer* lexer) {
-    if (strncmp(lexer->code, "true", 4) == 0 && isLexemeTerminator(lexer->code[4])) {
+    if (strncmp(lexer->code, "true", 4) == 0 && isLexemeTerminator(&lexer->code[4])) {
         Token token = makeToken(lexer, TOKEN_BOOL, 4);
         token.boolValue = true;
         lexerAdvance(lexer, 4);
         return token;
     }
-    else if (strncmp(lexer->code, "false", 5) == 0 && isLexemeTerminator(lexer->code[5])) {
+    else if (strncmp(lexer->code, "false", 5) == 0 && isLexemeTerminator(&lexer->code[5])) {
         Token token = makeToken(lexer, TOKEN_BOOL, 5);
         token.boolValue = false;
         lexerAdvance(lexer, 5);
@@ -441,7 +917,7 @@ Token getBoolToken(Lexer* lexer) {
 Token getKeywordToken(Lexer* lexer) {
     switch (*lexer->code) {
         case 'b': {
-            if (strncmp(lexer->code, "bool", 4) == 0 && isLexemeTerminator(lexer->code[4])) {
+            if (strncmp(lexer->code, "bool", 4) == 0 && isLexemeTerminator(&lexer->code[4])) {
                 Token token = makeToken(lexer, TOKEN_BOOLTYPE_KEYWORD, 4);
                 lexerAdvance(lexer, 4);
                 return token;
@@ -449,7 +925,7 @@ Token getKeywordToken(Lexer* lexer) {
             break;
         }
         case 'e': {
-            if (strncmp(lexer->code, "else", 4) == 0 && isLexemeTerminator(lexer->code[4])) {
+            if (strncmp(lexer->code, "else", 4) == 0 && isLexemeTerminator(&lexer->code[4])) {
                 Token token = makeToken(lexer, TOKEN_ELSE_KEYWORD, 4);
                 lexerAdvance(lexer, 4);
                 return token;
@@ -457,7 +933,7 @@ Token getKeywordToken(Lexer* lexer) {
             break;
         }
         case 'f': {
-            if (strncmp(lexer->code, "func", 4) == 0 && isLexemeTerminator(lexer->code[4])) {
+            if (strncmp(lexer->code, "func", 4) == 0 && isLexemeTerminator(&lexer->code[4])) {
                 Token token = makeToken(lexer, TOKEN_FUNC_KEYWORD, 4);
                 lexerAdvance(lexer, 4);
                 return token;
@@ -465,12 +941,12 @@ Token getKeywordToken(Lexer* lexer) {
             break;
         }
         case 'i': {
-            if (strncmp(lexer->code, "int", 3) == 0 && isLexemeTerminator(lexer->code[3])) {
+            if (strncmp(lexer->code, "int", 3) == 0 && isLexemeTerminator(&lexer->code[3])) {
                 Token token = makeToken(lexer, TOKEN_INTTYPE_KEYWORD, 3);
                 lexerAdvance(lexer, 3);
                 return token;
             }
-            else if (strncmp(lexer->code, "if", 2) == 0 && isLexemeTerminator(lexer->code[2])) {
+            else if (strncmp(lexer->code, "if", 2) == 0 && isLexemeTerminator(&lexer->code[2])) {
                 Token token = makeToken(lexer, TOKEN_IF_KEYWORD, 2);
                 lexerAdvance(lexer, 2);
                 return token;
@@ -478,7 +954,7 @@ Token getKeywordToken(Lexer* lexer) {
             break;
         }
         case 'r': {
-            if (strncmp(lexer->code, "return", 6) == 0 && isLexemeTerminator(lexer->code[6])) {
+            if (strncmp(lexer->code, "return", 6) == 0 && isLexemeTerminator(&lexer->code[6])) {
                 Token token = makeToken(lexer, TOKEN_RETURN_KEYWORD, 6);
                 lexerAdvance(lexer, 6);
                 return token;
@@ -486,7 +962,7 @@ Token getKeywordToken(Lexer* lexer) {
             break;
         }
         case 'u': {
-            if (strncmp(lexer->code, "unit", 4) == 0 && isLexemeTerminator(lexer->code[4])) {
+            if (strncmp(lexer->code, "unit", 4) == 0 && isLexemeTerminator(&lexer->code[4])) {
                 Token token = makeToken(lexer, TOKEN_UNITTYPE_KEYWORD, 4);
                 lexerAdvance(lexer, 4);
                 return token;
@@ -494,7 +970,7 @@ Token getKeywordToken(Lexer* lexer) {
             break;
         }
         case 'w': {
-            if (strncmp(lexer->code, "while", 5) == 0 && isLexemeTerminator(lexer->code[5])) {
+            if (strncmp(lexer->code, "while", 5) == 0 && isLexemeTerminator(&lexer->code[5])) {
                 Token token = makeToken(lexer, TOKEN_WHILE_KEYWORD, 5);
                 lexerAdvance(lexer, 5);
                 return token;
@@ -506,15 +982,19 @@ Token getKeywordToken(Lexer* lexer) {
 
 inline Token getIdentToken(Lexer* lexer) {
     int identLength = 0;
-    for (; !isLexemeTerminator(lexer->code[identLength]); ++identLength);
+    for (; !isLexemeTerminator(&lexer->code[identLength]); ++identLength);
     Token token = makeToken(lexer, TOKEN_IDENT, identLength);
     lexerAdvance(lexer, identLength);
     return token;
 }
 
 Token getToken(Lexer* lexer) {
-    while (isspace(*lexer->code)) {
-        lexerAdvance(lexer, 1);
+    ++lexer->tokensLexed;
+    if (!lexerSkipTrivia(lexer)) {
+        // The rest of the file is in the comment, so the error token is the last one.
+        Token result = makeToken(lexer, TOKEN_ERROR, 2);
+        lexerSkipTo(lexer, lexer->code + strlen(lexer->code));
+        return result;
     }
 
     switch(*lexer->code) {
@@ -613,12 +1093,11 @@ Token getToken(Lexer* lexer) {
             }
             return result;
         }
+        case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9': {
+            return getIntToken(lexer);
+        }
         default: {
-            Token result = getIntToken(lexer);
-            if (result.type != TOKEN_ERROR) {
-                return result;
-            }
-            result = getBoolToken(lexer);
+            Token result = getBoolToken(lexer);
             if (result.type != TOKEN_ERROR) {
                 return result;
             }
@@ -633,6 +1112,7 @@ Token getToken(Lexer* lexer) {
 }
 
 inline Token peekToken(Lexer* lexer) {
+    ++lexer->peeks;
     Lexer newLexer = *lexer;
     Token token = getToken(&newLexer);
     return token;
@@ -664,6 +1144,9 @@ void printToken(Token token) {
         case TOKEN_RBRACKET:
             printf("Type: RBRACKET, text: "SV_FMT"\n", SV_ARG(token.text));
             break;
+        case TOKEN_COLON:
+            printf("Type: COLON, text: "SV_FMT"\n", SV_ARG(token.text));
+            break;
         case TOKEN_DOUBLE_COLON:
             printf("Type: DOUBLE_COLON, text: "SV_FMT"\n", SV_ARG(token.text));
             break;
@@ -688,6 +1171,9 @@ void printToken(Token token) {
         case TOKEN_SLASH:
             printf("Type: SLASH, text: "SV_FMT"\n", SV_ARG(token.text));
             break;
+        case TOKEN_ARROW:
+            printf("Type: ARROW, text: "SV_FMT"\n", SV_ARG(token.text));
+            break;
         case TOKEN_FUNC_KEYWORD:
             printf("Type: FUNC_KEYWORD, text: "SV_FMT"\n", SV_ARG(token.text));
             break;
@@ -721,6 +1207,9 @@ void printToken(Token token) {
         case TOKEN_BOOL:
             printf("Type: BOOL, text: "SV_FMT"\n", SV_ARG(token.text));
             break;
+        case TOKEN_ERROR:
+            printf("Type: ERROR, text: "SV_FMT"\n", SV_ARG(token.text));
+            break;
     }
     static_assert(TOKEN_COUNT == 30, "Non-exhaustive cases (printToken)");
 }
@@ -752,6 +1241,9 @@ typedef enum {
 
     // Other expression nodes
     NODE_ARRAY_ACCESS,
+    NODE_CALL,
+    NODE_CALL_ARGS,  // Argument lists passed to calls
+    NODE_CONVERT,    // Conversions between integer types, like `i64(x)`
 
     // Boolean operators
     NODE_IS_EQUAL,
@@ -768,19 +1260,105 @@ typedef enum {
     // Identifiers
     NODE_IDENT,
 
+    // Only made by the optimizer, so these never reach the cache
+    NODE_SHIFT_LEFT,
+    NODE_DIVIDE_CONSTANT,
+
     // Used for static asserts
     NODE_COUNT,
 } Node_Type;
 
+// Turns signed division by a constant into a multiply-high sequence: the high half of `multiplier * n`, plus
+// `adjust * n`, shifted right by `shift`, and rounded towards zero. See `divisionMagic`.
+typedef struct {
+    int32_t multiplier;
+    int shift;
+    int adjust; // -1, 0 or 1
+} Division_Magic;
+
 typedef enum {
     TYPE_INT,
     TYPE_BOOL,
     TYPE_USER,
     TYPE_UNIT,
 
+    // Fixed-width integers
+    TYPE_I8,
+    TYPE_I16,
+    TYPE_I32,
+    TYPE_I64,
+    TYPE_U8,
+    TYPE_U16,
+    TYPE_U32,
+    TYPE_U64,
+
     TYPE_UNKNOWN, // Currently used for type checking errors, although could be used for type inference in the future.
 } Type_Id;
 
+typedef struct {
+    char* name;  // As written in lcl
+    char* cName; // As emitted
+    int bits;    // 0 if the type isn't an integer
+    bool isSigned;
+} Integer_Type;
+
+// `int` is C's `int`, which is 32 bits on every target lcom supports. The fixed-width types come from <stdint.h>.
+Integer_Type integerTypes[TYPE_UNKNOWN + 1] = {
+    [TYPE_INT] = {"int", "int",      32, true},
+    [TYPE_I8]  = {"i8",  "int8_t",   8,  true},
+    [TYPE_I16] = {"i16", "int16_t",  16, true},
+    [TYPE_I32] = {"i32", "int32_t",  32, true},
+    [TYPE_I64] = {"i64", "int64_t",  64, true},
+    [TYPE_U8]  = {"u8",  "uint8_t",  8,  false},
+    [TYPE_U16] = {"u16", "uint16_t", 16, false},
+    [TYPE_U32] = {"u32", "uint32_t", 32, false},
+    [TYPE_U64] = {"u64", "uint64_t", 64, false},
+};
+
+// Returns the fixed-width integer type called `name`, or TYPE_UNKNOWN if there is none. These aren't keywords, so
+// `parseType` asks for every identifier used as a type.
+Type_Id findIntegerType(String_View name) {
+    for (Type_Id id = TYPE_I8; id <= TYPE_U64; ++id) {
+        if (svEqualsCStr(name, integerTypes[id].name)) {
+            return id;
+        }
+    }
+    return TYPE_UNKNOWN;
+}
+
+// Whether arithmetic in `type` has to be wrapped around at its width. `int` is left to the backends, as it always has
+// been, and the 64-bit types are as wide as a `Value`.
+inline bool isNarrowType(Type_Id type) {
+    return type >= TYPE_I8 && type <= TYPE_U64 && integerTypes[type].bits < 64;
+}
+
+// Truncates `value` to the width of the narrow `type`, and sign or zero extends it back to 64 bits.
+inline long long narrowInteger(Type_Id type, uint64_t value) {
+    int shift = 64 - integerTypes[type].bits;
+    if (integerTypes[type].isSigned) {
+        return (long long)(value << shift) >> shift;
+    }
+    return (long long)(value << shift >> shift);
+}
+
+// Whether every value of `from` is also a value of `to`. Only these conversions are allowed, so they never change a
+// value, and a narrowing conversion is a compile error rather than a silent truncation.
+bool integerTypeHolds(Type_Id to, Type_Id from) {
+    Integer_Type toInfo = integerTypes[to];
+    Integer_Type fromInfo = integerTypes[from];
+    if (toInfo.isSigned == fromInfo.isSigned) {
+        return toInfo.bits >= fromInfo.bits;
+    }
+    return toInfo.isSigned && toInfo.bits > fromInfo.bits;
+}
+
+// Whether a literal of magnitude `value` is a value of `type`. Every literal the lexer accepts fits in a u64.
+bool integerTypeHoldsValue(Type_Id type, uint64_t value) {
+    Integer_Type info = integerTypes[type];
+    int valueBits = info.isSigned ? info.bits - 1 : info.bits;
+    return valueBits == 64 || value >> valueBits == 0;
+}
+
 typedef struct {
     String_View name;
     Type_Id id;
@@ -802,6 +1380,9 @@ Type getUnmodifiedTypeFromSv(String_View sv) {
     else if (svEqualsCStr(sv, "unit")) {
         type.id = TYPE_UNIT;
     }
+    else if (findIntegerType(sv) != TYPE_UNKNOWN) {
+        type.id = findIntegerType(sv);
+    }
     else {
         type.id = TYPE_USER;
     }
@@ -813,6 +1394,16 @@ inline bool typeEquals(Type t1, Type t2) {
     return t1.id == t2.id && t1.size == t2.size;
 }
 
+// Whether `type` is `int` or a fixed-width integer. Arrays of them aren't.
+inline bool isIntegerType(Type type) {
+    return type.size < 0 && integerTypes[type.id].bits != 0;
+}
+
+// Number of frame slots a variable of `type` takes. Arrays take one slot per element.
+inline int typeSlotCount(Type type) {
+    return type.size >= 0 ? type.size : 1;
+}
+
 inline Type makeType(Type_Id id) {
     switch (id) {
         case TYPE_UNIT:
@@ -836,6 +1427,20 @@ inline Type makeType(Type_Id id) {
                 .size = -1,
             };
 
+        case TYPE_I8:
+        case TYPE_I16:
+        case TYPE_I32:
+        case TYPE_I64:
+        case TYPE_U8:
+        case TYPE_U16:
+        case TYPE_U32:
+        case TYPE_U64:
+            return (Type){
+                .name = svFromCStr(integerTypes[id].name),
+                .id = id,
+                .size = -1,
+            };
+
         case TYPE_UNKNOWN:
             return (Type){.id = TYPE_UNKNOWN};
     }
@@ -849,6 +1454,9 @@ typedef union {
         AST_Node* functionArgs;
         AST_Node* functionBody;
         Type functionRetType;
+        int functionFrameSize; // Slots taken by the arguments and locals. Set by `tableAssignSlots`.
+        int functionSymbolStart; // The arguments and locals are the symbols `functionSymbolStart..functionSymbolEnd`
+        int functionSymbolEnd;   // (exclusive) of the table. Set by `tableAssignSlots`.
     };
     // Represents a linked list of function arguments.
     struct {                 // NODE_ARGS
@@ -868,11 +1476,25 @@ typedef union {
     struct {                 // Binary operations (e.g. NODE_PLUS, NODE_MINUS, ...)
         AST_Node* binaryOpLeft;
         AST_Node* binaryOpRight;
+        Type_Id binaryOpType; // Type of both operands. Set by the type checker, for the backends.
     };
     struct {                 // NODE_ARRAY_ACCESS
         String_View accessArrayName;
         AST_Node* accessIndex;
     };
+    struct {                 // NODE_CALL
+        String_View callName;
+        AST_Node* callArgs;
+    };
+    // Represents a linked list of expressions passed to a call.
+    struct {                 // NODE_CALL_ARGS
+        AST_Node* callArgExpr;
+        AST_Node* callArgNext;
+    };
+    struct {                 // NODE_CONVERT
+        AST_Node* convertExpr;
+        Type_Id convertType;
+    };
     struct {                 // Control statements (NODE_IF, NODE_WHILE)
         AST_Node* controlCondition;
         AST_Node* controlScope;
@@ -890,8 +1512,20 @@ typedef union {
         AST_Node* assignmentExpr;
     };
     String_View identName;   // NODE_IDENT
-    int intValue;            // NODE_INT
+    struct {                 // NODE_INT
+        long long intValue;  // The bits of the value. A u64 above the largest i64 looks negative.
+        Type_Id intType;     // Set by the type checker. Until then, `intValue` is the literal's magnitude.
+    };
     bool boolValue;          // NODE_BOOL
+    struct {                 // NODE_SHIFT_LEFT
+        AST_Node* shiftValue;
+        int shiftAmount;
+    };
+    struct {                 // NODE_DIVIDE_CONSTANT
+        AST_Node* divideDividend;
+        int divideDivisor;
+        Division_Magic divideMagic;
+    };
 } Node_Data;
 
 struct AST_Node {
@@ -926,19 +1560,15 @@ void printProgram(Program program) {
 void programAddNode(Program* program, AST_Node* node) {
     if (program->nodes == NULL) {
         program->capacity = INIT_PROGRAM_CAPACITY;
-        program->nodes = malloc(program->capacity * sizeof(AST_Node*));
+        program->nodes = memAlloc(MEM_PROGRAM, program->capacity * sizeof(AST_Node*));
     }
     else if (program->length == program->capacity) {
         program->capacity *= 2;
-        program->nodes = realloc(program->nodes, program->capacity * sizeof(AST_Node*));
+        program->nodes = memRealloc(MEM_PROGRAM, program->nodes, program->capacity * sizeof(AST_Node*));
     }
     program->nodes[program->length++] = node;
 }
 
-int getScopeId() {
-    static int id = 0;
-    return id++;
-}
 
 bool isNodeOperator(Node_Type type) {
     return type == NODE_PLUS
@@ -956,10 +1586,42 @@ typedef struct {
 
 #define INIT_LIST_CAPACITY 128
 
+// An expression that `parseExpr` has put aside to parse one of its operands.
+typedef struct {
+    bool parenthesized; // Waiting for the inside of "(...)" rather than for the right operand of `op`
+    int precedence;     // Lowest precedence the expression being put aside can still take operators of
+    AST_Node* left;
+    Token op;
+} Expr_Frame;
+
+// A scope that `parseScope` is still adding statements to.
+typedef struct {
+    AST_Node node;       // The scope, added to the list once it's closed
+    AST_Node* tail;      // Last element of the statement list, or NULL while the scope is empty
+    bool success;
+    Token_Type owner;    // Keyword of the statement that the scope is the body of, or TOKEN_LBRACE for a scope on its own
+    AST_Node* condition; // Condition of an `if` or `while`
+} Scope_Frame;
+
 typedef struct {
     AST_Node_Bucket* buckets; // The bucket array. This contains pointers to `AST_Node_Bucket`s in order to preserve pointer stability for the nodes in a given bucket.
     int length;                // Number of valid pointers to buckets
     int capacity;              // Capacity of the `buckets` array. Used to decide when `buckets` needs to be resized.
+    int allocatedLength;       // Number of buckets with node storage, including ones kept around by `nodeListReset`
+    int nextScopeId;           // Scope IDs are handed out per list, so every compile numbers its scopes densely from 0
+    int nodeCounts[NODE_COUNT]; // Nodes added since the last reset, by type
+
+    char** names;              // Identifiers made up by the compiler. Freed by `nodeListReset`.
+    int namesLength;
+    int namesCapacity;
+
+    Expr_Frame* exprStack;     // Scratch stack for `parseExpr`, kept between parses
+    int exprStackLength;
+    int exprStackCapacity;
+
+    Scope_Frame* scopeStack;   // Scratch stack for `parseScope`, kept between parses
+    int scopeStackLength;
+    int scopeStackCapacity;
 
     int bucketCapacity;        // The capacity of a single bucket
 } AST_Node_List;
@@ -970,39 +1632,110 @@ inline AST_Node_List makeNodeList(int bucketCapacity) {
         .buckets = NULL,
         .length = 0,
         .capacity = 0,
+        .allocatedLength = 0,
+        .nextScopeId = 0,
+        .nodeCounts = {0},
+        .names = NULL,
+        .namesLength = 0,
+        .namesCapacity = 0,
+        .exprStack = NULL,
+        .exprStackLength = 0,
+        .exprStackCapacity = 0,
+        .scopeStack = NULL,
+        .scopeStackLength = 0,
+        .scopeStackCapacity = 0,
         .bucketCapacity = bucketCapacity,
     };
 }
 
+inline int getScopeId(AST_Node_List* list) {
+    return list->nextScopeId++;
+}
+
+// Empties the list, but keeps all of its buckets so that they can be reused without allocating.
+void nodeListReset(AST_Node_List* list) {
+    for (int i = 0; i < list->length; ++i) {
+        list->buckets[i].length = 0;
+    }
+    list->length = list->allocatedLength > 0 ? 1 : 0;
+    list->nextScopeId = 0;
+    memset(list->nodeCounts, 0, sizeof(list->nodeCounts));
+    for (int i = 0; i < list->namesLength; ++i) {
+        memFree(list->names[i]);
+    }
+    list->namesLength = 0;
+}
+
+// Frees the nodes of the list along with all of the storage that `nodeListReset` keeps.
+void freeNodeList(AST_Node_List* list) {
+    nodeListReset(list);
+    for (int i = 0; i < list->allocatedLength; ++i) {
+        memFree(list->buckets[i].nodes);
+    }
+    memFree(list->buckets);
+    memFree(list->names);
+    memFree(list->exprStack);
+    memFree(list->scopeStack);
+    *list = makeNodeList(list->bucketCapacity);
+}
+
 inline AST_Node* nodeListAddNode(AST_Node_List* list, AST_Node node) {
     if (list->capacity == 0) {
         assert(list->length == 0);
         list->capacity = INIT_LIST_CAPACITY;
-        list->buckets = malloc(list->capacity * sizeof(AST_Node_Bucket));
+        list->buckets = memAlloc(MEM_AST, list->capacity * sizeof(AST_Node_Bucket));
         list->buckets[0] = (AST_Node_Bucket){
-            .nodes = malloc(list->bucketCapacity * sizeof(AST_Node)),
+            .nodes = memAlloc(MEM_AST, list->bucketCapacity * sizeof(AST_Node)),
             .length = 0,
         };
         list->length = 1;
+        list->allocatedLength = 1;
     }
 
     if (list->buckets[list->length - 1].length == list->bucketCapacity) {
-        if (list->length == list->capacity) {
-            list->capacity *= 2;
-            list->buckets = realloc(list->buckets, list->capacity * sizeof(AST_Node_Bucket));
+        if (list->length < list->allocatedLength) {
+            // Reuse a bucket left over from before the last reset.
+            list->buckets[list->length++].length = 0;
+        }
+        else {
+            if (list->length == list->capacity) {
+                list->capacity *= 2;
+                list->buckets = memRealloc(MEM_AST, list->buckets, list->capacity * sizeof(AST_Node_Bucket));
+            }
+            list->buckets[list->length++] = (AST_Node_Bucket){
+                .nodes = memAlloc(MEM_AST, list->bucketCapacity * sizeof(AST_Node)),
+                .length = 0,
+            };
+            list->allocatedLength = list->length;
         }
-        list->buckets[list->length++] = (AST_Node_Bucket){
-            .nodes = malloc(list->bucketCapacity * sizeof(AST_Node)),
-            .length = 0,
-        };
     }
 
+    ++list->nodeCounts[node.type];
     AST_Node_Bucket* lastBucket = &list->buckets[list->length - 1];
     assert(lastBucket->length < list->bucketCapacity);
     lastBucket->nodes[lastBucket->length++] = node;
     return &lastBucket->nodes[lastBucket->length - 1];
 }
 
+// Formats a new identifier that lives as long as the list's nodes, for variables introduced by the compiler.
+String_View nodeListMakeName(AST_Node_List* list, char* fmt, ...) {
+    char buffer[256];
+    va_list args;
+    va_start(args, fmt);
+    int length = vsnprintf(buffer, sizeof(buffer), fmt, args);
+    va_end(args);
+    assert(length >= 0 && length < (int)sizeof(buffer));
+
+    if (list->namesLength == list->namesCapacity) {
+        list->namesCapacity = list->namesCapacity == 0 ? 64 : list->namesCapacity * 2;
+        list->names = memRealloc(MEM_AST, list->names, list->namesCapacity * sizeof(char*));
+    }
+    char* name = memAlloc(MEM_AST, length + 1);
+    memcpy(name, buffer, length + 1);
+    list->names[list->namesLength++] = name;
+    return (String_View){name, length};
+}
+
 inline AST_Node* addDeclarationNode(AST_Node_List* list, String_View name, Type type) {
     AST_Node node;
     node.type = NODE_DECLARATION;
@@ -1019,13 +1752,20 @@ inline AST_Node* addAssignmentNode(AST_Node_List* list, String_View name, AST_No
     return nodeListAddNode(list, node);
 }
 
-inline AST_Node* addIntNode(AST_Node_List* list, int value) {
+// `type` is TYPE_UNKNOWN for literals that haven't been type checked yet.
+inline AST_Node* addIntNode(AST_Node_List* list, long long value, Type_Id type) {
     AST_Node node;
     node.type = NODE_INT;
     node.data.intValue = value;
+    node.data.intType = type;
     return nodeListAddNode(list, node);
 }
 
+// Whether the NODE_INT `node` is printed unsigned: literals are magnitudes until they are typed, and u64 stays unsigned.
+inline bool intIsMagnitude(AST_Node* node) {
+    return node->data.intType == TYPE_UNKNOWN || node->data.intType == TYPE_U64;
+}
+
 inline AST_Node* addBoolNode(AST_Node_List* list, bool value) {
     AST_Node node;
     node.type = NODE_BOOL;
@@ -1096,6 +1836,15 @@ inline AST_Node* addBinaryOpNode(AST_Node_List* list, AST_Node* left, Token toke
     static_assert(NUM_BINOP_TOKENS == 5, "Non-exhaustive cases (addBinaryOpNode)");
     node.data.binaryOpLeft = left;
     node.data.binaryOpRight = right;
+    node.data.binaryOpType = TYPE_UNKNOWN;
+    return nodeListAddNode(list, node);
+}
+
+inline AST_Node* addConversionNode(AST_Node_List* list, Type_Id type, AST_Node* expr) {
+    AST_Node node;
+    node.type = NODE_CONVERT;
+    node.data.convertExpr = expr;
+    node.data.convertType = type;
     return nodeListAddNode(list, node);
 }
 
@@ -1107,6 +1856,22 @@ AST_Node* addArrayAccessNode(AST_Node_List* list, String_View arrayName, AST_Nod
     return nodeListAddNode(list, node);
 }
 
+AST_Node* addCallNode(AST_Node_List* list, String_View name, AST_Node* args) {
+    AST_Node node;
+    node.type = NODE_CALL;
+    node.data.callName = name;
+    node.data.callArgs = args;
+    return nodeListAddNode(list, node);
+}
+
+inline AST_Node* addCallArgNode(AST_Node_List* list, AST_Node* expr) {
+    AST_Node node;
+    node.type = NODE_CALL_ARGS;
+    node.data.callArgExpr = expr;
+    node.data.callArgNext = NULL;
+    return nodeListAddNode(list, node);
+}
+
 int getPrecedence(Token_Type type) {
     switch (type) {
         case TOKEN_DOUBLE_EQUALS:
@@ -1147,7 +1912,7 @@ void recoverByEatUntil(Lexer* lexer, Token_Type wanted) {
         token = getToken(lexer);
     }
     if (token.type == TOKEN_EOF) {
-        exit(1);
+        fatalExit();
     }
 }
 
@@ -1158,23 +1923,51 @@ void recoverByEatUpTo(Lexer* lexer, Token_Type wanted) {
         peeked = peekToken(lexer);
     }
     if (peeked.type == TOKEN_EOF) {
-        exit(1);
+        fatalExit();
     }
 }
 
 Type parseType(Lexer* lexer);
 
 AST_Node* parseTerm(AST_Node_List* list, Lexer* lexer);
+AST_Node* parseCall(AST_Node_List* list, Lexer* lexer, String_View name);
 AST_Node* parseBracketedExpr(AST_Node_List* list, Lexer* lexer);
 AST_Node* parseExpr(AST_Node_List* list, Lexer* lexer, int precedence);
 AST_Node* parseStatement(AST_Node_List* list, Lexer* lexer);
-AST_Node* parseStatments(AST_Node_List* list, Lexer* lexer, bool* success);
 AST_Node* parseScope(AST_Node_List* list, Lexer* lexer);
 AST_Node* parseArgs(AST_Node_List* list, Lexer* lexer, bool* success);
 AST_Node* parseFunction(AST_Node_List* list, Lexer* lexer);
 
 Program parseProgram(AST_Node_List* list, Lexer* lexer, bool* success);
 
+// Reports an integer literal that doesn't fit in 64 bits. Returns whether it fits. Which integer type the literal has,
+// and so whether it really fits, is up to the type checker.
+bool checkIntLiteral(Lexer* lexer, Token token) {
+    if (token.intOverflow) {
+        printErrorMessage(lexer->fileName, scopeToken(token), "Integer literal \""SV_FMT"\" does not fit in 64 bits", SV_ARG(token.text));
+        return false;
+    }
+    return true;
+}
+
+// Parses a conversion like `i64(x)` to `type`, whose name has already been read. The next token must be the "(".
+AST_Node* parseConversion(AST_Node_List* list, Lexer* lexer, Type_Id type) {
+    Token token = getToken(lexer);
+    assert(token.type == TOKEN_LPAREN);
+
+    AST_Node* expr = parseExpr(list, lexer, -1);
+    if (expr == NULL) {
+        return NULL;
+    }
+    token = getToken(lexer);
+    if (token.type != TOKEN_RPAREN) {
+        printErrorMessage(lexer->fileName, scopeToken(token), "Expected \")\" in conversion to %s, but got \""SV_FMT"\"", integerTypes[type].name, SV_ARG(token.text));
+        recoverByEatUpTo(lexer, TOKEN_SEMICOLON);
+        return NULL;
+    }
+    return addConversionNode(list, type, expr);
+}
+
 Type parseType(Lexer* lexer) {
     Type type;
 
@@ -1184,7 +1977,11 @@ Type parseType(Lexer* lexer) {
         if (token.type != TOKEN_INT) {
             printErrorMessage(lexer->fileName, scopeToken(token), "Expected an integer in array type, got \""SV_FMT"\"", SV_ARG(token.text));
         }
-        type.size = token.intValue;
+        else if (token.intOverflow || token.intValue > INT_MAX) {
+            printErrorMessage(lexer->fileName, scopeToken(token), "Array size \""SV_FMT"\" is larger than the largest int, %d", SV_ARG(token.text), INT_MAX);
+            token.intValue = 0;
+        }
+        type.size = (int)token.intValue;
 
         token = getToken(lexer);
         if (token.type != TOKEN_RBRACKET) {
@@ -1198,7 +1995,6 @@ Type parseType(Lexer* lexer) {
     }
 
     type.name = token.text;
-    printToken(token);
 
     switch (token.type) {
         case TOKEN_INTTYPE_KEYWORD: {
@@ -1214,7 +2010,10 @@ Type parseType(Lexer* lexer) {
             break;
         }
         case TOKEN_IDENT: {
-            type.id = TYPE_USER;
+            type.id = findIntegerType(token.text);
+            if (type.id == TYPE_UNKNOWN) {
+                type.id = TYPE_USER;
+            }
             break;
         }
         default: {
@@ -1225,17 +2024,70 @@ Type parseType(Lexer* lexer) {
     return type;
 }
 
+// Parses the argument list of a call to `name`. The next token must be the opening "(".
+AST_Node* parseCall(AST_Node_List* list, Lexer* lexer, String_View name) {
+    Token token = getToken(lexer);
+    assert(token.type == TOKEN_LPAREN);
+
+    if (peekToken(lexer).type == TOKEN_RPAREN) {
+        getToken(lexer); // Eat the ')'
+        return addCallNode(list, name, NULL);
+    }
+
+    AST_Node* head = NULL;
+    AST_Node* curr = NULL;
+    while (true) {
+        AST_Node* expr = parseExpr(list, lexer, -1);
+        if (expr == NULL) {
+            return NULL;
+        }
+        AST_Node* arg = addCallArgNode(list, expr);
+        if (head == NULL) {
+            head = arg;
+        }
+        else {
+            curr->data.callArgNext = arg;
+        }
+        curr = arg;
+
+        token = getToken(lexer);
+        if (token.type == TOKEN_RPAREN) {
+            break;
+        }
+        if (token.type != TOKEN_COMMA) {
+            printErrorMessage(lexer->fileName, scopeToken(token), "Expected \",\" or \")\" in call to \""SV_FMT"\", but got \""SV_FMT"\"", SV_ARG(name), SV_ARG(token.text));
+            recoverByEatUpTo(lexer, TOKEN_SEMICOLON);
+            return NULL;
+        }
+    }
+    return addCallNode(list, name, head);
+}
+
 AST_Node* parseTerm(AST_Node_List* list, Lexer* lexer) {
     Token token = getToken(lexer);
     switch (token.type) {
         case TOKEN_INT:
-            return addIntNode(list, token.intValue);
+            if (!checkIntLiteral(lexer, token)) {
+                recoverByEatUpTo(lexer, TOKEN_SEMICOLON);
+                return NULL;
+            }
+            return addIntNode(list, (long long)token.intValue, TYPE_UNKNOWN);
         case TOKEN_BOOL:
             return addBoolNode(list, token.boolValue);
+        case TOKEN_INTTYPE_KEYWORD:
+            if (peekToken(lexer).type != TOKEN_LPAREN) {
+                printErrorMessage(lexer->fileName, scopeToken(token), "Expected \"(\" after \"int\" in an expression, to convert to int");
+                recoverByEatUpTo(lexer, TOKEN_SEMICOLON);
+                return NULL;
+            }
+            return parseConversion(list, lexer, TYPE_INT);
         case TOKEN_IDENT:
             String_View name = token.text;
 
             token = peekToken(lexer);
+            if (token.type == TOKEN_LPAREN && findIntegerType(name) != TYPE_UNKNOWN) {
+                return parseConversion(list, lexer, findIntegerType(name));
+            }
             if (token.type == TOKEN_LBRACKET) {
                 // This is an array access
                 getToken(lexer); // Eat the '['
@@ -1249,76 +2101,103 @@ AST_Node* parseTerm(AST_Node_List* list, Lexer* lexer) {
                 }
                 return addArrayAccessNode(list, name, index);
             }
+            if (token.type == TOKEN_LPAREN) {
+                return parseCall(list, lexer, name);
+            }
             return addIdentNode(list, name);
         default:
             printErrorMessage(lexer->fileName, scopeToken(token), "Expected an integer or identifier, but got \""SV_FMT"\"", SV_ARG(token.text));
             recoverByEatUpTo(lexer, TOKEN_SEMICOLON);
+            return NULL;
     }
-    return addIntNode(list, token.intValue);
 }
 
-AST_Node* parseIncreasingPrecedence(AST_Node_List* list, Lexer* lexer, AST_Node* left, int precedence) {
-    Token token = peekToken(lexer);
-    assert(isOperator(token.type));
-
-    int thisPrecedence = getPrecedence(token.type);
-    if (thisPrecedence > precedence) {
-        getToken(lexer); // Eat the operator
-        AST_Node* right = parseExpr(list, lexer, thisPrecedence);
-        if (right == NULL) {
-            return NULL;
-        }
-        return addBinaryOpNode(list, left, token, right);
+inline void pushExprFrame(AST_Node_List* list, Expr_Frame frame) {
+    if (list->exprStackLength == list->exprStackCapacity) {
+        list->exprStackCapacity = list->exprStackCapacity == 0 ? 64 : list->exprStackCapacity * 2;
+        list->exprStack = memRealloc(MEM_AST, list->exprStack, list->exprStackCapacity * sizeof(Expr_Frame));
     }
-    return left;
+    list->exprStack[list->exprStackLength++] = frame;
 }
 
+// Parses an expression by precedence climbing. Operators bind tighter the higher their precedence, and an operator is
+// only taken if its precedence is above `precedence`. A parenthesized expression is a whole operand, and ends the
+// operand it appears in.
+// Rather than recursing for each operand, the expression parsed so far is pushed on the list's `exprStack`, so long
+// chains of operators and deep parentheses use no more C stack than a single term. Terms themselves still recurse for
+// array indices and call arguments, which only nest as deep as the source does.
 AST_Node* parseExpr(AST_Node_List* list, Lexer* lexer, int precedence) {
-    Token peeked = peekToken(lexer);
-    if (peeked.type == TOKEN_LPAREN) {
-        getToken(lexer); // Eat the '('
-        AST_Node* inner = parseExpr(list, lexer, -1);
-        if (inner == NULL) {
-            return NULL;
+    // Calls from `parseTerm` share the stack, and only ever pop what they pushed.
+    int base = list->exprStackLength;
+    AST_Node* result = NULL;
+
+    while (true) {
+        // Start an operand, opening any parentheses in front of it.
+        Token peeked = peekToken(lexer);
+        while (peeked.type == TOKEN_LPAREN) {
+            getToken(lexer); // Eat the '('
+            pushExprFrame(list, (Expr_Frame){.parenthesized = true, .precedence = precedence});
+            precedence = -1;
+            peeked = peekToken(lexer);
         }
 
-        Token token = getToken(lexer);
-        if (token.type != TOKEN_RPAREN) {
-            printErrorMessage(lexer->fileName, scopeToken(token), "Expected \")\", but got \""SV_FMT"\"", SV_ARG(token.text));
-            recoverByEatUpTo(lexer, TOKEN_SEMICOLON);
-            return NULL;
+        AST_Node* term = parseTerm(list, lexer);
+        if (term == NULL) {
+            break;
         }
-        return inner;
-    }
 
-    AST_Node* term = parseTerm(list, lexer);
-    if (term == NULL) {
-        return NULL;
-    }
+        // Extend the operand with operators for as long as they bind tightly enough, then hand it to the expressions
+        // that were put aside waiting for it.
+        while (true) {
+            peeked = peekToken(lexer);
+            if (isOperator(peeked.type)) {
+                int thisPrecedence = getPrecedence(peeked.type);
+                if (thisPrecedence > precedence) {
+                    getToken(lexer); // Eat the operator
+                    pushExprFrame(list, (Expr_Frame){.parenthesized = false, .precedence = precedence, .left = term, .op = peeked});
+                    precedence = thisPrecedence;
+                    term = NULL;
+                    break;
+                }
+            }
+            else if (peeked.type == TOKEN_INT || peeked.type == TOKEN_IDENT) {
+                printErrorMessage(lexer->fileName, scopeToken(peeked), "Expected an operator, but got \""SV_FMT"\"", SV_ARG(peeked.text));
+                recoverByEatUpTo(lexer, TOKEN_SEMICOLON);
+                list->exprStackLength = base;
+                return NULL;
+            }
 
-    peeked = peekToken(lexer);
-    while (isOperator(peeked.type)) {
-        AST_Node* op = parseIncreasingPrecedence(list, lexer, term, precedence);
-        if (op == NULL) {
-            return NULL;
+            // `term` is complete. Close parentheses until it becomes the right operand of an operator.
+            while (list->exprStackLength > base && list->exprStack[list->exprStackLength - 1].parenthesized) {
+                Token token = getToken(lexer);
+                if (token.type != TOKEN_RPAREN) {
+                    printErrorMessage(lexer->fileName, scopeToken(token), "Expected \")\", but got \""SV_FMT"\"", SV_ARG(token.text));
+                    recoverByEatUpTo(lexer, TOKEN_SEMICOLON);
+                    list->exprStackLength = base;
+                    return NULL;
+                }
+                precedence = list->exprStack[--list->exprStackLength].precedence;
+            }
+            if (list->exprStackLength == base) {
+                result = term;
+                break;
+            }
+            Expr_Frame frame = list->exprStack[--list->exprStackLength];
+            term = addBinaryOpNode(list, frame.left, frame.op, term);
+            precedence = frame.precedence;
         }
-        if (op == term) {
-            return term;
+
+        if (result != NULL) {
+            break;
         }
-        term = op;
-        peeked = peekToken(lexer);
-    }
-    
-    if (peeked.type == TOKEN_INT || peeked.type == TOKEN_IDENT) {
-        printErrorMessage(lexer->fileName, scopeToken(peeked), "Expected an operator, but got %d", peeked.intValue);
-        recoverByEatUpTo(lexer, TOKEN_SEMICOLON);
-        return NULL;
     }
-   
-    return term;
+
+    list->exprStackLength = base;
+    return result;
 }
 
 //TODO: Refactor this to allow for expandability
+// Parses a statement that doesn't have a scope. Those are handled by `parseScope`.
 AST_Node* parseStatement(AST_Node_List* list, Lexer* lexer) {
     Token token = peekToken(lexer);
     switch (token.type) {
@@ -1337,12 +2216,23 @@ AST_Node* parseStatement(AST_Node_List* list, Lexer* lexer) {
             }
             return result;
         }
-        case TOKEN_LBRACE: {
-            return parseScope(list, lexer);
-        }
         case TOKEN_IDENT: {
             getToken(lexer); // Eat the ident
             String_View name = token.text;
+            if (peekToken(lexer).type == TOKEN_LPAREN) {
+                // A call whose result is discarded
+                AST_Node* call = parseCall(list, lexer, name);
+                if (call == NULL) {
+                    recoverByEatUntil(lexer, TOKEN_SEMICOLON);
+                    return NULL;
+                }
+                token = getToken(lexer);
+                if (token.type != TOKEN_SEMICOLON) {
+                    printErrorMessage(lexer->fileName, scopeAfter(token), "Expected a \";\", but got none");
+                    return NULL;
+                }
+                return call;
+            }
             token = getToken(lexer);
             switch (token.type) {
                 case TOKEN_COLON: {
@@ -1380,42 +2270,6 @@ AST_Node* parseStatement(AST_Node_List* list, Lexer* lexer) {
             }
             break;
         }
-        case TOKEN_IF_KEYWORD: {
-            getToken(lexer); // Eat the "if"
-            //TODO: Error recovery from parseExpr will eat until a semicolon, but that's not great here.
-            AST_Node* condition = parseExpr(list, lexer, -1);
-            if (condition == NULL) {
-                recoverByEatUntil(lexer, TOKEN_RBRACE);
-                return NULL;
-            }
-            AST_Node* scope = parseScope(list, lexer);
-            if (scope == NULL) {
-                return NULL;
-            }
-            return addControlNode(list, NODE_IF, condition, scope);
-        }
-        case TOKEN_ELSE_KEYWORD: {
-            getToken(lexer); // Eat the "else"
-            AST_Node* scope = parseScope(list, lexer);
-            if (scope == NULL) {
-                return NULL;
-            }
-            return addElseNode(list, scope);
-        }
-        case TOKEN_WHILE_KEYWORD: {
-            getToken(lexer); // Eat the "while"
-            AST_Node* condition = parseExpr(list, lexer, -1);
-            if (condition == NULL) {
-                recoverByEatUntil(lexer, TOKEN_RBRACE);
-                return NULL;
-            }
-            AST_Node* scope = parseScope(list, lexer);
-            if (scope == NULL) {
-                return NULL;
-            }
-            return addControlNode(list, NODE_WHILE, condition, scope);
-            break;
-        }
         default: {
             printErrorMessage(lexer->fileName, scopeToken(token), "Expected the start of a valid statement, got \""SV_FMT"\"", SV_ARG(token.text));
             recoverByEatUntil(lexer, TOKEN_SEMICOLON);
@@ -1424,48 +2278,99 @@ AST_Node* parseStatement(AST_Node_List* list, Lexer* lexer) {
     }
 }
 
-AST_Node* parseStatements(AST_Node_List* list, Lexer* lexer, bool* success) {
-    *success = true;
-
-    if (peekToken(lexer).type == TOKEN_RBRACE) {
-        getToken(lexer); // Eat the '}'
-        return NULL;
-    }
-
-    AST_Node node;
-    node.type = NODE_STATEMENTS;
-    node.data.statementStatement = parseStatement(list, lexer);
-    if (node.data.statementStatement == NULL) {
-        *success = false;
-    }
-    AST_Node* head = nodeListAddNode(list, node);
-    AST_Node* curr = head;
+// Opens the scope starting at the next token, which must be a "{".
+void pushScopeFrame(AST_Node_List* list, Lexer* lexer, Token_Type owner, AST_Node* condition) {
+    Token token = getToken(lexer);
+    assert(token.type == TOKEN_LBRACE);
 
-    while (peekToken(lexer).type != TOKEN_RBRACE) {
-        node.data.statementStatement = parseStatement(list, lexer);
-        if (node.data.statementStatement == NULL) {
-            *success = false;
-        }
-        curr->data.statementNext = nodeListAddNode(list, node);
-        curr = curr->data.statementNext;
+    if (list->scopeStackLength == list->scopeStackCapacity) {
+        list->scopeStackCapacity = list->scopeStackCapacity == 0 ? 64 : list->scopeStackCapacity * 2;
+        list->scopeStack = memRealloc(MEM_AST, list->scopeStack, list->scopeStackCapacity * sizeof(Scope_Frame));
     }
-    getToken(lexer); // Eat the '}'
-    curr->data.statementNext = NULL;
-    return head;
+    Scope_Frame* frame = &list->scopeStack[list->scopeStackLength++];
+    *frame = (Scope_Frame){
+        .tail = NULL,
+        .success = true,
+        .owner = owner,
+        .condition = condition,
+    };
+    frame->node.type = NODE_SCOPE;
+    frame->node.data.scopeId = getScopeId(list);
+    frame->node.data.scopeStatements = NULL;
 }
 
+// Parses a scope and everything nested in it. Scopes that are still open are kept on the list's `scopeStack` rather
+// than the C stack, so nesting depth is only limited by memory.
 AST_Node* parseScope(AST_Node_List* list, Lexer* lexer) {
-    Token token = getToken(lexer);
-    assert(token.type == TOKEN_LBRACE);
-
-    AST_Node node;
-    node.type = NODE_SCOPE;
-    node.data.scopeId = getScopeId();
-
-    bool success;
-    node.data.scopeStatements = parseStatements(list, lexer, &success);
+    int base = list->scopeStackLength;
+    pushScopeFrame(list, lexer, TOKEN_LBRACE, NULL);
+
+    while (true) {
+        Token token = peekToken(lexer);
+        AST_Node* statement = NULL;
+        switch (token.type) {
+            case TOKEN_RBRACE: {
+                getToken(lexer); // Eat the '}'
+                Scope_Frame frame = list->scopeStack[--list->scopeStackLength];
+                AST_Node* scope = frame.success ? nodeListAddNode(list, frame.node) : NULL;
+                if (list->scopeStackLength == base) {
+                    return scope;
+                }
+                if (scope != NULL) {
+                    switch (frame.owner) {
+                        case TOKEN_IF_KEYWORD:    statement = addControlNode(list, NODE_IF, frame.condition, scope);    break;
+                        case TOKEN_WHILE_KEYWORD: statement = addControlNode(list, NODE_WHILE, frame.condition, scope); break;
+                        case TOKEN_ELSE_KEYWORD:  statement = addElseNode(list, scope);                               break;
+                        default:                  statement = scope;                                                  break;
+                    }
+                }
+                break;
+            }
+            case TOKEN_LBRACE: {
+                pushScopeFrame(list, lexer, TOKEN_LBRACE, NULL);
+                continue;
+            }
+            case TOKEN_IF_KEYWORD:
+            case TOKEN_WHILE_KEYWORD: {
+                getToken(lexer); // Eat the "if" or "while"
+                //TODO: Error recovery from parseExpr will eat until a semicolon, but that's not great here.
+                AST_Node* condition = parseExpr(list, lexer, -1);
+                if (condition == NULL) {
+                    recoverByEatUntil(lexer, TOKEN_RBRACE);
+                    break;
+                }
+                pushScopeFrame(list, lexer, token.type, condition);
+                continue;
+            }
+            case TOKEN_ELSE_KEYWORD: {
+                getToken(lexer); // Eat the "else"
+                pushScopeFrame(list, lexer, TOKEN_ELSE_KEYWORD, NULL);
+                continue;
+            }
+            default: {
+                statement = parseStatement(list, lexer);
+                break;
+            }
+        }
 
-    return success ? nodeListAddNode(list, node) : NULL;
+        // The statement is finished, so it goes at the end of the innermost open scope.
+        Scope_Frame* frame = &list->scopeStack[list->scopeStackLength - 1];
+        if (statement == NULL) {
+            frame->success = false;
+        }
+        AST_Node node;
+        node.type = NODE_STATEMENTS;
+        node.data.statementStatement = statement;
+        node.data.statementNext = NULL;
+        AST_Node* element = nodeListAddNode(list, node);
+        if (frame->tail == NULL) {
+            frame->node.data.scopeStatements = element;
+        }
+        else {
+            frame->tail->data.statementNext = element;
+        }
+        frame->tail = element;
+    }
 }
 
 AST_Node* parseArgs(AST_Node_List* list, Lexer* lexer, bool* success) {
@@ -1538,10 +2443,11 @@ AST_Node* parseArgs(AST_Node_List* list, Lexer* lexer, bool* success) {
     return head;
 }
 
-AST_Node* parseFunction(AST_Node_List* list, Lexer* lexer) {
+// Parses everything in a function definition up to its body into `node`, leaving `functionBody` NULL.
+bool parseFunctionSignature(AST_Node_List* list, Lexer* lexer, AST_Node* node) {
     bool success = true;
-    AST_Node node;
-    node.type = NODE_FUNCTION;
+    node->type = NODE_FUNCTION;
+    node->data.functionBody = NULL;
 
     Token token = getToken(lexer);
     if (token.type != TOKEN_IDENT) {
@@ -1549,7 +2455,7 @@ AST_Node* parseFunction(AST_Node_List* list, Lexer* lexer) {
         recoverByEatUntil(lexer, TOKEN_IDENT);
         success = false;
     }
-    node.data.functionName = token.text;
+    node->data.functionName = token.text;
 
     token = getToken(lexer);
     if (token.type != TOKEN_DOUBLE_COLON) {
@@ -1573,7 +2479,7 @@ AST_Node* parseFunction(AST_Node_List* list, Lexer* lexer) {
     }
 
     bool argsSuccess;
-    node.data.functionArgs = parseArgs(list, lexer, &argsSuccess);
+    node->data.functionArgs = parseArgs(list, lexer, &argsSuccess);
     if (!argsSuccess) {
         success = false;
     }
@@ -1587,13 +2493,20 @@ AST_Node* parseFunction(AST_Node_List* list, Lexer* lexer) {
             recoverByEatUpTo(lexer, TOKEN_LBRACE);
             success = false;
         }
-        node.data.functionRetType = type;
-        token = peekToken(lexer);
+        node->data.functionRetType = type;
     }
     else {
-        node.data.functionRetType = makeType(TYPE_UNIT);
+        node->data.functionRetType = makeType(TYPE_UNIT);
     }
+    return success;
+}
 
+AST_Node* parseFunction(AST_Node_List* list, Lexer* lexer) {
+    AST_Node node;
+    bool success = parseFunctionSignature(list, lexer, &node);
+    traceBegin("parse", node.data.functionName);
+
+    Token token = peekToken(lexer);
     if (token.type != TOKEN_LBRACE) {
         printErrorMessage(lexer->fileName, scopeToken(token), "Expected function body (starting with \"{\") in function definition, got \""SV_FMT"\"", SV_ARG(token.text));
         recoverByEatUntil(lexer, TOKEN_LBRACE);
@@ -1605,6 +2518,7 @@ AST_Node* parseFunction(AST_Node_List* list, Lexer* lexer) {
         success = false;
     }
 
+    traceEnd("parse", node.data.functionName);
     return success ? nodeListAddNode(list, node) : NULL;
 }
 
@@ -1627,6 +2541,213 @@ Program parseProgram(AST_Node_List* list, Lexer* lexer, bool* success) {
     return program;
 }
 
+
+
+///////////////////
+// Traversal API //
+///////////////////
+
+// Passes over trees that can nest arbitrarily deep walk them with an explicit stack instead of recursing, so deeply
+// nested scopes and long expressions can't exhaust the C stack. A pass sets hooks for the node types it cares about:
+// - `pre` runs when a node is reached. Returning false skips its children and its `post` hook.
+// - `child` runs before each child, with the child's position among them. Returning false skips that child.
+// - `post` runs once the node's children are done.
+// Children are visited in order. Statement lists and call argument lists are flattened, so the children of a scope
+// are its statements and the children of a call are its argument expressions. A function's only child is its body,
+// since parameters are plain data that hooks can read off the function node.
+
+typedef struct Traversal Traversal;
+
+typedef bool (*Pre_Hook)(Traversal* traversal, AST_Node* node);
+typedef bool (*Child_Hook)(Traversal* traversal, AST_Node* node, AST_Node* child, int index);
+typedef void (*Post_Hook)(Traversal* traversal, AST_Node* node);
+
+typedef struct {
+    AST_Node* node;
+    AST_Node* cursor; // Rest of the list being walked, for nodes whose children are a list
+    AST_Node* item;   // List node holding the child handed out last, for nodes whose children are a list
+    int index;        // Children handed out so far
+    int scopeId;      // ID of the innermost scope containing `node`, or whatever the traversal started with
+
+    // Scratch space for the hooks of `node`
+    int mark;
+    AST_Node* extra;
+} Traversal_Frame;
+
+struct Traversal {
+    Pre_Hook pre[NODE_COUNT];
+    Child_Hook child[NODE_COUNT];
+    Post_Hook post[NODE_COUNT];
+    void* context;
+
+    Traversal_Frame* stack;
+    int length;
+    int capacity;
+};
+
+void traversalPush(Traversal* traversal, AST_Node* node, int scopeId) {
+    if (traversal->length == traversal->capacity) {
+        traversal->capacity = traversal->capacity == 0 ? 64 : traversal->capacity * 2;
+        traversal->stack = realloc(traversal->stack, traversal->capacity * sizeof(Traversal_Frame));
+    }
+
+    AST_Node* cursor = NULL;
+    switch (node->type) {
+        case NODE_SCOPE:      cursor = node->data.scopeStatements; break;
+        case NODE_CALL:       cursor = node->data.callArgs;        break;
+        case NODE_STATEMENTS:
+        case NODE_CALL_ARGS:  cursor = node;                       break;
+        default:                                                   break;
+    }
+    traversal->stack[traversal->length++] = (Traversal_Frame){.node = node, .cursor = cursor, .scopeId = scopeId};
+}
+
+// Returns the next child of the frame's node and moves past it, or NULL if there are no more.
+AST_Node* traversalNextChild(Traversal_Frame* frame) {
+    AST_Node* node = frame->node;
+    int index = frame->index++;
+
+    switch (node->type) {
+        case NODE_SCOPE:
+        case NODE_STATEMENTS: {
+            AST_Node* statements = frame->cursor;
+            if (statements == NULL) {
+                return NULL;
+            }
+            frame->item = statements;
+            frame->cursor = statements->data.statementNext;
+            return statements->data.statementStatement;
+        }
+        case NODE_CALL:
+        case NODE_CALL_ARGS: {
+            AST_Node* args = frame->cursor;
+            if (args == NULL) {
+                return NULL;
+            }
+            frame->item = args;
+            frame->cursor = args->data.callArgNext;
+            return args->data.callArgExpr;
+        }
+        case NODE_FUNCTION:        return index == 0 ? node->data.functionBody : NULL;
+        case NODE_RETURN:          return index == 0 ? node->data.returnExpr : NULL;
+        case NODE_ASSIGNMENT:      return index == 0 ? node->data.assignmentExpr : NULL;
+        case NODE_ARRAY_ACCESS:    return index == 0 ? node->data.accessIndex : NULL;
+        case NODE_CONVERT:         return index == 0 ? node->data.convertExpr : NULL;
+        case NODE_ELSE:            return index == 0 ? node->data.elseScope : NULL;
+        case NODE_SHIFT_LEFT:      return index == 0 ? node->data.shiftValue : NULL;
+        case NODE_DIVIDE_CONSTANT: return index == 0 ? node->data.divideDividend : NULL;
+        case NODE_PLUS:
+        case NODE_MINUS:
+        case NODE_TIMES:
+        case NODE_DIVIDE:
+        case NODE_IS_EQUAL: {
+            return index == 0 ? node->data.binaryOpLeft : index == 1 ? node->data.binaryOpRight : NULL;
+        }
+        case NODE_IF:
+        case NODE_WHILE: {
+            return index == 0 ? node->data.controlCondition : index == 1 ? node->data.controlScope : NULL;
+        }
+        case NODE_ARGS:
+        case NODE_DECLARATION:
+        case NODE_INT:
+        case NODE_BOOL:
+        case NODE_IDENT: {
+            return NULL;
+        }
+    }
+    static_assert(NODE_COUNT == 24, "Non-exhaustive cases (traversalNextChild)");
+    assert(false && "Unreachable (traversalNextChild)");
+    return NULL;
+}
+
+// Walks the tree under `root`, which is inside the scope with ID `scopeId`.
+void traverse(Traversal* traversal, AST_Node* root, int scopeId) {
+    assert(traversal->length == 0);
+    traversalPush(traversal, root, scopeId);
+
+    // Set while the frame on top has just been pushed, and its `pre` hook hasn't run yet.
+    bool entering = true;
+    while (traversal->length > 0) {
+        Traversal_Frame* frame = &traversal->stack[traversal->length - 1];
+        AST_Node* node = frame->node;
+
+        if (entering) {
+            entering = false;
+            Pre_Hook pre = traversal->pre[node->type];
+            if (pre != NULL && !pre(traversal, node)) {
+                traversal->length--;
+                continue;
+            }
+        }
+
+        int index = frame->index;
+        AST_Node* child = traversalNextChild(frame);
+        if (child != NULL) {
+            Child_Hook hook = traversal->child[node->type];
+            if (hook == NULL || hook(traversal, node, child, index)) {
+                traversalPush(traversal, child, node->type == NODE_SCOPE ? node->data.scopeId : frame->scopeId);
+                entering = true;
+            }
+            continue;
+        }
+
+        Post_Hook post = traversal->post[node->type];
+        if (post != NULL) {
+            post(traversal, node);
+        }
+        traversal->length--;
+    }
+}
+
+void freeTraversal(Traversal* traversal) {
+    free(traversal->stack);
+}
+
+// The frame of the node whose hook is running.
+inline Traversal_Frame* traversalFrame(Traversal* traversal) {
+    return &traversal->stack[traversal->length - 1];
+}
+
+// The parent of the node whose hook is running, or NULL for the root.
+inline AST_Node* traversalParent(Traversal* traversal) {
+    return traversal->length > 1 ? traversal->stack[traversal->length - 2].node : NULL;
+}
+
+// Whether the node whose hook is running is a statement, as opposed to part of an expression.
+inline bool traversalIsStatement(Traversal* traversal) {
+    AST_Node* parent = traversalParent(traversal);
+    return parent != NULL && parent->type == NODE_SCOPE;
+}
+
+// The statements node holding the statement whose hook is running. Passes can insert statements before it with
+// `insertStatementBefore`, since the rest of the list has already been taken.
+inline AST_Node** traversalPosition(Traversal* traversal) {
+    assert(traversalIsStatement(traversal));
+    return &traversal->stack[traversal->length - 2].item;
+}
+
+// The statement after the one whose hook is running, or NULL if it's the last one in its scope.
+inline AST_Node* traversalNextStatement(Traversal* traversal) {
+    assert(traversalIsStatement(traversal));
+    AST_Node* next = traversal->stack[traversal->length - 2].cursor;
+    return next != NULL ? next->data.statementStatement : NULL;
+}
+
+// A `pre` hook for nodes whose children a pass doesn't need to see.
+bool traversalSkip(Traversal* traversal, AST_Node* node) {
+    (void)traversal;
+    (void)node;
+    return false;
+}
+
+// A `child` hook for `if` and `while` that skips the condition, for passes that only look at statements.
+bool traversalSkipCondition(Traversal* traversal, AST_Node* node, AST_Node* child, int index) {
+    (void)traversal;
+    (void)node;
+    (void)child;
+    return index != 0;
+}
+
 void printIndented(int indent, char* fmt, ...) {
     for (int i = 0; i < indent; ++i) {
         printf("  ");
@@ -1637,160 +2758,209 @@ void printIndented(int indent, char* fmt, ...) {
     va_end(args);
 }
 
-void printASTIndented(int indent, AST_Node* root) {
-    switch (root->type) {
+// `context` of the traversal in `printASTIndented`, which is the indent of the node being printed.
+typedef struct {
+    int indent;
+} AST_Printer;
+
+void printArgsIndented(int indent, AST_Node* args) {
+    for (AST_Node* arg = args; arg != NULL; arg = arg->data.argNext) {
+        printIndented(indent, "name="SV_FMT", type="SV_FMT"\n", SV_ARG(arg->data.argName), SV_ARG(arg->data.argType.name));
+    }
+}
+
+// Prints the header of a node whose children follow in parentheses, and indents them.
+bool printASTOpen(Traversal* traversal, AST_Node* node) {
+    AST_Printer* printer = traversal->context;
+    int indent = printer->indent;
+    switch (node->type) {
         case NODE_FUNCTION: {
-            printIndented(indent, "node_type=FUNCTION, name="SV_FMT", rettype="SV_FMT", args=", SV_ARG(root->data.functionName), SV_ARG(root->data.functionRetType.name));
-            if (root->data.functionArgs == NULL) {
+            printIndented(indent, "node_type=FUNCTION, name="SV_FMT", rettype="SV_FMT", args=", SV_ARG(node->data.functionName), SV_ARG(node->data.functionRetType.name));
+            if (node->data.functionArgs == NULL) {
                 printf("NONE, body=");
             }
             else {
                 printf("(\n");
-                printASTIndented(indent + 1, root->data.functionArgs);
+                printArgsIndented(indent + 1, node->data.functionArgs);
                 printIndented(indent, "), body=");
             }
-            if (root->data.functionBody == NULL) {
+            if (node->data.functionBody == NULL) {
                 printf("NONE\n");
+                return false;
             }
-            else {
-                printf("(\n");
-                printASTIndented(indent + 1, root->data.functionBody);
-                printIndented(indent, ")\n");
-            }
-            break;
-        }
-        case NODE_ARGS: {
-            printIndented(indent, "name="SV_FMT", type="SV_FMT"\n", SV_ARG(root->data.argName), SV_ARG(root->data.argType.name));
-            while (root->data.argNext != NULL) {
-                root = root->data.argNext;
-                printIndented(indent, "name="SV_FMT", type="SV_FMT"\n", SV_ARG(root->data.argName), SV_ARG(root->data.argType.name));
-            }
+            printf("(\n");
             break;
         }
         case NODE_SCOPE: {
             printIndented(indent, "node_type=SCOPE, statements=");
-            if (root->data.scopeStatements == NULL) {
+            if (node->data.scopeStatements == NULL) {
                 printf("NONE\n");
+                return false;
             }
-            else {
-                printf("(\n");
-                printASTIndented(indent + 1, root->data.scopeStatements);
-                printIndented(indent, ")\n");
-            }
-            break;
-        }
-        case NODE_STATEMENTS: {
-            printASTIndented(indent, root->data.statementStatement);
-            while (root->data.statementNext != NULL) {
-                root = root->data.statementNext;
-                printASTIndented(indent, root->data.statementStatement);
-            }
+            printf("(\n");
             break;
         }
         case NODE_RETURN: {
             printIndented(indent, "node_type=RETURN, expr=");
-            if (root->data.returnExpr == NULL) {
+            if (node->data.returnExpr == NULL) {
                 printf("NONE\n");
+                return false;
             }
-            else {
-                printf("(\n");
-                printASTIndented(indent + 1, root->data.returnExpr);
-                printIndented(indent, ")\n");
-            }
+            printf("(\n");
             break;
         }
-        case NODE_DECLARATION: {
-            printIndented(indent, "node_type=DECLARATION, name="SV_FMT", type="SV_FMT"\n", SV_ARG(root->data.declarationName), SV_ARG(root->data.declarationType.name));
+        case NODE_CALL: {
+            printIndented(indent, "node_type=CALL, name="SV_FMT", args=", SV_ARG(node->data.callName));
+            if (node->data.callArgs == NULL) {
+                printf("NONE\n");
+                return false;
+            }
+            printf("(\n");
             break;
         }
         case NODE_ASSIGNMENT: {
-            printIndented(indent, "node_type=ASSIGNMENT, name="SV_FMT", expr=(\n", SV_ARG(root->data.declarationName));
-            printASTIndented(indent + 1, root->data.assignmentExpr);
-            printIndented(indent, ")\n");
-            break;
-        }
-        case NODE_PLUS: {
-            printIndented(indent, "node_type=PLUS, left=(\n");
-            printASTIndented(indent + 1, root->data.binaryOpLeft);
-            printIndented(indent, "), right=(\n");
-            printASTIndented(indent + 1, root->data.binaryOpRight);
-            printIndented(indent, ")\n");
-            break;
-        }
-        case NODE_MINUS: {
-            printIndented(indent, "node_type=MINUS, left=(\n");
-            printASTIndented(indent + 1, root->data.binaryOpLeft);
-            printIndented(indent, "), right=(\n");
-            printASTIndented(indent + 1, root->data.binaryOpRight);
-            printIndented(indent, ")\n");
+            printIndented(indent, "node_type=ASSIGNMENT, name="SV_FMT", expr=(\n", SV_ARG(node->data.declarationName));
             break;
         }
-        case NODE_TIMES: {
-            printIndented(indent, "node_type=TIMES, left=(\n");
-            printASTIndented(indent + 1, root->data.binaryOpLeft);
-            printIndented(indent, "), right=(\n");
-            printASTIndented(indent + 1, root->data.binaryOpRight);
-            printIndented(indent, ")\n");
+        case NODE_PLUS:     printIndented(indent, "node_type=PLUS, left=(\n");     break;
+        case NODE_MINUS:    printIndented(indent, "node_type=MINUS, left=(\n");    break;
+        case NODE_TIMES:    printIndented(indent, "node_type=TIMES, left=(\n");    break;
+        case NODE_DIVIDE:   printIndented(indent, "node_type=DIVIDE, left=(\n");   break;
+        case NODE_IS_EQUAL: printIndented(indent, "node_type=IS_EQUAL, left=(\n"); break;
+        case NODE_ARRAY_ACCESS: {
+            printIndented(indent, "node_type=ARRAY_ACCESS, array="SV_FMT", index = (\n", SV_ARG(node->data.accessArrayName));
             break;
         }
-        case NODE_DIVIDE: {
-            printIndented(indent, "node_type=DIVIDE, left=(\n");
-            printASTIndented(indent + 1, root->data.binaryOpLeft);
-            printIndented(indent, "), right=(\n");
-            printASTIndented(indent + 1, root->data.binaryOpRight);
-            printIndented(indent, ")\n");
+        case NODE_CONVERT: {
+            printIndented(indent, "node_type=CONVERT, type=%s, expr=(\n", integerTypes[node->data.convertType].name);
             break;
         }
-        case NODE_IS_EQUAL: {
-            printIndented(indent, "node_type=IS_EQUAL, left=(\n");
-            printASTIndented(indent + 1, root->data.binaryOpLeft);
-            printIndented(indent, "), right=(\n");
-            printASTIndented(indent + 1, root->data.binaryOpRight);
-            printIndented(indent, ")\n");
+        case NODE_IF:    printIndented(indent, "node_type=IF, condition=(\n");    break;
+        case NODE_WHILE: printIndented(indent, "node_type=WHILE, condition=(\n"); break;
+        case NODE_ELSE:  printIndented(indent, "node_type=ELSE, body=(\n");       break;
+        case NODE_SHIFT_LEFT: {
+            printIndented(indent, "node_type=SHIFT_LEFT, amount=%d, value=(\n", node->data.shiftAmount);
             break;
         }
-        case NODE_ARRAY_ACCESS: {
-            printIndented(indent, "node_type=ARRAY_ACCESS, array="SV_FMT", index = (\n", SV_ARG(root->data.accessArrayName));
-            printASTIndented(indent + 1, root->data.accessIndex);
-            printIndented(indent, ")\n");
+        case NODE_DIVIDE_CONSTANT: {
+            printIndented(indent, "node_type=DIVIDE_CONSTANT, divisor=%d, dividend=(\n", node->data.divideDivisor);
             break;
         }
-        case NODE_IF: {
-            printIndented(indent, "node_type=IF, condition=(\n");
-            printASTIndented(indent + 1, root->data.controlCondition);
-            printIndented(indent, "), body=(\n");
-            printASTIndented(indent + 1, root->data.controlScope);
-            printIndented(indent, ")\n");
-            break;
-        }
-        case NODE_ELSE: {
-            printIndented(indent, "node_type=ELSE, body=(\n");
-            printASTIndented(indent + 1, root->data.elseScope);
-            printIndented(indent, ")\n");
+        default:
+            assert(false && "Not a node with children (printASTOpen)");
+    }
+    printer->indent++;
+    return true;
+}
+
+// Separates the two children of a binary operator, or a control statement's condition from its body.
+bool printASTSeparator(Traversal* traversal, AST_Node* node, AST_Node* child, int index) {
+    (void)child;
+    AST_Printer* printer = traversal->context;
+    if (index == 1) {
+        printIndented(printer->indent - 1, isNodeOperator(node->type) ? "), right=(\n" : "), body=(\n");
+    }
+    return true;
+}
+
+void printASTClose(Traversal* traversal, AST_Node* node) {
+    (void)node;
+    AST_Printer* printer = traversal->context;
+    printer->indent--;
+    printIndented(printer->indent, ")\n");
+}
+
+bool printASTLeaf(Traversal* traversal, AST_Node* node) {
+    AST_Printer* printer = traversal->context;
+    int indent = printer->indent;
+    switch (node->type) {
+        case NODE_ARGS: {
+            printArgsIndented(indent, node);
             break;
         }
-        case NODE_WHILE: {
-            printIndented(indent, "node_type=WHILE, condition=(\n");
-            printASTIndented(indent + 1, root->data.controlCondition);
-            printIndented(indent, "), body=(\n");
-            printASTIndented(indent + 1, root->data.controlScope);
-            printIndented(indent, ")\n");
+        case NODE_DECLARATION: {
+            printIndented(indent, "node_type=DECLARATION, name="SV_FMT", type="SV_FMT"\n", SV_ARG(node->data.declarationName), SV_ARG(node->data.declarationType.name));
             break;
         }
         case NODE_INT: {
-            printIndented(indent, "node_type=INT, value=%d\n", root->data.intValue);
+            printIndented(indent, intIsMagnitude(node) ? "node_type=INT, value=%llu\n" : "node_type=INT, value=%lld\n", node->data.intValue);
             break;
         }
         case NODE_BOOL: {
-            printIndented(indent, "node_type=BOOL, value=%d\n", root->data.boolValue);
+            printIndented(indent, "node_type=BOOL, value=%d\n", node->data.boolValue);
             break;
         }
         case NODE_IDENT: {
-            printIndented(indent, "node_type=IDENT, name="SV_FMT"\n", SV_ARG(root->data.identName));
+            printIndented(indent, "node_type=IDENT, name="SV_FMT"\n", SV_ARG(node->data.identName));
             break;
         }
+        default:
+            assert(false && "Not a leaf node (printASTLeaf)");
     }
-    static_assert(NODE_COUNT == 19, "Non-exhaustive cases (printASTIndented)");
+    return false;
+}
+
+void printASTIndented(int indent, AST_Node* root) {
+    AST_Printer printer = {indent};
+    Traversal traversal = {
+        .pre = {
+            [NODE_FUNCTION] = printASTOpen,
+            [NODE_ARGS] = printASTLeaf,
+            [NODE_SCOPE] = printASTOpen,
+            [NODE_RETURN] = printASTOpen,
+            [NODE_DECLARATION] = printASTLeaf,
+            [NODE_ASSIGNMENT] = printASTOpen,
+            [NODE_PLUS] = printASTOpen,
+            [NODE_MINUS] = printASTOpen,
+            [NODE_TIMES] = printASTOpen,
+            [NODE_DIVIDE] = printASTOpen,
+            [NODE_IS_EQUAL] = printASTOpen,
+            [NODE_ARRAY_ACCESS] = printASTOpen,
+            [NODE_CALL] = printASTOpen,
+            [NODE_CONVERT] = printASTOpen,
+            [NODE_IF] = printASTOpen,
+            [NODE_ELSE] = printASTOpen,
+            [NODE_WHILE] = printASTOpen,
+            [NODE_INT] = printASTLeaf,
+            [NODE_BOOL] = printASTLeaf,
+            [NODE_IDENT] = printASTLeaf,
+            [NODE_SHIFT_LEFT] = printASTOpen,
+            [NODE_DIVIDE_CONSTANT] = printASTOpen,
+        },
+        .child = {
+            [NODE_PLUS] = printASTSeparator,
+            [NODE_MINUS] = printASTSeparator,
+            [NODE_TIMES] = printASTSeparator,
+            [NODE_DIVIDE] = printASTSeparator,
+            [NODE_IS_EQUAL] = printASTSeparator,
+            [NODE_IF] = printASTSeparator,
+            [NODE_WHILE] = printASTSeparator,
+        },
+        .post = {
+            [NODE_FUNCTION] = printASTClose,
+            [NODE_SCOPE] = printASTClose,
+            [NODE_RETURN] = printASTClose,
+            [NODE_ASSIGNMENT] = printASTClose,
+            [NODE_PLUS] = printASTClose,
+            [NODE_MINUS] = printASTClose,
+            [NODE_TIMES] = printASTClose,
+            [NODE_DIVIDE] = printASTClose,
+            [NODE_IS_EQUAL] = printASTClose,
+            [NODE_ARRAY_ACCESS] = printASTClose,
+            [NODE_CALL] = printASTClose,
+            [NODE_CONVERT] = printASTClose,
+            [NODE_IF] = printASTClose,
+            [NODE_ELSE] = printASTClose,
+            [NODE_WHILE] = printASTClose,
+            [NODE_SHIFT_LEFT] = printASTClose,
+            [NODE_DIVIDE_CONSTANT] = printASTClose,
+        },
+        .context = &printer,
+    };
+    // Statement and argument lists have no hooks of their own, so their elements print at the list's indent.
+    static_assert(NODE_COUNT == 24, "Non-exhaustive hooks (printASTIndented)");
+    traverse(&traversal, root, -1);
+    freeTraversal(&traversal);
 }
 
 inline void printAST(AST_Node* root) {
@@ -1803,142 +2973,439 @@ inline void printAST(AST_Node* root) {
 // Symbol table API //
 //////////////////////
 
+// A symbol gathered from the table's parallel arrays.
 typedef struct {
     int scopeId;
     String_View name;
     Type type;
 } Symbol_Entry;
 
+// Scope IDs are dense, so scopes are stored in an array indexed by ID. Each scope's symbols are added together, so
+// they form a contiguous slice of the symbol arrays and a lookup only compares the symbols of the scopes it walks.
+typedef struct {
+    int parentId;    // ID of the immediate parent scope, or -1 for a function body
+    int symbolStart; // The symbols of the scope are `symbolStart..symbolStart + symbolCount` (exclusive)
+    int symbolCount;
+    int spillStart;  // Index of the first symbol added to the scope after its slice was closed off by another scope's,
+                     // or -1 if there are none. Only the optimizer does this, and only until the table is rebuilt.
+    int slotStart;   // The symbols of the scope take the slots `slotStart..slotStart + slotCount` (exclusive) of the
+    int slotCount;   // function's frame. Set by `tableAssignSlots`.
+} Scope_Entry;
+
 typedef struct {
-    int id;
-    int parentId; // ID of the immediate parent of the scope with ID `id`.
-} Scope_Parent_Entry;
+    String_View name;
+    AST_Node* function; // NULL for empty buckets. Only the signature is needed, so the body may be NULL.
+    int index;          // Position of the function in the `Program` it was added from
+} Function_Entry;
 
 typedef struct {
-    // TODO: This should be a hash map
-    Symbol_Entry* symbols;
+    // Symbols are stored as parallel arrays, so that a lookup only reads the interned names of the scopes it walks. The
+    // scope IDs are only read for spilled symbols, and the types once the symbol has been found.
+    int* symbolScopes;
+    int* symbolNames; // Interned name IDs
+    Type* symbolTypes;
+    int* symbolSlots; // First slot of each symbol in its function's frame. Set by `tableAssignSlots`.
     int symbolsLength;
     int symbolsCapacity;
 
-    
-    // TODO: This should be a hash map
-    Scope_Parent_Entry* scopeParents;
-    int parentsLength;
-    int parentsCapacity;
+    // Every symbol name is interned, so symbols are compared by ID. `nameBuckets` is an open addressing hash map from
+    // names to their ID + 1, with 0 for empty buckets.
+    String_View* names;
+    int namesLength;
+    int namesCapacity;
+    int* nameBuckets;
+    int nameBucketsCapacity; // Zero or a power of two
+
+    Scope_Entry* scopes;
+    int scopesLength; // One past the highest scope ID seen
+    int scopesCapacity;
+
+    // Open addressing hash map from names to functions, so that calls don't have to search the program.
+    Function_Entry* functions;
+    int functionsLength;
+    int functionsCapacity; // Zero or a power of two
+
+    long long probes; // Entries compared by symbol and function lookups since the last reset
 } Symbol_Table;
 
 Symbol_Table makeSymbolTable(int capacity) {
     return (Symbol_Table){
-        .symbols = malloc(capacity * sizeof(Symbol_Entry)),
+        .symbolScopes = memAlloc(MEM_SYMBOLS, capacity * sizeof(int)),
+        .symbolNames = memAlloc(MEM_SYMBOLS, capacity * sizeof(int)),
+        .symbolTypes = memAlloc(MEM_SYMBOLS, capacity * sizeof(Type)),
+        .symbolSlots = memAlloc(MEM_SYMBOLS, capacity * sizeof(int)),
         .symbolsLength = 0,
         .symbolsCapacity = capacity,
 
-        .scopeParents = malloc(capacity * sizeof(Scope_Parent_Entry)),
-        .parentsLength = 0,
-        .parentsCapacity = capacity,
+        .names = memAlloc(MEM_SYMBOLS, capacity * sizeof(String_View)),
+        .namesLength = 0,
+        .namesCapacity = capacity,
+        .nameBuckets = NULL,
+        .nameBucketsCapacity = 0,
+
+        .scopes = memAlloc(MEM_SCOPES, capacity * sizeof(Scope_Entry)),
+        .scopesLength = 0,
+        .scopesCapacity = capacity,
+
+        .functions = NULL,
+        .functionsLength = 0,
+        .functionsCapacity = 0,
+
+        .probes = 0,
     };
 }
 
+// Empties the symbols and scopes of the table, but keeps its functions. Storage is kept for reuse.
+void symbolTableResetScopes(Symbol_Table* table) {
+    table->symbolsLength = 0;
+    // Names point into the source, which may not outlive the symbols.
+    if (table->namesLength > 0) {
+        memset(table->nameBuckets, 0, table->nameBucketsCapacity * sizeof(int));
+        table->namesLength = 0;
+    }
+    table->scopesLength = 0;
+    table->probes = 0;
+}
+
+// Empties the table, keeping its storage for reuse.
+void symbolTableReset(Symbol_Table* table) {
+    symbolTableResetScopes(table);
+    if (table->functionsLength > 0) {
+        memset(table->functions, 0, table->functionsCapacity * sizeof(Function_Entry));
+        table->functionsLength = 0;
+    }
+}
+
+void freeSymbolTable(Symbol_Table* table) {
+    memFree(table->symbolScopes);
+    memFree(table->symbolNames);
+    memFree(table->symbolTypes);
+    memFree(table->symbolSlots);
+    memFree(table->names);
+    memFree(table->nameBuckets);
+    memFree(table->scopes);
+    memFree(table->functions);
+    *table = (Symbol_Table){0};
+}
+
+inline Symbol_Entry tableSymbol(Symbol_Table* table, int index) {
+    return (Symbol_Entry){table->symbolScopes[index], table->names[table->symbolNames[index]], table->symbolTypes[index]};
+}
+
 void printSymbolTable(Symbol_Table table) {
     printf("Symbols:\n");
     for (int i = 0; i < table.symbolsLength; ++i) {
-        Symbol_Entry entry = table.symbols[i];
+        Symbol_Entry entry = tableSymbol(&table, i);
         printf("Scope id: %d, Name: "SV_FMT", Type: "SV_FMT"\n", entry.scopeId, SV_ARG(entry.name), SV_ARG(entry.type.name));
     }
 
     printf("--------------------------------------------------\n");
 
     printf("Parent data:\n");
-    for (int i = 0; i < table.parentsLength; ++i) {
-        Scope_Parent_Entry entry = table.scopeParents[i];
-        printf("This id: %d, Parent id: %d\n", entry.id, entry.parentId);
+    for (int i = 0; i < table.scopesLength; ++i) {
+        printf("This id: %d, Parent id: %d\n", i, table.scopes[i].parentId);
+    }
+}
+
+// Returns the entry of the scope with ID `scopeId`, adding empty root scopes up to it if the table hasn't seen it.
+Scope_Entry* tableScope(Symbol_Table* table, int scopeId) {
+    assert(scopeId >= 0);
+    if (scopeId >= table->scopesLength) {
+        if (scopeId >= table->scopesCapacity) {
+            while (scopeId >= table->scopesCapacity) {
+                table->scopesCapacity *= 2;
+            }
+            table->scopes = memRealloc(MEM_SCOPES, table->scopes, table->scopesCapacity * sizeof(Scope_Entry));
+        }
+        for (int i = table->scopesLength; i <= scopeId; ++i) {
+            table->scopes[i] = (Scope_Entry){.parentId = -1, .spillStart = -1};
+        }
+        table->scopesLength = scopeId + 1;
+    }
+    return &table->scopes[scopeId];
+}
+
+// Returns the bucket holding the name `name`, or the empty bucket it would go in. The map must not be empty.
+int* tableNameBucket(Symbol_Table* table, String_View name) {
+    size_t mask = (size_t)table->nameBucketsCapacity - 1;
+    size_t i = (size_t)hashBytes(name.start, name.length) & mask;
+    while (true) {
+        int* bucket = &table->nameBuckets[i];
+        if (*bucket == 0 || svEquals(table->names[*bucket - 1], name)) {
+            return bucket;
+        }
+        i = (i + 1) & mask;
     }
 }
 
+// Returns the ID of `name`, or -1 if no symbol has been given that name.
+int tableFindName(Symbol_Table* table, String_View name) {
+    if (table->namesLength == 0) {
+        return -1;
+    }
+    return *tableNameBucket(table, name) - 1;
+}
+
+// Returns the ID of `name`, giving it one if it doesn't have one yet.
+int tableInternName(Symbol_Table* table, String_View name) {
+    // Kept at most half full, so probe sequences stay short.
+    if ((table->namesLength + 1) * 2 > table->nameBucketsCapacity) {
+        table->nameBucketsCapacity = table->nameBucketsCapacity == 0 ? 64 : table->nameBucketsCapacity * 2;
+        memFree(table->nameBuckets);
+        table->nameBuckets = memAlloc(MEM_SYMBOLS, table->nameBucketsCapacity * sizeof(int));
+        memset(table->nameBuckets, 0, table->nameBucketsCapacity * sizeof(int));
+        for (int i = 0; i < table->namesLength; ++i) {
+            *tableNameBucket(table, table->names[i]) = i + 1;
+        }
+    }
+
+    int* bucket = tableNameBucket(table, name);
+    if (*bucket == 0) {
+        if (table->namesLength == table->namesCapacity) {
+            table->namesCapacity *= 2;
+            table->names = memRealloc(MEM_SYMBOLS, table->names, table->namesCapacity * sizeof(String_View));
+        }
+        table->names[table->namesLength++] = name;
+        *bucket = table->namesLength;
+    }
+    return *bucket - 1;
+}
+
 void addSymbol(Symbol_Table* table, int scopeId, String_View name, Type type) {
     if (table->symbolsLength == table->symbolsCapacity) {
         table->symbolsCapacity *= 2;
-        table->symbols = realloc(table->symbols, table->symbolsCapacity * sizeof(Symbol_Entry));
+        table->symbolScopes = memRealloc(MEM_SYMBOLS, table->symbolScopes, table->symbolsCapacity * sizeof(int));
+        table->symbolNames = memRealloc(MEM_SYMBOLS, table->symbolNames, table->symbolsCapacity * sizeof(int));
+        table->symbolTypes = memRealloc(MEM_SYMBOLS, table->symbolTypes, table->symbolsCapacity * sizeof(Type));
+        table->symbolSlots = memRealloc(MEM_SYMBOLS, table->symbolSlots, table->symbolsCapacity * sizeof(int));
+    }
+    Scope_Entry* scope = tableScope(table, scopeId);
+    if (scope->symbolCount == 0) {
+        scope->symbolStart = table->symbolsLength;
+        scope->symbolCount = 1;
+    }
+    else if (scope->symbolStart + scope->symbolCount == table->symbolsLength) {
+        scope->symbolCount++;
     }
-    table->symbols[table->symbolsLength++] = (Symbol_Entry){scopeId, name, type};
+    else if (scope->spillStart < 0) {
+        scope->spillStart = table->symbolsLength;
+    }
+    int index = table->symbolsLength++;
+    table->symbolScopes[index] = scopeId;
+    table->symbolNames[index] = tableInternName(table, name);
+    table->symbolTypes[index] = type;
+    table->symbolSlots[index] = -1;
 }
 
 void addScopeParent(Symbol_Table* table, int id, int parentId) {
-    if (table->parentsLength == table->parentsCapacity) {
-        table->parentsCapacity *= 2;
-        table->scopeParents = realloc(table->scopeParents, table->parentsCapacity * sizeof(Scope_Parent_Entry));
+    tableScope(table, id)->parentId = parentId;
+}
+
+// Returns the bucket holding the function `name`, or the empty bucket it would go in. The map must not be empty.
+Function_Entry* tableFunctionBucket(Symbol_Table* table, String_View name) {
+    size_t mask = (size_t)table->functionsCapacity - 1;
+    size_t i = (size_t)hashBytes(name.start, name.length) & mask;
+    while (true) {
+        ++table->probes;
+        Function_Entry* entry = &table->functions[i];
+        if (entry->function == NULL || svEquals(entry->name, name)) {
+            return entry;
+        }
+        i = (i + 1) & mask;
     }
-    table->scopeParents[table->parentsLength++] = (Scope_Parent_Entry){id, parentId};
 }
 
-void addScopeData(Symbol_Table* table, AST_Node* root, int parentId) {
-    assert(root->type == NODE_SCOPE);
+// Adds `function` to the function map. Returns false, keeping the existing entry, if the name is already taken.
+bool tableAddFunction(Symbol_Table* table, AST_Node* function, int index) {
+    assert(function->type == NODE_FUNCTION);
+
+    // Kept at most half full, so probe sequences stay short.
+    if ((table->functionsLength + 1) * 2 > table->functionsCapacity) {
+        Function_Entry* old = table->functions;
+        int oldCapacity = table->functionsCapacity;
+        table->functionsCapacity = oldCapacity == 0 ? 16 : oldCapacity * 2;
+        table->functions = memAlloc(MEM_SYMBOLS, table->functionsCapacity * sizeof(Function_Entry));
+        memset(table->functions, 0, table->functionsCapacity * sizeof(Function_Entry));
+        for (int i = 0; i < oldCapacity; ++i) {
+            if (old[i].function != NULL) {
+                *tableFunctionBucket(table, old[i].name) = old[i];
+            }
+        }
+        memFree(old);
+    }
 
-    AST_Node* statements = root->data.scopeStatements;
-    // If the root is empty, there's no data to add.
-    if (statements == NULL) {
-        return;
+    String_View name = function->data.functionName;
+    Function_Entry* entry = tableFunctionBucket(table, name);
+    if (entry->function != NULL) {
+        return false;
     }
+    *entry = (Function_Entry){name, function, index};
+    table->functionsLength++;
+    return true;
+}
 
-    addScopeParent(table, root->data.scopeId, parentId);
-    while (statements != NULL) {
-        AST_Node* statement = statements->data.statementStatement;
+// Returns the entry for the function `name`, or NULL if there is no such function.
+Function_Entry* tableLookupFunction(Symbol_Table* table, String_View name) {
+    if (table->functionsCapacity == 0) {
+        return NULL;
+    }
+    Function_Entry* entry = tableFunctionBucket(table, name);
+    return entry->function != NULL ? entry : NULL;
+}
 
-        switch (statement->type) {
-            case NODE_DECLARATION: {
-                addSymbol(table, root->data.scopeId, statement->data.declarationName, statement->data.declarationType);
-                break;
-            }
-            case NODE_SCOPE: {
-                addScopeData(table, statements->data.statementStatement, root->data.scopeId);
-                break;
-            }
-            case NODE_IF:
-            case NODE_WHILE: {
-                addScopeData(table, statement->data.controlScope, root->data.scopeId);
-                break;
-            }
-            case NODE_ELSE: {
-                addScopeData(table, statement->data.elseScope, root->data.scopeId);
-                break;
-            }
+// Adds every function in `program` to the function map. Duplicates keep the first definition, and are reported by
+// verification.
+void tableAddFunctions(Symbol_Table* table, Program program) {
+    for (int i = 0; i < program.length; ++i) {
+        tableAddFunction(table, program.nodes[i], i);
+    }
+}
+
+// Empty scopes are added too, so that every scope has a parent. The declarations of the scope are added before any
+// nested scope is visited, so that its symbols are contiguous.
+bool addScopeDataScope(Traversal* traversal, AST_Node* node) {
+    Symbol_Table* table = traversal->context;
+    addScopeParent(table, node->data.scopeId, traversalFrame(traversal)->scopeId);
+    for (AST_Node* statements = node->data.scopeStatements; statements != NULL; statements = statements->data.statementNext) {
+        AST_Node* statement = statements->data.statementStatement;
+        if (statement->type == NODE_DECLARATION) {
+            addSymbol(table, node->data.scopeId, statement->data.declarationName, statement->data.declarationType);
         }
-        statements = statements->data.statementNext;
     }
+    return true;
+}
+
+// Only the body of a control statement can declare anything.
+bool addScopeDataControl(Traversal* traversal, AST_Node* node, AST_Node* child, int index) {
+    (void)traversal;
+    (void)node;
+    (void)index;
+    return child->type == NODE_SCOPE;
+}
+
+void addScopeData(Symbol_Table* table, AST_Node* root, int parentId) {
+    assert(root->type == NODE_SCOPE);
+
+    Traversal traversal = {
+        .pre = {
+            [NODE_SCOPE] = addScopeDataScope,
+            [NODE_DECLARATION] = traversalSkip,
+            [NODE_RETURN] = traversalSkip,
+            [NODE_ASSIGNMENT] = traversalSkip,
+            [NODE_CALL] = traversalSkip,
+        },
+        .child = {
+            [NODE_IF] = addScopeDataControl,
+            [NODE_WHILE] = addScopeDataControl,
+        },
+        .context = table,
+    };
+    traverse(&traversal, root, parentId);
+    freeTraversal(&traversal);
 }
 
 void addFunctionData(Symbol_Table* table, AST_Node* root, int parentId) {
     assert(root->type == NODE_FUNCTION);
 
     AST_Node* body = root->data.functionBody;
-    // If the body of the function is empty, then we don't need to add any of the heirarchy data or argument symbols.
-    if (body->data.scopeStatements == NULL) {
-        return;
+    // If the body of the function is empty, then nothing can refer to the arguments, so they don't need symbols.
+    if (body->data.scopeStatements != NULL) {
+        // Added before the body's declarations, so that they start the body scope's slice.
+        AST_Node* arg = root->data.functionArgs;
+        while (arg != NULL) {
+            addSymbol(table, body->data.scopeId, arg->data.argName, arg->data.argType);
+            arg = arg->data.argNext;
+        }
     }
 
-    AST_Node* arg = root->data.functionArgs;
-    while (arg != NULL) {
-        addSymbol(table, body->data.scopeId, arg->data.argName, arg->data.argType);
-        arg = arg->data.argNext;
+    addScopeData(table, root->data.functionBody, parentId);
+}
+
+// Gives every symbol a slot in its function's frame, and every function in `program` the size of its frame. Slots
+// are Values, so a symbol's byte offset is its slot times `sizeof(Value)`. A scope's slots start after its parent's,
+// so sibling scopes, which are never live at the same time, share them.
+void tableAssignSlots(Symbol_Table* table, Program program) {
+    for (int i = 0; i < table->scopesLength; ++i) {
+        table->scopes[i].slotStart = -1;
+        table->scopes[i].slotCount = 0;
+    }
+    // Slots are first numbered within each scope, in table order so that arguments come first.
+    for (int i = 0; i < table->symbolsLength; ++i) {
+        Scope_Entry* scope = &table->scopes[table->symbolScopes[i]];
+        table->symbolSlots[i] = scope->slotCount;
+        scope->slotCount += typeSlotCount(table->symbolTypes[i]);
     }
 
-    addScopeData(table, root->data.functionBody, parentId);
+    // A scope's start depends on its parent's, so the chain of scopes without one is walked up and then numbered on
+    // the way back down. Each scope is numbered once.
+    int* frameEnds = calloc(table->scopesLength + 1, sizeof(int)); // Frame size so far, indexed by function body scope
+    int* roots = malloc((table->scopesLength + 1) * sizeof(int));
+    int* chain = malloc((table->scopesLength + 1) * sizeof(int));
+    for (int i = 0; i < table->scopesLength; ++i) {
+        int chainLength = 0;
+        for (int id = i; id != -1 && table->scopes[id].slotStart < 0; id = table->scopes[id].parentId) {
+            chain[chainLength++] = id;
+        }
+        while (chainLength > 0) {
+            int id = chain[--chainLength];
+            Scope_Entry* scope = &table->scopes[id];
+            if (scope->parentId == -1) {
+                scope->slotStart = 0;
+                roots[id] = id;
+            }
+            else {
+                Scope_Entry* parent = &table->scopes[scope->parentId];
+                scope->slotStart = parent->slotStart + parent->slotCount;
+                roots[id] = roots[scope->parentId];
+            }
+            int end = scope->slotStart + scope->slotCount;
+            if (end > frameEnds[roots[id]]) {
+                frameEnds[roots[id]] = end;
+            }
+        }
+    }
+    // A function's symbols are added together, so they are a contiguous range once the table is built.
+    int* symbolStarts = malloc((table->scopesLength + 1) * sizeof(int)); // Indexed by function body scope
+    int* symbolEnds = calloc(table->scopesLength + 1, sizeof(int));
+    for (int i = 0; i < table->scopesLength; ++i) {
+        symbolStarts[i] = -1;
+    }
+    for (int i = 0; i < table->symbolsLength; ++i) {
+        table->symbolSlots[i] += table->scopes[table->symbolScopes[i]].slotStart;
+        int root = roots[table->symbolScopes[i]];
+        if (symbolStarts[root] < 0) {
+            symbolStarts[root] = i;
+        }
+        symbolEnds[root] = i + 1;
+    }
+
+    for (int i = 0; i < program.length; ++i) {
+        AST_Node* function = program.nodes[i];
+        int bodyScope = function->data.functionBody->data.scopeId;
+        bool hasSymbols = bodyScope < table->scopesLength && symbolStarts[bodyScope] >= 0;
+        function->data.functionFrameSize = bodyScope < table->scopesLength ? frameEnds[bodyScope] : 0;
+        function->data.functionSymbolStart = hasSymbols ? symbolStarts[bodyScope] : 0;
+        function->data.functionSymbolEnd = hasSymbols ? symbolEnds[bodyScope] : 0;
+    }
+    free(symbolEnds);
+    free(symbolStarts);
+    free(chain);
+    free(roots);
+    free(frameEnds);
 }
 
 void initSymbolTable(Symbol_Table* table, Program program) {
+    tableAddFunctions(table, program);
     for (int i = 0; i < program.length; ++i) {
         addFunctionData(table, program.nodes[i], -1);
     }
+    tableAssignSlots(table, program);
 }
 
-Scope_Parent_Entry tableLookupParent(Symbol_Table* table, int scopeId) {
-    for (int i = 0; i < table->parentsLength; ++i) {
-        Scope_Parent_Entry entry = table->scopeParents[i];
-        if (entry.id == scopeId) {
-            return entry;
-        }
-    }
-    assert(false && "Unreachable (tableLookupParent)");
+// Returns the ID of the immediate parent of the scope with ID `scopeId`, or -1 if it is a root. Scopes the table hasn't
+// seen, like those the optimizer makes before the table is rebuilt, have no symbols and are treated as roots.
+inline int tableLookupParent(Symbol_Table* table, int scopeId) {
+    return scopeId < table->scopesLength ? table->scopes[scopeId].parentId : -1;
 }
 
 typedef struct {
@@ -1946,17 +3413,63 @@ typedef struct {
     Symbol_Entry entry;
 } Symbol_Lookup_Result;
 
-Symbol_Lookup_Result tableLookupSymbol(Symbol_Table* table, int scopeId, String_View name) {
-    while (scopeId != -1) {
-        for (int i = 0; i < table->symbolsLength; ++i) {
-            Symbol_Entry entry = table->symbols[i];
-            if (entry.scopeId == scopeId && svEquals(entry.name, name)) {
-                return (Symbol_Lookup_Result){true, entry};
+// Returns the index of the first of `names[start..end)` equal to `name`, or -1 if there is none. Eight names are
+// compared at a time where SSE2 is available, though most scopes are shorter than that and only use the plain loop.
+int findNameId(int* names, int start, int end, int name) {
+    int i = start;
+#ifdef LCOM_SSE2
+    __m128i wanted = _mm_set1_epi32(name);
+    for (; i + 8 <= end; i += 8) {
+        __m128i low = _mm_cmpeq_epi32(_mm_loadu_si128((__m128i*)&names[i]), wanted);
+        __m128i high = _mm_cmpeq_epi32(_mm_loadu_si128((__m128i*)&names[i + 4]), wanted);
+        unsigned int mask = (unsigned int)_mm_movemask_ps(_mm_castsi128_ps(low))
+            | (unsigned int)_mm_movemask_ps(_mm_castsi128_ps(high)) << 4;
+        if (mask != 0) {
+            return i + lowestSetBit(mask);
+        }
+    }
+#endif
+    for (; i < end; ++i) {
+        if (names[i] == name) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Returns the index of the symbol in the table, or -1 if it is not visible from the scope with ID `scopeId`.
+int tableLookupSymbolIndex(Symbol_Table* table, int scopeId, String_View name) {
+    int nameId = tableFindName(table, name);
+    if (nameId < 0) {
+        return -1;
+    }
+    while (scopeId != -1 && scopeId < table->scopesLength) {
+        Scope_Entry* scope = &table->scopes[scopeId];
+        int end = scope->symbolStart + scope->symbolCount;
+        int index = findNameId(table->symbolNames, scope->symbolStart, end, nameId);
+        table->probes += (index < 0 ? end : index + 1) - scope->symbolStart;
+        if (index >= 0) {
+            return index;
+        }
+        if (scope->spillStart >= 0) {
+            for (int i = scope->spillStart; i < table->symbolsLength; ++i) {
+                ++table->probes;
+                if (table->symbolScopes[i] == scopeId && table->symbolNames[i] == nameId) {
+                    return i;
+                }
             }
         }
-        scopeId = tableLookupParent(table, scopeId).parentId;
+        scopeId = scope->parentId;
+    }
+    return -1;
+}
+
+Symbol_Lookup_Result tableLookupSymbol(Symbol_Table* table, int scopeId, String_View name) {
+    int index = tableLookupSymbolIndex(table, scopeId, name);
+    if (index < 0) {
+        return (Symbol_Lookup_Result){false};
     }
-    return (Symbol_Lookup_Result){false};
+    return (Symbol_Lookup_Result){true, tableSymbol(table, index)};
 }
 
 
@@ -1968,7 +3481,6 @@ Symbol_Lookup_Result tableLookupSymbol(Symbol_Table* table, int scopeId, String_
 bool verifyProgram(Symbol_Table* table, Program program);
 bool verifyFunction(Symbol_Table* table, AST_Node* root);
 bool verifyScope(Symbol_Table* table, AST_Node* root);
-bool verifyExpr(Symbol_Table* table, AST_Node* root, int scopeId);
 
 bool verifyProgram(Symbol_Table* table, Program program) {
     bool success = true;
@@ -1985,102 +3497,108 @@ bool verifyProgram(Symbol_Table* table, Program program) {
 bool verifyFunction(Symbol_Table* table, AST_Node* root) {
     assert(root->type == NODE_FUNCTION);
 
-    return verifyScope(table, root->data.functionBody);
-}
-
-bool verifyScope(Symbol_Table* table, AST_Node* root) {
-    bool success = true;
+    traceBegin("verify", root->data.functionName);
+    bool success = verifyScope(table, root->data.functionBody);
 
-    assert(root->type == NODE_SCOPE);
+    // The function map keeps the first definition of each name, so any other definition is a duplicate.
+    Function_Entry* entry = tableLookupFunction(table, root->data.functionName);
+    assert(entry != NULL);
+    if (entry->function->data.functionName.start != root->data.functionName.start) {
+        diagnosticf("ERROR! Function \""SV_FMT"\" is defined more than once\n", SV_ARG(root->data.functionName));
+        success = false;
+    }
+    traceEnd("verify", root->data.functionName);
+    return success;
+}
 
-    AST_Node* statements = root->data.scopeStatements;
-    while (statements != NULL) {
-        AST_Node* statement = statements->data.statementStatement;
+// `context` of the traversal in `verifyScope`. Every failure is reported, so the scope verifies if nothing was.
+typedef struct {
+    Symbol_Table* table;
+    int errors;
+} Verifier;
+
+bool verifyAssignment(Traversal* traversal, AST_Node* node) {
+    Verifier* verifier = traversal->context;
+    Symbol_Lookup_Result result = tableLookupSymbol(verifier->table, traversalFrame(traversal)->scopeId, node->data.assignmentName);
+    if (!result.exists) {
+        diagnosticf("ERROR! Use of undeclared identifier \""SV_FMT"\"\n", SV_ARG(node->data.assignmentName));
+        verifier->errors++;
+    }
+    return true;
+}
 
-        switch (statement->type) {
-            case NODE_RETURN: {
-                if (!verifyExpr(table, statement->data.returnExpr, root->data.scopeId)) {
-                    success = false;
-                }
-                break;
-            }
-            case NODE_ASSIGNMENT: {
-                Symbol_Lookup_Result result = tableLookupSymbol(table, root->data.scopeId, statement->data.assignmentName);
-                if (!result.exists) {
-                    fprintf(stderr, "ERROR! Use of undeclared identifier \""SV_FMT"\"\n", SV_ARG(statement->data.assignmentName));
-                    success = false;
-                }
-                break;
-            }
-            case NODE_SCOPE: {
-                if (!verifyScope(table, statements->data.statementStatement)) {
-                    success = false;
-                }
-                break;
-            }
-            case NODE_IF:
-            case NODE_WHILE: {
-                if (!verifyExpr(table, statement->data.controlCondition, root->data.scopeId)) {
-                    success = false;
-                }
-                if (!verifyScope(table, statement->data.controlScope)) {
-                    success = false;
-                }
-                break;
-            }
-            case NODE_ELSE: {
-                if (!verifyScope(table, statement->data.elseScope)) {
-                    success = false;
-                }
-                break;
-            }
-            case NODE_DECLARATION: {
-                break;
-            }
-            default:
-                printf("Unknown statement type: %d\n", statement->type);
-                assert(false && "Not a statement type or non-exhaustive cases (verifyScope)");
-        }
+bool verifyIdent(Traversal* traversal, AST_Node* node) {
+    Verifier* verifier = traversal->context;
+    Symbol_Lookup_Result result = tableLookupSymbol(verifier->table, traversalFrame(traversal)->scopeId, node->data.identName);
+    if (!result.exists) {
+        diagnosticf("ERROR! Variable \""SV_FMT"\" used before it was declared\n", SV_ARG(node->data.identName));
+        verifier->errors++;
+    }
+    return false;
+}
 
-        statements = statements->data.statementNext;
+bool verifyArrayAccess(Traversal* traversal, AST_Node* node) {
+    Verifier* verifier = traversal->context;
+    Symbol_Lookup_Result result = tableLookupSymbol(verifier->table, traversalFrame(traversal)->scopeId, node->data.accessArrayName);
+    if (!result.exists) {
+        diagnosticf("ERROR! Array \""SV_FMT"\" used before it was declared\n", SV_ARG(node->data.accessArrayName));
+        verifier->errors++;
+        return false;
+    }
+    if (result.entry.type.size < 0) {
+        diagnosticf("ERROR! Variable \""SV_FMT"\" is indexed, but is not an array\n", SV_ARG(node->data.accessArrayName));
+        verifier->errors++;
+        return false;
     }
+    return true;
+}
 
-    return success;
+bool verifyCall(Traversal* traversal, AST_Node* node) {
+    Verifier* verifier = traversal->context;
+    if (tableLookupFunction(verifier->table, node->data.callName) == NULL) {
+        diagnosticf("ERROR! Call to undefined function \""SV_FMT"\"\n", SV_ARG(node->data.callName));
+        verifier->errors++;
+    }
+    return true;
 }
 
-bool verifyExpr(Symbol_Table* table, AST_Node* root, int scopeId) {
-    switch (root->type) {
-        case NODE_INT:
-        case NODE_BOOL: {
-            return true;
-        }
+// The right operand of an operator is only verified if the left one was fine.
+bool verifyOperand(Traversal* traversal, AST_Node* node, AST_Node* child, int index) {
+    (void)node;
+    (void)child;
+    Verifier* verifier = traversal->context;
+    Traversal_Frame* frame = traversalFrame(traversal);
+    if (index == 0) {
+        frame->mark = verifier->errors;
+        return true;
+    }
+    return verifier->errors == frame->mark;
+}
 
-        case NODE_IDENT: {
-            Symbol_Lookup_Result result = tableLookupSymbol(table, scopeId, root->data.identName);
-            if (!result.exists) {
-                fprintf(stderr, "ERROR! Variable \""SV_FMT"\" used before it was declared\n", SV_ARG(root->data.identName));
-                return false;
-            }
-            return true;
-        }
+bool verifyScope(Symbol_Table* table, AST_Node* root) {
+    assert(root->type == NODE_SCOPE);
 
-        case NODE_PLUS:
-        case NODE_MINUS:
-        case NODE_TIMES:
-        case NODE_DIVIDE:
-        case NODE_IS_EQUAL: {
-            if (!verifyExpr(table, root->data.binaryOpLeft, scopeId)) {
-                return false;
-            }
-            if (!verifyExpr(table, root->data.binaryOpRight, scopeId)) {
-                return false;
-            }
-            return true;
-        }
-        default:
-            printf("Unknown expression node: %d\n", root->type);
-            assert(false && "Not an expression type or non-exhaustive cases (verifyExpr)");
-    }
+    Verifier verifier = {table, 0};
+    Traversal traversal = {
+        .pre = {
+            [NODE_ASSIGNMENT] = verifyAssignment,
+            [NODE_IDENT] = verifyIdent,
+            [NODE_ARRAY_ACCESS] = verifyArrayAccess,
+            [NODE_CALL] = verifyCall,
+        },
+        .child = {
+            [NODE_PLUS] = verifyOperand,
+            [NODE_MINUS] = verifyOperand,
+            [NODE_TIMES] = verifyOperand,
+            [NODE_DIVIDE] = verifyOperand,
+            [NODE_IS_EQUAL] = verifyOperand,
+        },
+        .context = &verifier,
+    };
+    static_assert(NUM_BINOP_NODES == 5, "Non-exhaustive hooks (verifyScope)");
+    traverse(&traversal, root, -1);
+    freeTraversal(&traversal);
+    return verifier.errors == 0;
 }
 
 
@@ -2111,348 +3629,6108 @@ bool typeCheckProgram(Symbol_Table* table, Program program) {
 
 bool typeCheckFunction(Symbol_Table* table, AST_Node* root) {
     assert(root->type == NODE_FUNCTION);
-    
-    return expectScopeType(table, root->data.functionBody, root->data.functionRetType);
-}
 
-bool expectScopeType(Symbol_Table* table, AST_Node* root, Type expected) {
-    bool success = true;
-    assert(root->type == NODE_SCOPE);
+    traceBegin("typeCheck", root->data.functionName);
+    bool success = expectScopeType(table, root->data.functionBody, root->data.functionRetType);
+    traceEnd("typeCheck", root->data.functionName);
+    return success;
+}
 
-    AST_Node* statements = root->data.scopeStatements;
-    while (statements != NULL) {
-        AST_Node* statement = statements->data.statementStatement;
+typedef struct {
+    Type type;
+    AST_Node* literal; // The expression, if it is nothing but integer literals and arithmetic operators on them
+} Expr_Type;
 
-        switch (statement->type) {
-            case NODE_RETURN: {
-                Type exprType = getExprType(table, statement->data.returnExpr, root->data.scopeId);
-                if (exprType.id == TYPE_UNKNOWN) {
-                    fprintf(stderr, "ERROR! Could not evaluate type of return expression.\n");
-                    success = false;
-                }
-                if (!typeEquals(exprType, expected)) {
-                    printf("Ids: %d; %d, Sizes: %d; %d\n", exprType.id, expected.id, exprType.size, expected.size);
-                    fprintf(stderr, "ERROR! Type mismatch. Expected "SV_FMT", got "SV_FMT"\n", SV_ARG(expected.name), SV_ARG(exprType.name));
-                    success = false;
-                }
-                break;
-            }
-            case NODE_ASSIGNMENT: {
-                Symbol_Lookup_Result var = tableLookupSymbol(table, root->data.scopeId, statement->data.assignmentName);
-                assert(var.exists);
-                Type varType = var.entry.type;
-                Type exprType = getExprType(table, statement->data.assignmentExpr, root->data.scopeId);
-                if (exprType.id == TYPE_UNKNOWN) {
-                    //TODO: IMPROVE THIS ERROR MESSAGE!!!!! Lexical scoping of AST_Nodes
-                    fprintf(stderr, "ERROR! Could not evalutate the right hand side of assignment\n");
-                    success = false;
-                }
-                if (!typeEquals(varType, exprType)) {
-                    fprintf(stderr, "ERROR! Type mismatch. Expected "SV_FMT", got "SV_FMT"\n", SV_ARG(varType.name), SV_ARG(exprType.name));
-                    success = false;
-                }
-                break;
-            }
-            case NODE_IF:
-            case NODE_WHILE: {
-                Type conditionType = getExprType(table, statement->data.controlCondition, root->data.scopeId);
-                if (conditionType.id == TYPE_UNKNOWN) {
-                    fprintf(stderr, "ERROR! Could not evaluate type of control condition\n");
-                    success = false;
-                }
-                if (!typeEquals(conditionType, makeType(TYPE_BOOL))) {
-                    fprintf(stderr, "ERROR! Type mismatch. Expected bool, got "SV_FMT"\n", SV_ARG(conditionType.name));
-                    success = false;
-                }
+// `context` of the traversals in `expectScopeType` and `getExprType`. Each expression pushes its type on `types` once
+// its children are done, and whoever uses it pops it. Calls made as statements check their own result instead.
+typedef struct {
+    Symbol_Table* table;
+    Type expected; // Return type of the function
+    bool success;
 
-                expectScopeType(table, statement->data.controlScope, makeType(TYPE_UNIT));
-                break;
-            }
-            case NODE_ELSE: {
-                if (!expectScopeType(table, statement->data.elseScope, makeType(TYPE_UNIT))) {
-                    success = false;
-                }
-                break;
-            }
-            case NODE_SCOPE: {
-                if (!expectScopeType(table, statements->data.statementStatement, makeType(TYPE_UNIT))) {
-                    success = false;
-                }
-                break;
-            }
-        }
+    Expr_Type* types;
+    int typesLength;
+    int typesCapacity;
+} Type_Checker;
 
-        statements = statements->data.statementNext;
+void pushExprEntry(Type_Checker* checker, Expr_Type entry) {
+    if (checker->typesLength == checker->typesCapacity) {
+        checker->typesCapacity = checker->typesCapacity == 0 ? 64 : checker->typesCapacity * 2;
+        checker->types = realloc(checker->types, checker->typesCapacity * sizeof(Expr_Type));
     }
-    return success;
+    checker->types[checker->typesLength++] = entry;
 }
 
-Type getExprType(Symbol_Table* table, AST_Node* root, int scopeId) {
-    switch (root->type) {
+inline void pushExprType(Type_Checker* checker, Type type) {
+    pushExprEntry(checker, (Expr_Type){type, NULL});
+}
+
+// Gives the integer literal `node` the type `type`, which it has to fit in.
+void typeLiteralAs(Type_Checker* checker, AST_Node* node, Type type) {
+    uint64_t magnitude = (uint64_t)node->data.intValue;
+    if (!integerTypeHoldsValue(type.id, magnitude)) {
+        diagnosticf("ERROR! Integer literal %llu does not fit in "SV_FMT"\n", (unsigned long long)magnitude, SV_ARG(type.name));
+        checker->success = false;
+    }
+    node->data.intType = type.id;
+}
+
+// Pops the type of an expression that is used where a `wanted` is expected. Integer literals, and arithmetic on nothing
+// but them like `0 - 1`, have no type of their own: they take on `wanted` if that is an integer type and are an `int`
+// otherwise, as long as every literal fits.
+Type popExprTypeAs(Type_Checker* checker, Type wanted) {
+    assert(checker->typesLength > 0);
+    Expr_Type entry = checker->types[--checker->typesLength];
+    if (entry.literal == NULL) {
+        return entry.type;
+    }
+    Type type = isIntegerType(wanted) ? wanted : makeType(TYPE_INT);
+    if (entry.literal->type == NODE_INT) {
+        typeLiteralAs(checker, entry.literal, type);
+        return type;
+    }
+    // Operators on literals can nest as deeply as the source does, so they are walked with an explicit stack.
+    int stackCapacity = 16;
+    AST_Node** stack = malloc(stackCapacity * sizeof(AST_Node*));
+    int stackLength = 0;
+    stack[stackLength++] = entry.literal;
+    while (stackLength > 0) {
+        AST_Node* node = stack[--stackLength];
+        if (node->type == NODE_INT) {
+            typeLiteralAs(checker, node, type);
+            continue;
+        }
+        node->data.binaryOpType = type.id;
+        if (stackLength + 2 > stackCapacity) {
+            stackCapacity *= 2;
+            stack = realloc(stack, stackCapacity * sizeof(AST_Node*));
+        }
+        stack[stackLength++] = node->data.binaryOpRight;
+        stack[stackLength++] = node->data.binaryOpLeft;
+    }
+    free(stack);
+    return type;
+}
+
+inline Type popExprType(Type_Checker* checker) {
+    return popExprTypeAs(checker, makeType(TYPE_UNKNOWN));
+}
+
+void typeCheckReturn(Traversal* traversal, AST_Node* node) {
+    (void)node;
+    Type_Checker* checker = traversal->context;
+    Type exprType = popExprTypeAs(checker, checker->expected);
+    if (exprType.id == TYPE_UNKNOWN) {
+        diagnosticf("ERROR! Could not evaluate type of return expression.\n");
+        checker->success = false;
+    }
+    if (!typeEquals(exprType, checker->expected)) {
+        diagnosticf("ERROR! Type mismatch. Expected "SV_FMT", got "SV_FMT"\n", SV_ARG(checker->expected.name), SV_ARG(exprType.name));
+        checker->success = false;
+    }
+}
+
+void typeCheckAssignment(Traversal* traversal, AST_Node* node) {
+    Type_Checker* checker = traversal->context;
+    Symbol_Lookup_Result var = tableLookupSymbol(checker->table, traversalFrame(traversal)->scopeId, node->data.assignmentName);
+    assert(var.exists);
+    Type varType = var.entry.type;
+    Type exprType = popExprTypeAs(checker, varType);
+    if (exprType.id == TYPE_UNKNOWN) {
+        //TODO: IMPROVE THIS ERROR MESSAGE!!!!! Lexical scoping of AST_Nodes
+        diagnosticf("ERROR! Could not evalutate the right hand side of assignment\n");
+        checker->success = false;
+    }
+    if (!typeEquals(varType, exprType)) {
+        diagnosticf("ERROR! Type mismatch. Expected "SV_FMT", got "SV_FMT"\n", SV_ARG(varType.name), SV_ARG(exprType.name));
+        checker->success = false;
+    }
+}
+
+// Checks the condition of an `if` or `while` once it's done, before the body. Nested scopes return from the enclosing
+// function, so the body expects the same return type.
+bool typeCheckControl(Traversal* traversal, AST_Node* node, AST_Node* child, int index) {
+    (void)node;
+    (void)child;
+    Type_Checker* checker = traversal->context;
+    if (index == 1) {
+        Type conditionType = popExprType(checker);
+        if (conditionType.id == TYPE_UNKNOWN) {
+            diagnosticf("ERROR! Could not evaluate type of control condition\n");
+            checker->success = false;
+        }
+        if (!typeEquals(conditionType, makeType(TYPE_BOOL))) {
+            diagnosticf("ERROR! Type mismatch. Expected bool, got "SV_FMT"\n", SV_ARG(conditionType.name));
+            checker->success = false;
+        }
+    }
+    return true;
+}
+
+bool typeCheckLiteral(Traversal* traversal, AST_Node* node) {
+    if (node->type == NODE_INT && node->data.intType != TYPE_UNKNOWN) {
+        // Already typed, by an earlier check or by the optimizer.
+        pushExprType(traversal->context, makeType(node->data.intType));
+    }
+    else if (node->type == NODE_INT) {
+        pushExprEntry(traversal->context, (Expr_Type){makeType(TYPE_INT), node});
+    }
+    else {
+        pushExprType(traversal->context, makeType(TYPE_BOOL));
+    }
+    return false;
+}
+
+bool typeCheckIdent(Traversal* traversal, AST_Node* node) {
+    Type_Checker* checker = traversal->context;
+    Symbol_Lookup_Result result = tableLookupSymbol(checker->table, traversalFrame(traversal)->scopeId, node->data.identName);
+    assert(result.exists);
+    pushExprType(checker, result.entry.type);
+    return false;
+}
+
+// The index can be of any integer type, so that a table of 256 entries can be indexed by a u8.
+void typeCheckArrayAccess(Traversal* traversal, AST_Node* node) {
+    Type_Checker* checker = traversal->context;
+    Type indexType = popExprType(checker);
+    if (indexType.id != TYPE_UNKNOWN && !isIntegerType(indexType)) {
+        diagnosticf("ERROR! Index into \""SV_FMT"\" should be an integer, but is "SV_FMT"\n", SV_ARG(node->data.accessArrayName), SV_ARG(indexType.name));
+        checker->success = false;
+    }
+
+    Symbol_Lookup_Result result = tableLookupSymbol(checker->table, traversalFrame(traversal)->scopeId, node->data.accessArrayName);
+    assert(result.exists);
+    assert(result.entry.type.size >= 0);
+    Type elemType = result.entry.type;
+    elemType.size = -1;
+    pushExprType(checker, elemType);
+}
+
+// Nodes made by the optimizer, which only work on ints.
+bool typeCheckOptimized(Traversal* traversal, AST_Node* node) {
+    (void)node;
+    pushExprType(traversal->context, makeType(TYPE_INT));
+    return false;
+}
+
+// An integer literal takes on the type of the other operand, so that `x + 1` works whatever integer type `x` is.
+// Arithmetic on two literals is a literal itself, and takes its type from where it is used.
+void typeCheckOperator(Traversal* traversal, AST_Node* node) {
+    Type_Checker* checker = traversal->context;
+    Expr_Type leftEntry = checker->types[checker->typesLength - 2];
+    Expr_Type rightEntry = checker->types[checker->typesLength - 1];
+    if (node->type != NODE_IS_EQUAL && leftEntry.literal != NULL && rightEntry.literal != NULL) {
+        checker->typesLength -= 2;
+        pushExprEntry(checker, (Expr_Type){makeType(TYPE_INT), node});
+        return;
+    }
+    Type right = popExprTypeAs(checker, leftEntry.literal == NULL ? leftEntry.type : makeType(TYPE_UNKNOWN));
+    Type left = popExprTypeAs(checker, right);
+    if (left.id == TYPE_UNKNOWN || right.id == TYPE_UNKNOWN) {
+        diagnosticf("ERROR! Could not evaluate expression type\n");
+        pushExprType(checker, makeType(TYPE_UNKNOWN));
+        return;
+    }
+    if (!typeEquals(left, right)) {
+        diagnosticf("ERROR! Type mismatch. Left is "SV_FMT", right is "SV_FMT"\n", SV_ARG(left.name), SV_ARG(right.name));
+        pushExprType(checker, makeType(TYPE_UNKNOWN));
+        return;
+    }
+    node->data.binaryOpType = left.id;
+    pushExprType(checker, node->type == NODE_IS_EQUAL ? makeType(TYPE_BOOL) : left);
+}
+
+void typeCheckConversion(Traversal* traversal, AST_Node* node) {
+    Type_Checker* checker = traversal->context;
+    Type to = makeType(node->data.convertType);
+    Type from = popExprTypeAs(checker, to);
+    if (from.id == TYPE_UNKNOWN) {
+        pushExprType(checker, from);
+        return;
+    }
+    if (!isIntegerType(from)) {
+        diagnosticf("ERROR! Only integers can be converted to "SV_FMT", but got "SV_FMT"\n", SV_ARG(to.name), SV_ARG(from.name));
+        checker->success = false;
+    }
+    else if (!integerTypeHolds(to.id, from.id)) {
+        diagnosticf("ERROR! Converting "SV_FMT" to "SV_FMT" could lose information, since "SV_FMT" can't hold every "SV_FMT"\n", SV_ARG(from.name), SV_ARG(to.name), SV_ARG(to.name), SV_ARG(from.name));
+        checker->success = false;
+    }
+    pushExprType(checker, to);
+}
+
+// Hands over the result of a call. A call made as a statement discards it, but still fails if it's unknown.
+void typeCheckCallResult(Traversal* traversal, Type type) {
+    Type_Checker* checker = traversal->context;
+    if (traversalIsStatement(traversal)) {
+        if (type.id == TYPE_UNKNOWN) {
+            checker->success = false;
+        }
+    }
+    else {
+        pushExprType(checker, type);
+    }
+}
+
+// The frame of a call keeps the parameter of the argument being checked in `extra`, and whether every argument so far
+// matched in `mark`.
+bool typeCheckCall(Traversal* traversal, AST_Node* node) {
+    Type_Checker* checker = traversal->context;
+    Function_Entry* entry = tableLookupFunction(checker->table, node->data.callName);
+    assert(entry != NULL);
+    AST_Node* function = entry->function;
+
+    int paramCount = 0;
+    for (AST_Node* param = function->data.functionArgs; param != NULL; param = param->data.argNext) {
+        paramCount++;
+    }
+    int argCount = 0;
+    for (AST_Node* arg = node->data.callArgs; arg != NULL; arg = arg->data.callArgNext) {
+        argCount++;
+    }
+    if (argCount != paramCount) {
+        diagnosticf("ERROR! Function \""SV_FMT"\" takes %d arguments, but was called with %d\n", SV_ARG(node->data.callName), paramCount, argCount);
+        typeCheckCallResult(traversal, makeType(TYPE_UNKNOWN));
+        return false;
+    }
+
+    Traversal_Frame* frame = traversalFrame(traversal);
+    frame->mark = true;
+    frame->extra = function->data.functionArgs;
+    return true;
+}
+
+// Checks the argument for the parameter in the frame's `extra`, once it's done.
+void typeCheckArgument(Traversal* traversal, AST_Node* node) {
+    Type_Checker* checker = traversal->context;
+    Traversal_Frame* frame = traversalFrame(traversal);
+    AST_Node* param = frame->extra;
+    if (param->data.argType.size >= 0) {
+        return; // Already reported, and never checked
+    }
+
+    Type argType = popExprTypeAs(checker, param->data.argType);
+    if (argType.id == TYPE_UNKNOWN) {
+        frame->mark = false;
+    }
+    else if (!typeEquals(argType, param->data.argType)) {
+        diagnosticf("ERROR! Type mismatch in argument \""SV_FMT"\" of \""SV_FMT"\". Expected "SV_FMT", got "SV_FMT"\n", SV_ARG(param->data.argName), SV_ARG(node->data.callName), SV_ARG(param->data.argType.name), SV_ARG(argType.name));
+        frame->mark = false;
+    }
+}
+
+bool typeCheckCallArgument(Traversal* traversal, AST_Node* node, AST_Node* child, int index) {
+    (void)child;
+    Traversal_Frame* frame = traversalFrame(traversal);
+    if (index > 0) {
+        typeCheckArgument(traversal, node);
+        frame->extra = frame->extra->data.argNext;
+    }
+
+    AST_Node* param = frame->extra;
+    if (param->data.argType.size >= 0) {
+        diagnosticf("ERROR! Passing arrays to functions is not supported yet (argument \""SV_FMT"\" of \""SV_FMT"\")\n", SV_ARG(param->data.argName), SV_ARG(node->data.callName));
+        frame->mark = false;
+        return false;
+    }
+    return true;
+}
+
+void typeCheckCallDone(Traversal* traversal, AST_Node* node) {
+    Traversal_Frame* frame = traversalFrame(traversal);
+    if (frame->extra != NULL) {
+        typeCheckArgument(traversal, node);
+    }
+
+    Type result = makeType(TYPE_UNKNOWN);
+    if (frame->mark) {
+        result = tableLookupFunction(((Type_Checker*)traversal->context)->table, node->data.callName)->function->data.functionRetType;
+    }
+    typeCheckCallResult(traversal, result);
+}
+
+Traversal makeTypeCheckTraversal(Type_Checker* checker) {
+    return (Traversal){
+        .pre = {
+            [NODE_INT] = typeCheckLiteral,
+            [NODE_BOOL] = typeCheckLiteral,
+            [NODE_IDENT] = typeCheckIdent,
+            [NODE_CALL] = typeCheckCall,
+            [NODE_SHIFT_LEFT] = typeCheckOptimized,
+            [NODE_DIVIDE_CONSTANT] = typeCheckOptimized,
+        },
+        .child = {
+            [NODE_IF] = typeCheckControl,
+            [NODE_WHILE] = typeCheckControl,
+            [NODE_CALL] = typeCheckCallArgument,
+        },
+        .post = {
+            [NODE_RETURN] = typeCheckReturn,
+            [NODE_ASSIGNMENT] = typeCheckAssignment,
+            [NODE_PLUS] = typeCheckOperator,
+            [NODE_MINUS] = typeCheckOperator,
+            [NODE_TIMES] = typeCheckOperator,
+            [NODE_DIVIDE] = typeCheckOperator,
+            [NODE_IS_EQUAL] = typeCheckOperator,
+            [NODE_ARRAY_ACCESS] = typeCheckArrayAccess,
+            [NODE_CALL] = typeCheckCallDone,
+            [NODE_CONVERT] = typeCheckConversion,
+        },
+        .context = checker,
+    };
+    static_assert(NUM_BINOP_NODES == 5, "Non-exhaustive hooks (makeTypeCheckTraversal)");
+}
+
+bool expectScopeType(Symbol_Table* table, AST_Node* root, Type expected) {
+    assert(root->type == NODE_SCOPE);
+
+    Type_Checker checker = {.table = table, .expected = expected, .success = true};
+    Traversal traversal = makeTypeCheckTraversal(&checker);
+    traverse(&traversal, root, -1);
+    assert(checker.typesLength == 0);
+    freeTraversal(&traversal);
+    free(checker.types);
+    return checker.success;
+}
+
+Type getExprType(Symbol_Table* table, AST_Node* root, int scopeId) {
+    Type_Checker checker = {.table = table, .expected = makeType(TYPE_UNKNOWN), .success = true};
+    Traversal traversal = makeTypeCheckTraversal(&checker);
+    traverse(&traversal, root, scopeId);
+    Type type = popExprType(&checker);
+    freeTraversal(&traversal);
+    free(checker.types);
+    return type;
+}
+
+
+
+///////////////////
+// Optimizer API //
+///////////////////
+
+// With `-O`, the checked program is rewritten before it reaches a backend, so the emitted C, the interpreter and the
+// VM all benefit from the same passes. Passes rewrite the AST in place. Variables introduced by the optimizer are named
+// `__lcl_...`, which is reserved for the compiler.
+
+#define INLINE_MAX_NODES 48 // Largest function body, in nodes, that gets inlined
+
+// A temporary kept equal to `i * factor` throughout a loop, where `i` is an induction variable and `factor` is a
+// literal or doesn't change in the loop.
+typedef struct {
+    AST_Node* factor;
+    int factorSymbol; // -1 if the factor is a literal
+    String_View name;
+} Induction_Product;
+
+// A variable `i` that a loop updates exactly once per iteration, with `i = i + step` directly in its body.
+typedef struct {
+    int symbol;
+    AST_Node* update; // The statements node holding the update
+    int step;
+} Induction;
+
+// A scope that `foldScope` is partway through.
+typedef struct {
+    AST_Node* scope;
+    AST_Node* previous; // Statements node before `position`, or NULL if `position` is the first one
+    AST_Node* position;
+} Fold_Frame;
+
+// What `hoistExpr` found out about a node of the expression at hand. Nodes are numbered in the order they are reached.
+typedef struct {
+    bool invariant;
+    int end; // Number of the first node after this one's operands
+} Hoist_Entry;
+
+typedef struct {
+    AST_Node_List* list;
+    Symbol_Table* table;
+    Program program;
+
+    bool* inlinable;         // Whether each function of `program` can be inlined
+    int nextInlineId;        // Numbers the names made for each inlined call
+    String_View* renamedFrom; // Names in the function being inlined...
+    String_View* renamedTo;   // ...and what they are called at the call site
+    int renamedLength;
+    int renamedCapacity;
+
+    AST_Node** constants;    // Literal held by each variable, or NULL if unknown. Parallel to the symbols of `table`.
+
+    int* variantLoop;        // Last loop each variable was found to change in. Parallel to the symbols of `table`.
+    int variantCapacity;
+    int loopId;              // Numbers the loops as they are hoisted from, starting at 1
+    int nextTempId;          // Numbers the temporaries made for loops
+
+    Induction_Product* products; // Products kept for the induction variable at hand
+    int productsLength;
+    int productsCapacity;
+
+    // Passes that add statements insert them before the statements node `*position`, which is in the scope with ID
+    // `outerScopeId`: before the statement at hand when inlining, and before the loop at hand otherwise.
+    AST_Node** position;
+    int outerScopeId;
+    Induction* induction;    // Induction variable at hand
+
+    Fold_Frame* folds;       // Scopes `foldScope` is partway through, innermost last
+    int foldsLength;
+    int foldsCapacity;
+
+    Hoist_Entry* hoisting;   // Nodes of the expression `hoistExpr` is at
+    int hoistingLength;
+    int hoistingCapacity;
+    int hoistingNext;        // Number of the next node to be reached when hoisting
+
+    int countedSymbol;       // Variable `countAssignments` is counting assignments to
+    int assignmentCount;     // Assignments found so far, or -1 once a declaration is found
+} Optimizer;
+
+typedef struct {
+    int nodes;
+    int calls;
+    int returns;
+} Node_Summary;
+
+// Counts the nodes, calls and returns in `node`. Stops counting once there are more than `INLINE_MAX_NODES` nodes, so
+// unlike the other passes it can recurse without regard for how deep the tree is.
+void summarizeNode(AST_Node* node, Node_Summary* summary) {
+    if (node == NULL || summary->nodes > INLINE_MAX_NODES) {
+        return;
+    }
+    summary->nodes++;
+
+    switch (node->type) {
+        case NODE_SCOPE: {
+            summarizeNode(node->data.scopeStatements, summary);
+            break;
+        }
+        case NODE_STATEMENTS: {
+            summarizeNode(node->data.statementStatement, summary);
+            summarizeNode(node->data.statementNext, summary);
+            break;
+        }
+        case NODE_RETURN: {
+            summary->returns++;
+            summarizeNode(node->data.returnExpr, summary);
+            break;
+        }
+        case NODE_ASSIGNMENT: {
+            summarizeNode(node->data.assignmentExpr, summary);
+            break;
+        }
+        case NODE_PLUS:
+        case NODE_MINUS:
+        case NODE_TIMES:
+        case NODE_DIVIDE:
+        case NODE_IS_EQUAL: {
+            summarizeNode(node->data.binaryOpLeft, summary);
+            summarizeNode(node->data.binaryOpRight, summary);
+            break;
+        }
+        case NODE_ARRAY_ACCESS: {
+            summarizeNode(node->data.accessIndex, summary);
+            break;
+        }
+        case NODE_SHIFT_LEFT: {
+            summarizeNode(node->data.shiftValue, summary);
+            break;
+        }
+        case NODE_DIVIDE_CONSTANT: {
+            summarizeNode(node->data.divideDividend, summary);
+            break;
+        }
+        case NODE_CONVERT: {
+            summarizeNode(node->data.convertExpr, summary);
+            break;
+        }
+        case NODE_CALL: {
+            summary->calls++;
+            summarizeNode(node->data.callArgs, summary);
+            break;
+        }
+        case NODE_CALL_ARGS: {
+            summarizeNode(node->data.callArgExpr, summary);
+            summarizeNode(node->data.callArgNext, summary);
+            break;
+        }
+        case NODE_IF:
+        case NODE_WHILE: {
+            summarizeNode(node->data.controlCondition, summary);
+            summarizeNode(node->data.controlScope, summary);
+            break;
+        }
+        case NODE_ELSE: {
+            summarizeNode(node->data.elseScope, summary);
+            break;
+        }
+        case NODE_DECLARATION:
+        case NODE_INT:
+        case NODE_BOOL:
+        case NODE_IDENT: {
+            break;
+        }
+        default:
+            printf("Unexpected node type: %d\n", node->type);
+            assert(false && "Not a statement or expression type (summarizeNode)");
+    }
+    static_assert(NODE_COUNT == 24, "Non-exhaustive cases (summarizeNode)");
+}
+
+// Small leaf functions are inlined. Being leaves, they can't be recursive. The only return has to be the last
+// statement of the body, so the inlined code never needs to jump out early.
+bool isInlinable(AST_Node* function) {
+    AST_Node* body = function->data.functionBody;
+    Node_Summary summary = {0};
+    summarizeNode(body, &summary);
+    if (summary.nodes > INLINE_MAX_NODES || summary.calls > 0) {
+        return false;
+    }
+    if (summary.returns == 0) {
+        return function->data.functionRetType.id == TYPE_UNIT;
+    }
+
+    AST_Node* last = body->data.scopeStatements;
+    while (last->data.statementNext != NULL) {
+        last = last->data.statementNext;
+    }
+    return summary.returns == 1 && last->data.statementStatement->type == NODE_RETURN;
+}
+
+// Returns the name `name` from the function being inlined gets at the current call site.
+String_View inlineRename(Optimizer* opt, String_View name) {
+    for (int i = 0; i < opt->renamedLength; ++i) {
+        if (svEquals(opt->renamedFrom[i], name)) {
+            return opt->renamedTo[i];
+        }
+    }
+    if (opt->renamedLength == opt->renamedCapacity) {
+        opt->renamedCapacity = opt->renamedCapacity == 0 ? 16 : opt->renamedCapacity * 2;
+        opt->renamedFrom = realloc(opt->renamedFrom, opt->renamedCapacity * sizeof(String_View));
+        opt->renamedTo = realloc(opt->renamedTo, opt->renamedCapacity * sizeof(String_View));
+    }
+    opt->renamedFrom[opt->renamedLength] = name;
+    opt->renamedTo[opt->renamedLength] = nodeListMakeName(opt->list, "__lcl_%d_"SV_FMT, opt->nextInlineId, SV_ARG(name));
+    return opt->renamedTo[opt->renamedLength++];
+}
+
+// Copies `node` out of the function being inlined, renaming its variables and giving its scopes fresh IDs. Inlined
+// bodies have at most `INLINE_MAX_NODES` nodes, so this recurses.
+AST_Node* copyInlined(Optimizer* opt, AST_Node* node) {
+    if (node == NULL) {
+        return NULL;
+    }
+
+    AST_Node copy = *node;
+    switch (node->type) {
+        case NODE_SCOPE: {
+            copy.data.scopeId = getScopeId(opt->list);
+            copy.data.scopeStatements = copyInlined(opt, node->data.scopeStatements);
+            break;
+        }
+        case NODE_STATEMENTS: {
+            copy.data.statementStatement = copyInlined(opt, node->data.statementStatement);
+            copy.data.statementNext = copyInlined(opt, node->data.statementNext);
+            break;
+        }
+        case NODE_RETURN: {
+            copy.data.returnExpr = copyInlined(opt, node->data.returnExpr);
+            break;
+        }
+        case NODE_DECLARATION: {
+            copy.data.declarationName = inlineRename(opt, node->data.declarationName);
+            break;
+        }
+        case NODE_ASSIGNMENT: {
+            copy.data.assignmentName = inlineRename(opt, node->data.assignmentName);
+            copy.data.assignmentExpr = copyInlined(opt, node->data.assignmentExpr);
+            break;
+        }
+        case NODE_PLUS:
+        case NODE_MINUS:
+        case NODE_TIMES:
+        case NODE_DIVIDE:
+        case NODE_IS_EQUAL: {
+            copy.data.binaryOpLeft = copyInlined(opt, node->data.binaryOpLeft);
+            copy.data.binaryOpRight = copyInlined(opt, node->data.binaryOpRight);
+            break;
+        }
+        case NODE_ARRAY_ACCESS: {
+            copy.data.accessArrayName = inlineRename(opt, node->data.accessArrayName);
+            copy.data.accessIndex = copyInlined(opt, node->data.accessIndex);
+            break;
+        }
+        case NODE_SHIFT_LEFT: {
+            copy.data.shiftValue = copyInlined(opt, node->data.shiftValue);
+            break;
+        }
+        case NODE_DIVIDE_CONSTANT: {
+            copy.data.divideDividend = copyInlined(opt, node->data.divideDividend);
+            break;
+        }
+        case NODE_CONVERT: {
+            copy.data.convertExpr = copyInlined(opt, node->data.convertExpr);
+            break;
+        }
+        case NODE_CALL: {
+            copy.data.callArgs = copyInlined(opt, node->data.callArgs);
+            break;
+        }
+        case NODE_CALL_ARGS: {
+            copy.data.callArgExpr = copyInlined(opt, node->data.callArgExpr);
+            copy.data.callArgNext = copyInlined(opt, node->data.callArgNext);
+            break;
+        }
+        case NODE_IF:
+        case NODE_WHILE: {
+            copy.data.controlCondition = copyInlined(opt, node->data.controlCondition);
+            copy.data.controlScope = copyInlined(opt, node->data.controlScope);
+            break;
+        }
+        case NODE_ELSE: {
+            copy.data.elseScope = copyInlined(opt, node->data.elseScope);
+            break;
+        }
+        case NODE_IDENT: {
+            copy.data.identName = inlineRename(opt, node->data.identName);
+            break;
+        }
+        case NODE_INT:
+        case NODE_BOOL: {
+            break;
+        }
+        default:
+            printf("Unexpected node type: %d\n", node->type);
+            assert(false && "Not a statement or expression type (copyInlined)");
+    }
+    static_assert(NODE_COUNT == 24, "Non-exhaustive cases (copyInlined)");
+    return nodeListAddNode(opt->list, copy);
+}
+
+// Links `statement` in at `*tail`, and moves `tail` past it.
+void appendStatement(AST_Node_List* list, AST_Node*** tail, AST_Node* statement) {
+    AST_Node node;
+    node.type = NODE_STATEMENTS;
+    node.data.statementStatement = statement;
+    node.data.statementNext = NULL;
+    **tail = nodeListAddNode(list, node);
+    *tail = &(**tail)->data.statementNext;
+}
+
+// Inserts `statement` before the one held by `*position`, and moves `position` along so that it still holds the
+// original statement.
+void insertStatementBefore(AST_Node_List* list, AST_Node** position, AST_Node* statement) {
+    AST_Node* moved = nodeListAddNode(list, **position);
+    (*position)->data.statementStatement = statement;
+    (*position)->data.statementNext = moved;
+    *position = moved;
+}
+
+// Returns a scope that runs the body of `function` on `args` and assigns its result to `result`. `result` is unused
+// if the function returns unit.
+AST_Node* inlineCall(Optimizer* opt, AST_Node* function, AST_Node* args, String_View result) {
+    opt->renamedLength = 0;
+
+    // The parameters become locals of the new scope. The arguments are evaluated inside it, but they can't see the
+    // parameters, because those are renamed.
+    AST_Node* head = NULL;
+    AST_Node** tail = &head;
+    for (AST_Node* param = function->data.functionArgs; param != NULL; param = param->data.argNext) {
+        appendStatement(opt->list, &tail, addDeclarationNode(opt->list, inlineRename(opt, param->data.argName), param->data.argType));
+    }
+    AST_Node* arg = args;
+    for (AST_Node* param = function->data.functionArgs; param != NULL; param = param->data.argNext) {
+        appendStatement(opt->list, &tail, addAssignmentNode(opt->list, inlineRename(opt, param->data.argName), arg->data.callArgExpr));
+        arg = arg->data.callArgNext;
+    }
+
+    AST_Node* statements = function->data.functionBody->data.scopeStatements;
+    for (; statements != NULL; statements = statements->data.statementNext) {
+        AST_Node* statement = statements->data.statementStatement;
+        if (statement->type == NODE_RETURN) {
+            appendStatement(opt->list, &tail, addAssignmentNode(opt->list, result, copyInlined(opt, statement->data.returnExpr)));
+        }
+        else {
+            appendStatement(opt->list, &tail, copyInlined(opt, statement));
+        }
+    }
+
+    opt->nextInlineId++;
+    AST_Node scope;
+    scope.type = NODE_SCOPE;
+    scope.data.scopeId = getScopeId(opt->list);
+    scope.data.scopeStatements = head;
+    return nodeListAddNode(opt->list, scope);
+}
+
+// Returns the function that the call `node` should be replaced with, or NULL if it should be left alone.
+// `needsValue` is set when the result of the call is used.
+AST_Node* inlineTarget(Optimizer* opt, AST_Node* node, bool needsValue) {
+    if (node->type != NODE_CALL) {
+        return NULL;
+    }
+    Function_Entry* entry = tableLookupFunction(opt->table, node->data.callName);
+    assert(entry != NULL);
+    if (!opt->inlinable[entry->index]) {
+        return NULL;
+    }
+    // There is no variable to hold a unit result in.
+    if (needsValue && entry->function->data.functionRetType.id == TYPE_UNIT) {
+        return NULL;
+    }
+    return entry->function;
+}
+
+// Declares a variable for the result of `function` before `*position`, and returns its name.
+String_View declareInlineResult(Optimizer* opt, AST_Node** position, AST_Node* function) {
+    String_View result = nodeListMakeName(opt->list, "__lcl_r%d", opt->nextInlineId);
+    insertStatementBefore(opt->list, position, addDeclarationNode(opt->list, result, function->data.functionRetType));
+    return result;
+}
+
+// Inlines the call `node` once the calls in its arguments are done, and replaces it by the variable holding its result.
+void inlineExprCall(Traversal* traversal, AST_Node* node) {
+    Optimizer* opt = traversal->context;
+    AST_Node* function = inlineTarget(opt, node, true);
+    if (function != NULL) {
+        String_View result = declareInlineResult(opt, opt->position, function);
+        insertStatementBefore(opt->list, opt->position, inlineCall(opt, function, node->data.callArgs, result));
+        node->type = NODE_IDENT;
+        node->data.identName = result;
+    }
+}
+
+// Inlines the calls in `expr`, innermost first. Each result is computed by statements inserted before `*position`,
+// and the call is replaced by the variable holding it.
+void inlineExprCalls(Optimizer* opt, AST_Node** position, AST_Node* expr) {
+    Traversal traversal = {
+        .post = {
+            [NODE_CALL] = inlineExprCall,
+        },
+        .context = opt,
+    };
+    opt->position = position;
+    traverse(&traversal, expr, -1);
+    freeTraversal(&traversal);
+}
+
+bool inlineStatement(Traversal* traversal, AST_Node* statement) {
+    Optimizer* opt = traversal->context;
+    AST_Node** position = traversalPosition(traversal);
+
+    switch (statement->type) {
+        case NODE_ASSIGNMENT: {
+            AST_Node* expr = statement->data.assignmentExpr;
+            AST_Node* function = inlineTarget(opt, expr, true);
+            if (function == NULL) {
+                inlineExprCalls(opt, position, expr);
+                return false;
+            }
+            // The result goes straight to the assigned variable. Nothing in the inlined body can shadow it, since
+            // everything there is renamed.
+            for (AST_Node* arg = expr->data.callArgs; arg != NULL; arg = arg->data.callArgNext) {
+                inlineExprCalls(opt, position, arg->data.callArgExpr);
+            }
+            (*position)->data.statementStatement = inlineCall(opt, function, expr->data.callArgs, statement->data.assignmentName);
+            return false;
+        }
+        case NODE_CALL: {
+            for (AST_Node* arg = statement->data.callArgs; arg != NULL; arg = arg->data.callArgNext) {
+                inlineExprCalls(opt, position, arg->data.callArgExpr);
+            }
+            AST_Node* function = inlineTarget(opt, statement, false);
+            if (function != NULL) {
+                // The result is still computed, so that any runtime error it raises isn't lost.
+                String_View result = {0};
+                if (function->data.functionRetType.id != TYPE_UNIT) {
+                    result = declareInlineResult(opt, position, function);
+                }
+                (*position)->data.statementStatement = inlineCall(opt, function, statement->data.callArgs, result);
+            }
+            return false;
+        }
+        case NODE_RETURN: {
+            inlineExprCalls(opt, position, statement->data.returnExpr);
+            return false;
+        }
+        case NODE_IF: {
+            inlineExprCalls(opt, position, statement->data.controlCondition);
+            return true;
+        }
+        default:
+            return true;
+    }
+}
+
+void inlineScope(Optimizer* opt, AST_Node* scope) {
+    assert(scope->type == NODE_SCOPE);
+
+    // The condition of a while is evaluated on every iteration, so its calls can't be moved in front of the loop.
+    Traversal traversal = {
+        .pre = {
+            [NODE_ASSIGNMENT] = inlineStatement,
+            [NODE_CALL] = inlineStatement,
+            [NODE_RETURN] = inlineStatement,
+            [NODE_IF] = inlineStatement,
+        },
+        .child = {
+            [NODE_IF] = traversalSkipCondition,
+            [NODE_WHILE] = traversalSkipCondition,
+        },
+        .context = opt,
+    };
+    traverse(&traversal, scope, scope->data.scopeId);
+    freeTraversal(&traversal);
+}
+
+bool forgetAssignment(Traversal* traversal, AST_Node* statement) {
+    Optimizer* opt = traversal->context;
+    int index = tableLookupSymbolIndex(opt->table, traversalFrame(traversal)->scopeId, statement->data.assignmentName);
+    assert(index >= 0);
+    opt->constants[index] = NULL;
+    return false;
+}
+
+// Forgets the value of every variable assigned anywhere in `scope`.
+void forgetAssigned(Optimizer* opt, AST_Node* scope) {
+    assert(scope->type == NODE_SCOPE);
+
+    Traversal traversal = {
+        .pre = {
+            [NODE_ASSIGNMENT] = forgetAssignment,
+            [NODE_RETURN] = traversalSkip,
+            [NODE_CALL] = traversalSkip,
+        },
+        .child = {
+            [NODE_IF] = traversalSkipCondition,
+            [NODE_WHILE] = traversalSkipCondition,
+        },
+        .context = opt,
+    };
+    traverse(&traversal, scope, scope->data.scopeId);
+    freeTraversal(&traversal);
+}
+
+inline bool isLiteral(AST_Node* node) {
+    return node->type == NODE_INT || node->type == NODE_BOOL;
+}
+
+// Evaluates the arithmetic operator `op` on two literals of `type` the way the backends do. Returns false when the
+// result is left to run time: division by zero, overflow of int and i64 (which the backends don't agree on), and the
+// smallest i64, which C has no literal for.
+bool foldIntegerOperator(Node_Type op, Type_Id type, long long a, long long b, long long* result) {
+    if (op == NODE_DIVIDE && b == 0) {
+        return false;
+    }
+    long long value;
+    if (type == TYPE_INT) {
+        switch (op) {
+            case NODE_PLUS:  value = a + b; break;
+            case NODE_MINUS: value = a - b; break;
+            case NODE_TIMES: value = a * b; break;
+            default:         value = a / b; break;
+        }
+        if (value < INT_MIN || value > INT_MAX) {
+            return false;
+        }
+    }
+    else {
+        uint64_t wrapped;
+        switch (op) {
+            case NODE_PLUS:  wrapped = (uint64_t)a + (uint64_t)b; break;
+            case NODE_MINUS: wrapped = (uint64_t)a - (uint64_t)b; break;
+            case NODE_TIMES: wrapped = (uint64_t)a * (uint64_t)b; break;
+            default: {
+                if (type == TYPE_I64 && a == INT64_MIN && b == -1) {
+                    return false;
+                }
+                // Only u64 values can look negative without being negative.
+                wrapped = type == TYPE_U64 ? (uint64_t)a / (uint64_t)b : (uint64_t)(a / b);
+                break;
+            }
+        }
+        value = isNarrowType(type) ? narrowInteger(type, wrapped) : (long long)wrapped;
+        if (type == TYPE_I64) {
+            bool overflow = false;
+            switch (op) {
+                case NODE_PLUS:  overflow = (b > 0 && a > INT64_MAX - b) || (b < 0 && a < INT64_MIN - b); break;
+                case NODE_MINUS: overflow = (b < 0 && a > INT64_MAX + b) || (b > 0 && a < INT64_MIN + b); break;
+                case NODE_TIMES: overflow = a != 0 && ((a == -1 && b == INT64_MIN) || value / a != b); break;
+                default: break;
+            }
+            if (overflow || value == INT64_MIN) {
+                return false;
+            }
+        }
+    }
+    static_assert(NUM_BINOP_NODES == 5, "Non-exhaustive cases (foldIntegerOperator)");
+    *result = value;
+    return true;
+}
+
+bool foldIdent(Traversal* traversal, AST_Node* node) {
+    Optimizer* opt = traversal->context;
+    int index = tableLookupSymbolIndex(opt->table, traversalFrame(traversal)->scopeId, node->data.identName);
+    assert(index >= 0);
+    if (opt->constants[index] != NULL) {
+        *node = *opt->constants[index];
+    }
+    return false;
+}
+
+void foldOperator(Traversal* traversal, AST_Node* expr) {
+    (void)traversal;
+    AST_Node* left = expr->data.binaryOpLeft;
+    AST_Node* right = expr->data.binaryOpRight;
+
+    if (expr->type == NODE_IS_EQUAL && isLiteral(left) && left->type == right->type) {
+        bool value = left->type == NODE_INT ? left->data.intValue == right->data.intValue : left->data.boolValue == right->data.boolValue;
+        expr->type = NODE_BOOL;
+        expr->data.boolValue = value;
+        return;
+    }
+    if (left->type != NODE_INT || right->type != NODE_INT) {
+        return;
+    }
+
+    long long value;
+    if (!foldIntegerOperator(expr->type, expr->data.binaryOpType, left->data.intValue, right->data.intValue, &value)) {
+        return;
+    }
+    expr->type = NODE_INT;
+    expr->data.intValue = value;
+    expr->data.intType = expr->data.binaryOpType;
+}
+
+void foldConversion(Traversal* traversal, AST_Node* expr) {
+    (void)traversal;
+    // Conversions only widen, so a converted literal is the same literal.
+    if (expr->data.convertExpr->type == NODE_INT) {
+        *expr = *expr->data.convertExpr;
+    }
+}
+
+// Replaces variables with known values by their literals, and evaluates operators on literals.
+void foldExpr(Optimizer* opt, AST_Node* expr, int scopeId) {
+    Traversal traversal = {
+        .pre = {
+            [NODE_IDENT] = foldIdent,
+        },
+        .post = {
+            [NODE_PLUS] = foldOperator,
+            [NODE_MINUS] = foldOperator,
+            [NODE_TIMES] = foldOperator,
+            [NODE_DIVIDE] = foldOperator,
+            [NODE_IS_EQUAL] = foldOperator,
+            [NODE_CONVERT] = foldConversion,
+        },
+        .context = opt,
+    };
+    static_assert(NUM_BINOP_NODES == 5, "Non-exhaustive hooks (foldExpr)");
+    traverse(&traversal, expr, scopeId);
+    freeTraversal(&traversal);
+}
+
+// Removes the statement at `position` from `scope`, and returns the statement after it.
+AST_Node* removeStatement(AST_Node* scope, AST_Node* previous, AST_Node* position) {
+    if (previous == NULL) {
+        scope->data.scopeStatements = position->data.statementNext;
+    }
+    else {
+        previous->data.statementNext = position->data.statementNext;
+    }
+    return position->data.statementNext;
+}
+
+void foldPushScope(Optimizer* opt, AST_Node* scope) {
+    assert(scope->type == NODE_SCOPE);
+    if (opt->foldsLength == opt->foldsCapacity) {
+        opt->foldsCapacity = opt->foldsCapacity == 0 ? 64 : opt->foldsCapacity * 2;
+        opt->folds = realloc(opt->folds, opt->foldsCapacity * sizeof(Fold_Frame));
+    }
+    opt->folds[opt->foldsLength++] = (Fold_Frame){.scope = scope, .previous = NULL, .position = scope->data.scopeStatements};
+}
+
+// Moves `frame` past its statement once `done`, a scope in that statement, is folded.
+void foldScopeDone(Optimizer* opt, Fold_Frame* frame, AST_Node* done) {
+    AST_Node* statement = frame->position->data.statementStatement;
+    // Either branch of an if may have run afterwards, and a loop may have run any number of times, so their
+    // assignments can't be relied on.
+    if (statement->type != NODE_SCOPE) {
+        forgetAssigned(opt, done);
+    }
+    if (statement->type == NODE_IF) {
+        AST_Node* next = frame->position->data.statementNext;
+        if (next != NULL && next->data.statementStatement->type == NODE_ELSE) {
+            frame->previous = frame->position;
+            frame->position = next;
+            foldPushScope(opt, next->data.statementStatement->data.elseScope);
+            return;
+        }
+    }
+    frame->previous = frame->position;
+    frame->position = frame->position->data.statementNext;
+}
+
+// Propagates constants through `scope` in statement order, folding expressions and removing branches that can't run.
+// Nested scopes are pushed on `opt->folds`, and the statement holding one is moved past once it is done.
+void foldScope(Optimizer* opt, AST_Node* scope) {
+    assert(opt->foldsLength == 0);
+    foldPushScope(opt, scope);
+
+    while (opt->foldsLength > 0) {
+        Fold_Frame* frame = &opt->folds[opt->foldsLength - 1];
+        if (frame->position == NULL) {
+            AST_Node* done = frame->scope;
+            opt->foldsLength--;
+            if (opt->foldsLength > 0) {
+                foldScopeDone(opt, &opt->folds[opt->foldsLength - 1], done);
+            }
+            continue;
+        }
+
+        scope = frame->scope;
+        int scopeId = scope->data.scopeId;
+        AST_Node* position = frame->position;
+        AST_Node* statement = position->data.statementStatement;
+
+        switch (statement->type) {
+            case NODE_DECLARATION: {
+                int index = tableLookupSymbolIndex(opt->table, scopeId, statement->data.declarationName);
+                assert(index >= 0);
+                opt->constants[index] = NULL;
+                break;
+            }
+            case NODE_ASSIGNMENT: {
+                AST_Node* expr = statement->data.assignmentExpr;
+                foldExpr(opt, expr, scopeId);
+                int index = tableLookupSymbolIndex(opt->table, scopeId, statement->data.assignmentName);
+                assert(index >= 0);
+                opt->constants[index] = isLiteral(expr) ? expr : NULL;
+                break;
+            }
+            case NODE_RETURN: {
+                foldExpr(opt, statement->data.returnExpr, scopeId);
+                break;
+            }
+            case NODE_CALL: {
+                foldExpr(opt, statement, scopeId);
+                break;
+            }
+            case NODE_SCOPE: {
+                foldPushScope(opt, statement);
+                continue;
+            }
+            case NODE_IF: {
+                AST_Node* condition = statement->data.controlCondition;
+                foldExpr(opt, condition, scopeId);
+                if (condition->type != NODE_BOOL) {
+                    foldPushScope(opt, statement->data.controlScope);
+                    continue;
+                }
+
+                // Only one branch can run, so it takes the place of the whole if and else, and is visited again as a
+                // plain scope.
+                AST_Node* next = position->data.statementNext;
+                AST_Node* elseScope = NULL;
+                if (next != NULL && next->data.statementStatement->type == NODE_ELSE) {
+                    elseScope = next->data.statementStatement->data.elseScope;
+                    position->data.statementNext = next->data.statementNext;
+                }
+                AST_Node* taken = condition->data.boolValue ? statement->data.controlScope : elseScope;
+                if (taken == NULL) {
+                    frame->position = removeStatement(scope, frame->previous, position);
+                }
+                else {
+                    position->data.statementStatement = taken;
+                }
+                continue;
+            }
+            case NODE_ELSE: {
+                assert(false && "Else without a preceding if (foldScope)");
+                break;
+            }
+            case NODE_WHILE: {
+                // Values assigned in the loop change between iterations, and the loop may not run at all.
+                forgetAssigned(opt, statement->data.controlScope);
+                foldExpr(opt, statement->data.controlCondition, scopeId);
+                if (statement->data.controlCondition->type == NODE_BOOL && !statement->data.controlCondition->data.boolValue) {
+                    frame->position = removeStatement(scope, frame->previous, position);
+                    continue;
+                }
+                foldPushScope(opt, statement->data.controlScope);
+                continue;
+            }
+            default:
+                printf("Unexpected node type: %d\n", statement->type);
+                assert(false && "Not a statement type or non-exhaustive cases (foldScope)");
+        }
+
+        frame->previous = position;
+        frame->position = position->data.statementNext;
+    }
+}
+
+// Adds a variable declared by the optimizer in the scope with ID `scopeId` to the end of the table, so the rest of the
+// pass can look it up.
+void optimizerAddSymbol(Optimizer* opt, int scopeId, String_View name, Type type) {
+    addSymbol(opt->table, scopeId, name, type);
+    if (opt->table->symbolsLength > opt->variantCapacity) {
+        int oldCapacity = opt->variantCapacity;
+        opt->variantCapacity = opt->table->symbolsCapacity;
+        opt->variantLoop = realloc(opt->variantLoop, opt->variantCapacity * sizeof(int));
+        memset(&opt->variantLoop[oldCapacity], 0, (opt->variantCapacity - oldCapacity) * sizeof(int));
+    }
+}
+
+bool markVariant(Traversal* traversal, AST_Node* statement) {
+    Optimizer* opt = traversal->context;
+    String_View name = statement->type == NODE_DECLARATION ? statement->data.declarationName : statement->data.assignmentName;
+    int index = tableLookupSymbolIndex(opt->table, traversalFrame(traversal)->scopeId, name);
+    assert(index >= 0);
+    opt->variantLoop[index] = opt->loopId;
+    return false;
+}
+
+// Marks every variable assigned or declared in `scope` as changing in the loop `opt->loopId`.
+void markLoopVariant(Optimizer* opt, AST_Node* scope) {
+    assert(scope->type == NODE_SCOPE);
+
+    Traversal traversal = {
+        .pre = {
+            [NODE_DECLARATION] = markVariant,
+            [NODE_ASSIGNMENT] = markVariant,
+            [NODE_RETURN] = traversalSkip,
+            [NODE_CALL] = traversalSkip,
+        },
+        .child = {
+            [NODE_IF] = traversalSkipCondition,
+            [NODE_WHILE] = traversalSkipCondition,
+        },
+        .context = opt,
+    };
+    traverse(&traversal, scope, scope->data.scopeId);
+    freeTraversal(&traversal);
+}
+
+// Marks the node whose hook is running as done, and its parent as variant if it is.
+void closeHoistEntry(Traversal* traversal) {
+    Optimizer* opt = traversal->context;
+    Hoist_Entry* entry = &opt->hoisting[traversalFrame(traversal)->mark];
+    entry->end = opt->hoistingLength;
+    if (traversal->length > 1 && !entry->invariant) {
+        opt->hoisting[traversal->stack[traversal->length - 2].mark].invariant = false;
+    }
+}
+
+// Records whether `expr` gives the same value on every iteration of the loop `opt->loopId`, and can't fail at run
+// time. Expressions that can fail stay in the loop, since it may not run at all. Operators whose operands aren't
+// invariant are marked once the operands are done.
+bool findInvariant(Traversal* traversal, AST_Node* expr) {
+    Optimizer* opt = traversal->context;
+    Traversal_Frame* frame = traversalFrame(traversal);
+    bool invariant = true;
+    bool leaf = false;
+
+    switch (expr->type) {
+        case NODE_INT:
+        case NODE_BOOL: {
+            leaf = true;
+            break;
+        }
+        case NODE_IDENT: {
+            int index = tableLookupSymbolIndex(opt->table, frame->scopeId, expr->data.identName);
+            assert(index >= 0);
+            invariant = opt->variantLoop[index] != opt->loopId;
+            leaf = true;
+            break;
+        }
+        case NODE_ARRAY_ACCESS: {
+            // Arrays can't be assigned to, but only constant indices are known to be in bounds.
+            int index = tableLookupSymbolIndex(opt->table, frame->scopeId, expr->data.accessArrayName);
+            assert(index >= 0);
+            AST_Node* arrayIndex = expr->data.accessIndex;
+            invariant = opt->variantLoop[index] != opt->loopId && arrayIndex->type == NODE_INT &&
+                arrayIndex->data.intValue >= 0 && arrayIndex->data.intValue < opt->table->symbolTypes[index].size;
+            break;
+        }
+        case NODE_DIVIDE: {
+            // -1 is excluded too, because INT_MIN / -1 overflows in C.
+            AST_Node* divisor = expr->data.binaryOpRight;
+            invariant = divisor->type == NODE_INT && divisor->data.intValue != 0 && divisor->data.intValue != -1;
+            break;
+        }
+        case NODE_CALL: {
+            invariant = false;
+            break;
+        }
+        default:
+            break;
+    }
+
+    if (opt->hoistingLength == opt->hoistingCapacity) {
+        opt->hoistingCapacity = opt->hoistingCapacity == 0 ? 64 : opt->hoistingCapacity * 2;
+        opt->hoisting = realloc(opt->hoisting, opt->hoistingCapacity * sizeof(Hoist_Entry));
+    }
+    frame->mark = opt->hoistingLength;
+    opt->hoisting[opt->hoistingLength++] = (Hoist_Entry){.invariant = invariant};
+    if (leaf) {
+        closeHoistEntry(traversal);
+    }
+    return !leaf;
+}
+
+void findInvariantDone(Traversal* traversal, AST_Node* expr) {
+    (void)expr;
+    closeHoistEntry(traversal);
+}
+
+// Hoists `expr` if it is invariant, and otherwise goes on to its operands.
+bool hoistInvariant(Traversal* traversal, AST_Node* expr) {
+    Optimizer* opt = traversal->context;
+    Hoist_Entry entry = opt->hoisting[opt->hoistingNext++];
+    if (expr->type == NODE_INT || expr->type == NODE_BOOL || expr->type == NODE_IDENT) {
+        return false;
+    }
+    if (!entry.invariant) {
+        return true;
+    }
+
+    String_View name = nodeListMakeName(opt->list, "__lcl_t%d", opt->nextTempId++);
+    Type type = getExprType(opt->table, expr, traversalFrame(traversal)->scopeId);
+    insertStatementBefore(opt->list, opt->position, addDeclarationNode(opt->list, name, type));
+    insertStatementBefore(opt->list, opt->position, addAssignmentNode(opt->list, name, nodeListAddNode(opt->list, *expr)));
+    optimizerAddSymbol(opt, opt->outerScopeId, name, type);
+    expr->type = NODE_IDENT;
+    expr->data.identName = name;
+    opt->hoistingNext = entry.end;
+    return false;
+}
+
+// Moves the largest invariant parts of `expr` into temporaries, computed before the loop held by `*opt->position`. The
+// first walk finds which nodes are invariant, and the second hoists the outermost of them.
+void hoistExpr(Optimizer* opt, AST_Node* expr, int scopeId) {
+    Traversal find = {
+        .pre = {
+            [NODE_INT] = findInvariant,
+            [NODE_BOOL] = findInvariant,
+            [NODE_IDENT] = findInvariant,
+            [NODE_ARRAY_ACCESS] = findInvariant,
+            [NODE_PLUS] = findInvariant,
+            [NODE_MINUS] = findInvariant,
+            [NODE_TIMES] = findInvariant,
+            [NODE_DIVIDE] = findInvariant,
+            [NODE_IS_EQUAL] = findInvariant,
+            [NODE_SHIFT_LEFT] = findInvariant,
+            [NODE_DIVIDE_CONSTANT] = findInvariant,
+            [NODE_CONVERT] = findInvariant,
+            [NODE_CALL] = findInvariant,
+        },
+        .post = {
+            [NODE_ARRAY_ACCESS] = findInvariantDone,
+            [NODE_PLUS] = findInvariantDone,
+            [NODE_MINUS] = findInvariantDone,
+            [NODE_TIMES] = findInvariantDone,
+            [NODE_DIVIDE] = findInvariantDone,
+            [NODE_IS_EQUAL] = findInvariantDone,
+            [NODE_SHIFT_LEFT] = findInvariantDone,
+            [NODE_DIVIDE_CONSTANT] = findInvariantDone,
+            [NODE_CONVERT] = findInvariantDone,
+            [NODE_CALL] = findInvariantDone,
+        },
+        .context = opt,
+    };
+    static_assert(NUM_BINOP_NODES == 5, "Non-exhaustive hooks (hoistExpr)");
+    opt->hoistingLength = 0;
+    traverse(&find, expr, scopeId);
+    freeTraversal(&find);
+
+    Traversal hoist = {
+        .pre = {
+            [NODE_INT] = hoistInvariant,
+            [NODE_BOOL] = hoistInvariant,
+            [NODE_IDENT] = hoistInvariant,
+            [NODE_ARRAY_ACCESS] = hoistInvariant,
+            [NODE_PLUS] = hoistInvariant,
+            [NODE_MINUS] = hoistInvariant,
+            [NODE_TIMES] = hoistInvariant,
+            [NODE_DIVIDE] = hoistInvariant,
+            [NODE_IS_EQUAL] = hoistInvariant,
+            [NODE_SHIFT_LEFT] = hoistInvariant,
+            [NODE_DIVIDE_CONSTANT] = hoistInvariant,
+            [NODE_CONVERT] = hoistInvariant,
+            [NODE_CALL] = hoistInvariant,
+        },
+        .context = opt,
+    };
+    opt->hoistingNext = 0;
+    traverse(&hoist, expr, scopeId);
+    assert(opt->hoistingNext == opt->hoistingLength);
+    freeTraversal(&hoist);
+}
+
+bool hoistFromStatement(Traversal* traversal, AST_Node* statement) {
+    Optimizer* opt = traversal->context;
+    int scopeId = traversalFrame(traversal)->scopeId;
+    switch (statement->type) {
+        case NODE_ASSIGNMENT: {
+            hoistExpr(opt, statement->data.assignmentExpr, scopeId);
+            return false;
+        }
+        case NODE_RETURN: {
+            hoistExpr(opt, statement->data.returnExpr, scopeId);
+            return false;
+        }
+        case NODE_CALL: {
+            hoistExpr(opt, statement, scopeId);
+            return false;
+        }
+        default: {
+            hoistExpr(opt, statement->data.controlCondition, scopeId);
+            return true;
+        }
+    }
+}
+
+// Hoists the invariant expressions of every statement in `scope`, which is inside the loop held by `*opt->position`.
+void hoistFromScope(Optimizer* opt, AST_Node* scope) {
+    assert(scope->type == NODE_SCOPE);
+
+    Traversal traversal = {
+        .pre = {
+            [NODE_ASSIGNMENT] = hoistFromStatement,
+            [NODE_RETURN] = hoistFromStatement,
+            [NODE_CALL] = hoistFromStatement,
+            [NODE_IF] = hoistFromStatement,
+            [NODE_WHILE] = hoistFromStatement,
+        },
+        .child = {
+            [NODE_IF] = traversalSkipCondition,
+            [NODE_WHILE] = traversalSkipCondition,
+        },
+        .context = opt,
+    };
+    traverse(&traversal, scope, scope->data.scopeId);
+    freeTraversal(&traversal);
+}
+
+// Runs once the loops inside `loop` are done, so what they hoisted can be hoisted again.
+void hoistLoop(Traversal* traversal, AST_Node* loop) {
+    Optimizer* opt = traversal->context;
+    int scopeId = traversalFrame(traversal)->scopeId;
+    AST_Node* body = loop->data.controlScope;
+    opt->loopId++;
+    markLoopVariant(opt, body);
+    opt->position = traversalPosition(traversal);
+    opt->outerScopeId = scopeId;
+    hoistExpr(opt, loop->data.controlCondition, scopeId);
+    hoistFromScope(opt, body);
+}
+
+// Loop-invariant code motion. Inner loops are done first, so what they hoist can be hoisted again by the loops around
+// them.
+void hoistLoops(Optimizer* opt, AST_Node* scope) {
+    assert(scope->type == NODE_SCOPE);
+
+    Traversal traversal = {
+        .pre = {
+            [NODE_ASSIGNMENT] = traversalSkip,
+            [NODE_RETURN] = traversalSkip,
+            [NODE_CALL] = traversalSkip,
+        },
+        .child = {
+            [NODE_IF] = traversalSkipCondition,
+            [NODE_WHILE] = traversalSkipCondition,
+        },
+        .post = {
+            [NODE_WHILE] = hoistLoop,
+        },
+        .context = opt,
+    };
+    traverse(&traversal, scope, scope->data.scopeId);
+    freeTraversal(&traversal);
+}
+
+bool countAssignment(Traversal* traversal, AST_Node* statement) {
+    Optimizer* opt = traversal->context;
+    if (opt->assignmentCount < 0) {
+        return false;
+    }
+    String_View name = statement->type == NODE_DECLARATION ? statement->data.declarationName : statement->data.assignmentName;
+    if (tableLookupSymbolIndex(opt->table, traversalFrame(traversal)->scopeId, name) == opt->countedSymbol) {
+        opt->assignmentCount = statement->type == NODE_DECLARATION ? -1 : opt->assignmentCount + 1;
+    }
+    return false;
+}
+
+// Returns how many times the variable with index `symbol` is assigned in `scope`, or -1 if it is declared there.
+int countAssignments(Optimizer* opt, AST_Node* scope, int symbol) {
+    assert(scope->type == NODE_SCOPE);
+
+    Traversal traversal = {
+        .pre = {
+            [NODE_DECLARATION] = countAssignment,
+            [NODE_ASSIGNMENT] = countAssignment,
+            [NODE_RETURN] = traversalSkip,
+            [NODE_CALL] = traversalSkip,
+        },
+        .child = {
+            [NODE_IF] = traversalSkipCondition,
+            [NODE_WHILE] = traversalSkipCondition,
+        },
+        .context = opt,
+    };
+    opt->countedSymbol = symbol;
+    opt->assignmentCount = 0;
+    traverse(&traversal, scope, scope->data.scopeId);
+    freeTraversal(&traversal);
+    return opt->assignmentCount;
+}
+
+// Returns whether the statement held by `statements`, directly in the loop body `body`, updates an induction variable.
+// If so, fills in `induction`.
+bool matchInduction(Optimizer* opt, AST_Node* body, AST_Node* statements, Induction* induction) {
+    AST_Node* statement = statements->data.statementStatement;
+    if (statement->type != NODE_ASSIGNMENT) {
+        return false;
+    }
+    AST_Node* expr = statement->data.assignmentExpr;
+    if (expr->type != NODE_PLUS && expr->type != NODE_MINUS) {
+        return false;
+    }
+    AST_Node* variable = expr->data.binaryOpLeft;
+    AST_Node* step = expr->data.binaryOpRight;
+    if (expr->type == NODE_PLUS && variable->type == NODE_INT) {
+        variable = expr->data.binaryOpRight;
+        step = expr->data.binaryOpLeft;
+    }
+    if (variable->type != NODE_IDENT || step->type != NODE_INT || !svEquals(variable->data.identName, statement->data.assignmentName)) {
+        return false;
+    }
+    // INT_MIN can't be negated.
+    if (expr->type == NODE_MINUS && step->data.intValue == INT_MIN) {
+        return false;
+    }
+
+    induction->symbol = tableLookupSymbolIndex(opt->table, body->data.scopeId, statement->data.assignmentName);
+    assert(induction->symbol >= 0);
+    // The products are kept in int temporaries.
+    if (!typeEquals(opt->table->symbolTypes[induction->symbol], makeType(TYPE_INT))) {
+        return false;
+    }
+    induction->update = statements;
+    induction->step = (int)(expr->type == NODE_PLUS ? step->data.intValue : -step->data.intValue);
+    return countAssignments(opt, body, induction->symbol) == 1;
+}
+
+// Declares an int temporary set to `value` before the loop held by `*opt->position`, and returns its name.
+String_View declareLoopTemp(Optimizer* opt, AST_Node* value) {
+    String_View name = nodeListMakeName(opt->list, "__lcl_t%d", opt->nextTempId++);
+    insertStatementBefore(opt->list, opt->position, addDeclarationNode(opt->list, name, makeType(TYPE_INT)));
+    insertStatementBefore(opt->list, opt->position, addAssignmentNode(opt->list, name, value));
+    optimizerAddSymbol(opt, opt->outerScopeId, name, makeType(TYPE_INT));
+    return name;
+}
+
+// Like `addBinaryOpNode`, but for operators that don't come from a token.
+inline AST_Node* addOperatorNode(AST_Node_List* list, Node_Type type, AST_Node* left, AST_Node* right) {
+    assert(isNodeOperator(type));
+    AST_Node node;
+    node.type = type;
+    node.data.binaryOpLeft = left;
+    node.data.binaryOpRight = right;
+    node.data.binaryOpType = TYPE_INT;
+    return nodeListAddNode(list, node);
+}
+
+// Returns the temporary holding `i * factor` for `opt->induction`, starting one if there isn't one yet. Returns an empty
+// name if the step of the temporary would overflow.
+String_View inductionProduct(Optimizer* opt, AST_Node* factor, int factorSymbol) {
+    Induction* induction = opt->induction;
+    for (int i = 0; i < opt->productsLength; ++i) {
+        Induction_Product product = opt->products[i];
+        bool sameLiteral = factorSymbol == -1 && product.factorSymbol == -1 && product.factor->data.intValue == factor->data.intValue;
+        if (sameLiteral || (factorSymbol != -1 && product.factorSymbol == factorSymbol)) {
+            return product.name;
+        }
+    }
+
+    AST_Node* step;
+    if (factorSymbol == -1) {
+        long long value = (long long)induction->step * factor->data.intValue;
+        if (value < INT_MIN || value > INT_MAX) {
+            return (String_View){0};
+        }
+        step = addIntNode(opt->list, value, TYPE_INT);
+    }
+    else if (induction->step == 1) {
+        step = addIdentNode(opt->list, factor->data.identName);
+    }
+    else {
+        // The factor doesn't change in the loop, so neither does the step.
+        AST_Node* value = addOperatorNode(opt->list, NODE_TIMES, addIntNode(opt->list, induction->step, TYPE_INT), addIdentNode(opt->list, factor->data.identName));
+        step = addIdentNode(opt->list, declareLoopTemp(opt, value));
+    }
+
+    String_View variable = induction->update->data.statementStatement->data.assignmentName;
+    AST_Node* initial = addOperatorNode(opt->list, NODE_TIMES, addIdentNode(opt->list, variable), nodeListAddNode(opt->list, *factor));
+    String_View name = declareLoopTemp(opt, initial);
+
+    // The temporary is stepped right after the variable, so the two always agree.
+    AST_Node* sum = addOperatorNode(opt->list, NODE_PLUS, addIdentNode(opt->list, name), step);
+    AST_Node statements;
+    statements.type = NODE_STATEMENTS;
+    statements.data.statementStatement = addAssignmentNode(opt->list, name, sum);
+    statements.data.statementNext = induction->update->data.statementNext;
+    induction->update->data.statementNext = nodeListAddNode(opt->list, statements);
+
+    if (opt->productsLength == opt->productsCapacity) {
+        opt->productsCapacity = opt->productsCapacity == 0 ? 8 : opt->productsCapacity * 2;
+        opt->products = realloc(opt->products, opt->productsCapacity * sizeof(Induction_Product));
+    }
+    opt->products[opt->productsLength++] = (Induction_Product){factor, factorSymbol, name};
+    return name;
+}
+
+// Replaces `i * factor` with a temporary that is stepped along with `i`, if `i` is the induction variable at hand.
+bool reduceInductionProduct(Traversal* traversal, AST_Node* expr) {
+    Optimizer* opt = traversal->context;
+    int scopeId = traversalFrame(traversal)->scopeId;
+    for (int side = 0; side < 2; ++side) {
+        AST_Node* variable = side == 0 ? expr->data.binaryOpLeft : expr->data.binaryOpRight;
+        AST_Node* factor = side == 0 ? expr->data.binaryOpRight : expr->data.binaryOpLeft;
+        if (variable->type != NODE_IDENT || tableLookupSymbolIndex(opt->table, scopeId, variable->data.identName) != opt->induction->symbol) {
+            continue;
+        }
+
+        int factorSymbol = -1;
+        if (factor->type == NODE_IDENT) {
+            factorSymbol = tableLookupSymbolIndex(opt->table, scopeId, factor->data.identName);
+            assert(factorSymbol >= 0);
+            if (opt->variantLoop[factorSymbol] == opt->loopId) {
+                continue;
+            }
+        }
+        else if (factor->type != NODE_INT) {
+            continue;
+        }
+
+        String_View product = inductionProduct(opt, factor, factorSymbol);
+        if (product.start != NULL) {
+            expr->type = NODE_IDENT;
+            expr->data.identName = product;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Replaces every `i * factor` under `root`, which is inside the scope with ID `scopeId`, with a temporary that is
+// stepped along with `i`.
+void reduceInductionProducts(Optimizer* opt, AST_Node* root, int scopeId) {
+    Traversal traversal = {
+        .pre = {
+            [NODE_TIMES] = reduceInductionProduct,
+        },
+        .context = opt,
+    };
+    traverse(&traversal, root, scopeId);
+    freeTraversal(&traversal);
+}
+
+// Runs once the loops inside `loop` are done, like `hoistLoop`.
+void reduceInductionLoop(Traversal* traversal, AST_Node* loop) {
+    Optimizer* opt = traversal->context;
+    int scopeId = traversalFrame(traversal)->scopeId;
+    AST_Node* body = loop->data.controlScope;
+    opt->loopId++;
+    markLoopVariant(opt, body);
+    opt->position = traversalPosition(traversal);
+    opt->outerScopeId = scopeId;
+
+    for (AST_Node* statements = body->data.scopeStatements; statements != NULL; statements = statements->data.statementNext) {
+        Induction induction;
+        if (!matchInduction(opt, body, statements, &induction)) {
+            continue;
+        }
+        opt->productsLength = 0;
+        opt->induction = &induction;
+        reduceInductionProducts(opt, loop->data.controlCondition, scopeId);
+        reduceInductionProducts(opt, body, body->data.scopeId);
+    }
+}
+
+// Turns products of induction variables in while loops into additions. Inner loops are done first, like `hoistLoops`.
+void reduceInductionLoops(Optimizer* opt, AST_Node* scope) {
+    assert(scope->type == NODE_SCOPE);
+
+    Traversal traversal = {
+        .pre = {
+            [NODE_ASSIGNMENT] = traversalSkip,
+            [NODE_RETURN] = traversalSkip,
+            [NODE_CALL] = traversalSkip,
+        },
+        .child = {
+            [NODE_IF] = traversalSkipCondition,
+            [NODE_WHILE] = traversalSkipCondition,
+        },
+        .post = {
+            [NODE_WHILE] = reduceInductionLoop,
+        },
+        .context = opt,
+    };
+    traverse(&traversal, scope, scope->data.scopeId);
+    freeTraversal(&traversal);
+}
+
+// Finds the multiplier and shift for dividing by `divisor`, which must not be 0, 1, -1 or INT_MIN. Follows the signed
+// algorithm from Hacker's Delight, section 10-4: the smallest shift for which some 33-bit multiplier rounds correctly
+// for every 32-bit dividend.
+Division_Magic divisionMagic(int divisor) {
+    assert(divisor != 0 && divisor != 1 && divisor != -1 && divisor != INT_MIN);
+
+    const uint32_t two31 = 0x80000000u;
+    uint32_t absDivisor = divisor < 0 ? (uint32_t)-divisor : (uint32_t)divisor;
+    uint32_t t = two31 + ((uint32_t)divisor >> 31);
+    uint32_t absNc = t - 1 - t % absDivisor; // Largest dividend of the same sign whose remainder is |d| - 1
+    int p = 31;
+    uint32_t q1 = two31 / absNc;
+    uint32_t r1 = two31 - q1 * absNc;
+    uint32_t q2 = two31 / absDivisor;
+    uint32_t r2 = two31 - q2 * absDivisor;
+    uint32_t delta;
+    do {
+        p++;
+        q1 *= 2;
+        r1 *= 2;
+        if (r1 >= absNc) {
+            q1++;
+            r1 -= absNc;
+        }
+        q2 *= 2;
+        r2 *= 2;
+        if (r2 >= absDivisor) {
+            q2++;
+            r2 -= absDivisor;
+        }
+        delta = absDivisor - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+
+    Division_Magic magic;
+    magic.multiplier = (int32_t)(q2 + 1);
+    if (divisor < 0) {
+        magic.multiplier = -magic.multiplier;
+    }
+    magic.shift = p - 32;
+    // The multiplier doesn't fit in 32 signed bits when its sign comes out wrong, so the dividend makes up the rest.
+    magic.adjust = divisor > 0 && magic.multiplier < 0 ? 1 : divisor < 0 && magic.multiplier > 0 ? -1 : 0;
+    return magic;
+}
+
+// Divides `n` by the divisor `magic` was made for, rounding towards zero. `n` is treated as a 32-bit int, like the
+// emitted C does.
+inline long long divideByMagic(long long n, Division_Magic magic) {
+    int64_t dividend = (int32_t)n;
+    int64_t quotient = ((int64_t)magic.multiplier * dividend) >> 32;
+    quotient += magic.adjust * dividend;
+    quotient >>= magic.shift;
+    return quotient + (quotient < 0);
+}
+
+// Packs `magic` into a single bytecode constant.
+inline long long packDivisionMagic(Division_Magic magic) {
+    return (long long)((uint64_t)(uint32_t)magic.multiplier | (uint64_t)magic.shift << 32 | (uint64_t)(magic.adjust + 1) << 40);
+}
+
+inline Division_Magic unpackDivisionMagic(long long packed) {
+    return (Division_Magic){
+        .multiplier = (int32_t)(uint32_t)packed,
+        .shift = (int)((packed >> 32) & 0xff),
+        .adjust = (int)((packed >> 40) & 0xff) - 1,
+    };
+}
+
+// Returns k if `value` is 2^k for some k >= 1, and -1 otherwise.
+inline int powerOfTwoExponent(int value) {
+    if (value < 2 || (value & (value - 1)) != 0) {
+        return -1;
+    }
+    int exponent = 0;
+    while (value > 1) {
+        value >>= 1;
+        exponent++;
+    }
+    return exponent;
+}
+
+// Multiplication by powers of two becomes a shift, once the operands are reduced.
+void reduceProduct(Traversal* traversal, AST_Node* expr) {
+    (void)traversal;
+    AST_Node* left = expr->data.binaryOpLeft;
+    AST_Node* right = expr->data.binaryOpRight;
+    if (left->type == NODE_INT) {
+        AST_Node* swap = left;
+        left = right;
+        right = swap;
+    }
+    // The reduced forms only exist for int; sized operators keep their own wrapping.
+    if (expr->data.binaryOpType != TYPE_INT || right->type != NODE_INT) {
+        return;
+    }
+    int exponent = powerOfTwoExponent((int)right->data.intValue);
+    if (exponent > 0) {
+        expr->type = NODE_SHIFT_LEFT;
+        expr->data.shiftValue = left;
+        expr->data.shiftAmount = exponent;
+    }
+}
+
+// Division by a constant becomes a multiply-high sequence, once the operands are reduced.
+void reduceQuotient(Traversal* traversal, AST_Node* expr) {
+    (void)traversal;
+    AST_Node* left = expr->data.binaryOpLeft;
+    AST_Node* right = expr->data.binaryOpRight;
+    // Division by zero is left to fail at run time, and division by 1 or -1 is left alone.
+    if (expr->data.binaryOpType != TYPE_INT || right->type != NODE_INT) {
+        return;
+    }
+    int divisor = (int)right->data.intValue;
+    if (divisor == 0 || divisor == 1 || divisor == -1 || divisor == INT_MIN) {
+        return;
+    }
+    expr->type = NODE_DIVIDE_CONSTANT;
+    expr->data.divideDividend = left;
+    expr->data.divideDivisor = divisor;
+    expr->data.divideMagic = divisionMagic(divisor);
+}
+
+// Replaces multiplication by powers of two with shifts, and division by constants with multiply-high sequences.
+void reduceScope(Optimizer* opt, AST_Node* scope) {
+    assert(scope->type == NODE_SCOPE);
+
+    Traversal traversal = {
+        .post = {
+            [NODE_TIMES] = reduceProduct,
+            [NODE_DIVIDE] = reduceQuotient,
+        },
+        .context = opt,
+    };
+    traverse(&traversal, scope, scope->data.scopeId);
+    freeTraversal(&traversal);
+}
+
+// Optimizes the checked `program` in place, leaving `table` describing the result.
+void optimizeProgram(AST_Node_List* list, Symbol_Table* table, Program program) {
+    Optimizer opt = {
+        .list = list,
+        .table = table,
+        .program = program,
+    };
+
+    // Candidates are picked before anything changes, so inlining into a function can't change whether it is inlined.
+    opt.inlinable = calloc(program.length + 1, sizeof(bool));
+    bool anyInlinable = false;
+    for (int i = 0; i < program.length; ++i) {
+        opt.inlinable[i] = isInlinable(program.nodes[i]);
+        anyInlinable = anyInlinable || opt.inlinable[i];
+    }
+    if (anyInlinable) {
+        for (int i = 0; i < program.length; ++i) {
+            traceBegin("inline", program.nodes[i]->data.functionName);
+            inlineScope(&opt, program.nodes[i]->data.functionBody);
+            traceEnd("inline", program.nodes[i]->data.functionName);
+        }
+        // Inlining adds scopes and variables, so the table is rebuilt to match.
+        symbolTableReset(table);
+        initSymbolTable(table, program);
+    }
+
+    // Folding runs after inlining, so that constant arguments reach the inlined bodies.
+    opt.constants = calloc(table->symbolsLength + 1, sizeof(AST_Node*));
+    for (int i = 0; i < program.length; ++i) {
+        traceBegin("fold", program.nodes[i]->data.functionName);
+        foldScope(&opt, program.nodes[i]->data.functionBody);
+        traceEnd("fold", program.nodes[i]->data.functionName);
+    }
+
+    // Hoisting runs last, so that expressions folded to literals aren't given temporaries.
+    opt.variantCapacity = table->symbolsCapacity;
+    opt.variantLoop = calloc(opt.variantCapacity, sizeof(int));
+    for (int i = 0; i < program.length; ++i) {
+        traceBegin("hoist", program.nodes[i]->data.functionName);
+        hoistLoops(&opt, program.nodes[i]->data.functionBody);
+        traceEnd("hoist", program.nodes[i]->data.functionName);
+    }
+    // Induction variables are looked for after hoisting, so that invariant factors are already plain variables.
+    for (int i = 0; i < program.length; ++i) {
+        traceBegin("inductions", program.nodes[i]->data.functionName);
+        reduceInductionLoops(&opt, program.nodes[i]->data.functionBody);
+        traceEnd("inductions", program.nodes[i]->data.functionName);
+    }
+    // Temporaries were added to the end of the table as they were made, but the bytecode compiler needs each function's
+    // symbols to be contiguous.
+    if (opt.nextTempId > 0) {
+        symbolTableReset(table);
+        initSymbolTable(table, program);
+    }
+
+    // Strength reduction runs last, since the other passes only understand the operators the parser makes.
+    for (int i = 0; i < program.length; ++i) {
+        traceBegin("reduce", program.nodes[i]->data.functionName);
+        reduceScope(&opt, program.nodes[i]->data.functionBody);
+        traceEnd("reduce", program.nodes[i]->data.functionName);
+    }
+
+    free(opt.hoisting);
+    free(opt.folds);
+    free(opt.products);
+    free(opt.variantLoop);
+    free(opt.constants);
+    free(opt.renamedFrom);
+    free(opt.renamedTo);
+    free(opt.inlinable);
+}
+
+
+
+/////////////////
+// Emitter API //
+/////////////////
+
+void emitScope(int leadingIndent, int indent, String_Builder* out, AST_Node* root);
+void emitArgs(String_Builder* out, AST_Node* root);
+void emitFunctionSignature(String_Builder* out, AST_Node* root);
+void emitFunction(String_Builder* out, AST_Node* root);
+void emitPrelude(String_Builder* out);
+void emitPrototypes(String_Builder* out, Program program);
+void emitProgram(String_Builder* out, Program program);
+
+// `context` of the traversal in `emitScope`.
+typedef struct {
+    String_Builder* out;
+    int indent;        // Indent of the closing brace of the innermost scope. Its statements go one level deeper.
+    int leadingIndent; // Indent of the opening brace of the outermost scope
+} Emitter;
+
+// Writes the C spelling of `type`. The sized integer types come from <stdint.h>.
+void emitTypeName(String_Builder* out, Type type) {
+    if (type.id >= TYPE_I8 && type.id <= TYPE_U64) {
+        sbAppend(out, integerTypes[type.id].cName);
+    }
+    else {
+        sbPrintf(out, SV_FMT, SV_ARG(type.name));
+    }
+}
+
+// Whether the operator `node` is emitted as a wrapping operation: its operands are cast to 64 bits, where C neither
+// promotes them to int nor overflows, and the result is cast back to the narrow type.
+inline bool emitsWrapping(AST_Node* node) {
+    return node->type != NODE_IS_EQUAL && isNarrowType(node->data.binaryOpType);
+}
+
+// The 64-bit type the operands of a wrapping operator are cast to. Division has to keep the sign.
+inline char* wrappingOperandType(AST_Node* node) {
+    if (node->type == NODE_DIVIDE && integerTypes[node->data.binaryOpType].isSigned) {
+        return "int64_t";
+    }
+    return "uint64_t";
+}
+
+// Returns the precedence that `parent` emits its operands at. Operands that bind less tightly need parentheses.
+int emitOperandPrecedence(AST_Node* parent) {
+    if (parent == NULL) {
+        return -1;
+    }
+    if (isNodeOperator(parent->type)) {
+        // Operands of a wrapping operator follow a cast, so every operator among them needs parentheses.
+        return emitsWrapping(parent) ? INT_MAX : getNodePrecedence(parent->type);
+    }
+    if (parent->type == NODE_DIVIDE_CONSTANT) {
+        return getNodePrecedence(NODE_DIVIDE);
+    }
+    return -1;
+}
+
+bool emitScopeOpen(Traversal* traversal, AST_Node* node) {
+    (void)node;
+    Emitter* emitter = traversal->context;
+    AST_Node* parent = traversalParent(traversal);
+    int leadingIndent = emitter->leadingIndent;
+    if (parent != NULL) {
+        // Scopes that are statements of their own start on a new line, and the bodies of control statements don't.
+        emitter->indent++;
+        leadingIndent = parent->type == NODE_SCOPE ? emitter->indent : 0;
+    }
+    sbAppendIndented(leadingIndent, emitter->out, "{\n");
+    return true;
+}
+
+void emitScopeClose(Traversal* traversal, AST_Node* node) {
+    (void)node;
+    Emitter* emitter = traversal->context;
+    sbAppendIndented(emitter->indent, emitter->out, "}\n");
+    if (traversalParent(traversal) != NULL) {
+        emitter->indent--;
+    }
+}
+
+bool emitStatementStart(Traversal* traversal, AST_Node* node) {
+    Emitter* emitter = traversal->context;
+    String_Builder* out = emitter->out;
+    int indent = emitter->indent + 1;
+    switch (node->type) {
+        case NODE_RETURN: {
+            sbAppendIndented(indent, out, "return ");
+            return true;
+        }
+        case NODE_DECLARATION: {
+            sbAppendIndented(indent, out, "");
+            emitTypeName(out, node->data.declarationType);
+            sbPrintf(out, " "SV_FMT, SV_ARG(node->data.declarationName));
+            if (node->data.declarationType.size >= 0) {
+                sbPrintf(out, "[%d]", node->data.declarationType.size);
+            }
+            sbAppend(out, ";\n");
+            return false;
+        }
+        case NODE_ASSIGNMENT: {
+            sbPrintfIndented(indent, out, SV_FMT" = ", SV_ARG(node->data.assignmentName));
+            return true;
+        }
+        case NODE_IF: {
+            sbAppendIndented(indent, out, "if (");
+            return true;
+        }
+        case NODE_ELSE: {
+            sbAppendIndented(indent, out, "else ");
+            return true;
+        }
+        case NODE_WHILE: {
+            sbAppendIndented(indent, out, "while (");
+            return true;
+        }
+        default:
+            printf("Unexpected node type: %d\n", node->type);
+            assert(false && "Not a statement type or non-exhaustive cases (emitStatementStart)");
+    }
+    return false;
+}
+
+void emitStatementEnd(Traversal* traversal, AST_Node* node) {
+    (void)node;
+    Emitter* emitter = traversal->context;
+    sbAppend(emitter->out, ";\n");
+}
+
+bool emitControlBody(Traversal* traversal, AST_Node* node, AST_Node* child, int index) {
+    (void)node;
+    (void)child;
+    Emitter* emitter = traversal->context;
+    if (index == 1) {
+        sbAppend(emitter->out, ") ");
+    }
+    return true;
+}
+
+bool emitOperatorStart(Traversal* traversal, AST_Node* node) {
+    Emitter* emitter = traversal->context;
+    if (emitsWrapping(node)) {
+        sbPrintf(emitter->out, "(%s)((%s)", integerTypes[node->data.binaryOpType].cName, wrappingOperandType(node));
+        return true;
+    }
+    if (getNodePrecedence(node->type) < emitOperandPrecedence(traversalParent(traversal))) {
+        sbAppend(emitter->out, "(");
+    }
+    return true;
+}
+
+bool emitOperator(Traversal* traversal, AST_Node* node, AST_Node* child, int index) {
+    (void)child;
+    Emitter* emitter = traversal->context;
+    if (index == 1) {
+        switch (node->type) {
+            case NODE_PLUS:     sbAppend(emitter->out, " + ");  break;
+            case NODE_MINUS:    sbAppend(emitter->out, " - ");  break;
+            case NODE_TIMES:    sbAppend(emitter->out, " * ");  break;
+            case NODE_DIVIDE:   sbAppend(emitter->out, " / ");  break;
+            case NODE_IS_EQUAL: sbAppend(emitter->out, " == "); break;
+        }
+        static_assert(NUM_BINOP_NODES == 5, "Non-exhaustive cases (emitOperator)");
+        if (emitsWrapping(node)) {
+            sbPrintf(emitter->out, "(%s)", wrappingOperandType(node));
+        }
+    }
+    return true;
+}
+
+void emitOperatorEnd(Traversal* traversal, AST_Node* node) {
+    Emitter* emitter = traversal->context;
+    if (emitsWrapping(node)) {
+        sbAppend(emitter->out, ")");
+        return;
+    }
+    if (getNodePrecedence(node->type) < emitOperandPrecedence(traversalParent(traversal))) {
+        sbAppend(emitter->out, ")");
+    }
+}
+
+bool emitTermStart(Traversal* traversal, AST_Node* node) {
+    Emitter* emitter = traversal->context;
+    String_Builder* out = emitter->out;
+    switch (node->type) {
+        case NODE_INT: {
+            // C would evaluate an operator on two unsuffixed literals in a signed type, and has no signed type for the
+            // u64 values above the largest i64, so u64 literals are written unsigned. i64 literals are written as long
+            // long, so that `2147483647 + 1` isn't evaluated as an int.
+            if (node->data.intType == TYPE_U64) {
+                sbPrintf(out, "%lluULL", (unsigned long long)node->data.intValue);
+            }
+            else if (node->data.intType == TYPE_I64) {
+                sbPrintf(out, "%lldLL", node->data.intValue);
+            }
+            else {
+                sbPrintf(out, "%lld", node->data.intValue);
+            }
+            return false;
+        }
+        case NODE_BOOL: {
+            sbPrintf(out, "%d", node->data.boolValue);
+            return false;
+        }
+        case NODE_IDENT: {
+            sbPrintf(out, SV_FMT, SV_ARG(node->data.identName));
+            return false;
+        }
+        case NODE_ARRAY_ACCESS: {
+            sbPrintf(out, SV_FMT"[", SV_ARG(node->data.accessArrayName));
+            return true;
+        }
+        case NODE_CALL: {
+            if (traversalIsStatement(traversal)) {
+                sbAppendIndented(emitter->indent + 1, out, "");
+            }
+            sbPrintf(out, SV_FMT"(", SV_ARG(node->data.callName));
+            return true;
+        }
+        case NODE_SHIFT_LEFT: {
+            // Shifting a negative int left is undefined in C, but shifting it as unsigned matches multiplication.
+            sbAppend(out, "(int)((unsigned)(");
+            return true;
+        }
+        case NODE_DIVIDE_CONSTANT: {
+            // C compilers already divide by constants this way, so the emitted C keeps the plain division.
+            sbAppend(out, "(");
+            return true;
+        }
+        case NODE_CONVERT: {
+            sbPrintf(out, "(%s)(", integerTypes[node->data.convertType].cName);
+            return true;
+        }
+        default:
+            printf("Unknown node term type: %d\n", node->type);
+            assert(false && "Called with a non-term node or non-exhaustive cases (emitTermStart)");
+    }
+    return false;
+}
+
+bool emitCallArgument(Traversal* traversal, AST_Node* node, AST_Node* child, int index) {
+    (void)node;
+    (void)child;
+    Emitter* emitter = traversal->context;
+    if (index > 0) {
+        sbAppend(emitter->out, ", ");
+    }
+    return true;
+}
+
+void emitTermEnd(Traversal* traversal, AST_Node* node) {
+    Emitter* emitter = traversal->context;
+    String_Builder* out = emitter->out;
+    switch (node->type) {
+        case NODE_ARRAY_ACCESS: {
+            sbAppend(out, "]");
+            break;
+        }
+        case NODE_CALL: {
+            sbAppend(out, traversalIsStatement(traversal) ? ");\n" : ")");
+            break;
+        }
+        case NODE_SHIFT_LEFT: {
+            sbPrintf(out, ") << %d)", node->data.shiftAmount);
+            break;
+        }
+        case NODE_DIVIDE_CONSTANT: {
+            sbPrintf(out, " / %d)", node->data.divideDivisor);
+            break;
+        }
+        case NODE_CONVERT: {
+            sbAppend(out, ")");
+            break;
+        }
+        default:
+            assert(false && "Called with a term without children or non-exhaustive cases (emitTermEnd)");
+    }
+}
+
+// Emits the scope `root`, with its opening brace at `leadingIndent` and its closing brace at `indent`.
+void emitScope(int leadingIndent, int indent, String_Builder* out, AST_Node* root) {
+    assert(root->type == NODE_SCOPE);
+
+    Emitter emitter = {out, indent, leadingIndent};
+    Traversal traversal = {
+        .pre = {
+            [NODE_SCOPE] = emitScopeOpen,
+            [NODE_RETURN] = emitStatementStart,
+            [NODE_DECLARATION] = emitStatementStart,
+            [NODE_ASSIGNMENT] = emitStatementStart,
+            [NODE_IF] = emitStatementStart,
+            [NODE_ELSE] = emitStatementStart,
+            [NODE_WHILE] = emitStatementStart,
+            [NODE_PLUS] = emitOperatorStart,
+            [NODE_MINUS] = emitOperatorStart,
+            [NODE_TIMES] = emitOperatorStart,
+            [NODE_DIVIDE] = emitOperatorStart,
+            [NODE_IS_EQUAL] = emitOperatorStart,
+            [NODE_INT] = emitTermStart,
+            [NODE_BOOL] = emitTermStart,
+            [NODE_IDENT] = emitTermStart,
+            [NODE_ARRAY_ACCESS] = emitTermStart,
+            [NODE_CALL] = emitTermStart,
+            [NODE_SHIFT_LEFT] = emitTermStart,
+            [NODE_DIVIDE_CONSTANT] = emitTermStart,
+            [NODE_CONVERT] = emitTermStart,
+        },
+        .child = {
+            [NODE_IF] = emitControlBody,
+            [NODE_WHILE] = emitControlBody,
+            [NODE_PLUS] = emitOperator,
+            [NODE_MINUS] = emitOperator,
+            [NODE_TIMES] = emitOperator,
+            [NODE_DIVIDE] = emitOperator,
+            [NODE_IS_EQUAL] = emitOperator,
+            [NODE_CALL] = emitCallArgument,
+        },
+        .post = {
+            [NODE_SCOPE] = emitScopeClose,
+            [NODE_RETURN] = emitStatementEnd,
+            [NODE_ASSIGNMENT] = emitStatementEnd,
+            [NODE_PLUS] = emitOperatorEnd,
+            [NODE_MINUS] = emitOperatorEnd,
+            [NODE_TIMES] = emitOperatorEnd,
+            [NODE_DIVIDE] = emitOperatorEnd,
+            [NODE_IS_EQUAL] = emitOperatorEnd,
+            [NODE_ARRAY_ACCESS] = emitTermEnd,
+            [NODE_CALL] = emitTermEnd,
+            [NODE_SHIFT_LEFT] = emitTermEnd,
+            [NODE_DIVIDE_CONSTANT] = emitTermEnd,
+            [NODE_CONVERT] = emitTermEnd,
+        },
+        .context = &emitter,
+    };
+    static_assert(NODE_COUNT == 24, "Non-exhaustive hooks (emitScope)");
+    traverse(&traversal, root, -1);
+    freeTraversal(&traversal);
+}
+
+void emitArgs(String_Builder* out, AST_Node* root) {
+    if (root == NULL) {
+        sbAppend(out, "()");
+        return;
+    }
+
+    sbAppend(out, "(");
+    emitTypeName(out, root->data.argType);
+    sbPrintf(out, " "SV_FMT, SV_ARG(root->data.argName));
+    root = root->data.argNext;
+    while (root != NULL) {
+        sbAppend(out, ", ");
+        emitTypeName(out, root->data.argType);
+        sbPrintf(out, " "SV_FMT, SV_ARG(root->data.argName));
+        root = root->data.argNext;
+    }
+    sbAppend(out, ")");
+}
+
+void emitFunctionSignature(String_Builder* out, AST_Node* root) {
+    assert(root->type == NODE_FUNCTION);
+
+    if (svEqualsCStr(root->data.functionName, "main")) {
+        sbAppend(out, "int ");
+    }
+    else if (svEqualsCStr(root->data.functionRetType.name, "unit")) {
+        sbAppend(out, "void ");
+    }
+    else {
+        emitTypeName(out, root->data.functionRetType);
+        sbAppend(out, " ");
+    }
+    sbPrintf(out, SV_FMT, SV_ARG(root->data.functionName));
+    emitArgs(out, root->data.functionArgs);
+}
+
+void emitFunction(String_Builder* out, AST_Node* root) {
+    assert(root->type == NODE_FUNCTION);
+    traceBegin("emit", root->data.functionName);
+
+    emitFunctionSignature(out, root);
+    sbAppend(out, " ");
+    emitScope(0, 0, out, root->data.functionBody);
+    traceEnd("emit", root->data.functionName);
+}
+
+void emitPrelude(String_Builder* out) {
+    sbAppend(out, "#include <stdbool.h>\n"); // Needed for bool types in the emitted C program
+    sbAppend(out, "#include <stdint.h>\n\n"); // Needed for the sized integer types
+}
+
+// Declares every function up front, so that functions can be called before they are defined.
+void emitPrototypes(String_Builder* out, Program program) {
+    if (program.length == 0) {
+        return;
+    }
+
+    for (int i = 0; i < program.length; ++i) {
+        emitFunctionSignature(out, program.nodes[i]);
+        sbAppend(out, ";\n");
+    }
+    sbAppend(out, "\n");
+}
+
+void emitProgram(String_Builder* out, Program program) {
+    emitPrelude(out);
+
+    if (program.length == 0) {
+        return;
+    }
+
+    emitPrototypes(out, program);
+
+    emitFunction(out, program.nodes[0]);
+    for (int i = 1; i < program.length; ++i) {
+        sbAppend(out, "\n");
+        emitFunction(out, program.nodes[i]);
+    }
+}
+
+/////////////////////
+// Interpreter API //
+/////////////////////
+
+// Evaluates a verified and type checked `Program` directly from the AST, without going through C.
+// Every call gets one frame, sized and laid out by the symbol table. A scope's slots are cleared whenever it is
+// entered, so its variables start at zero each time.
+// Expressions and scopes are walked with explicit stacks, so only calls in the program being run use the C stack.
+
+typedef long long Value;
+
+typedef struct {
+    int base; // Index of the first slot of this frame in `Interpreter.stack`
+} Interp_Frame;
+
+typedef enum {
+    EXEC_NORMAL,
+    EXEC_RETURN,
+} Exec_Result;
+
+// A scope being run, and how far it has got.
+typedef struct {
+    AST_Node* statements; // The statements left to run
+    AST_Node* loop;       // The `while` this scope is the body of, or NULL
+    int scopeId;
+    bool runElse;         // Whether an `else` directly following the previous statement should run
+} Interp_Block;
+
+typedef struct {
+    Symbol_Table* table;
+    Program program;
+
+    Value* stack;
+    int stackLength;
+    int stackCapacity;
+
+    Interp_Frame* frames;
+    int framesLength;
+    int framesCapacity;
+
+    Interp_Block* blocks;
+    int blocksLength;
+    int blocksCapacity;
+
+    Traversal operators; // Operators whose operands are being evaluated. No hooks are set; `interpEvalExpr` drives it.
+    Value* values;       // Operands evaluated so far
+    int valuesLength;
+    int valuesCapacity;
+
+    Value returnValue; // Set when a statement finishes with `EXEC_RETURN`
+} Interpreter;
+
+Value interpEvalExpr(Interpreter* interp, AST_Node* root, int scopeId);
+Value interpRunFunction(Interpreter* interp, AST_Node* function, Value* args);
+
+void interpError(char* fmt, ...) {
+    fprintf(stderr, "RUNTIME ERROR! ");
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+Interpreter makeInterpreter(Symbol_Table* table, Program program) {
+    Interpreter interp = {0};
+    interp.table = table;
+    interp.program = program;
+    interp.stackCapacity = 256;
+    interp.stack = malloc(interp.stackCapacity * sizeof(Value));
+    interp.framesCapacity = 32;
+    interp.frames = malloc(interp.framesCapacity * sizeof(Interp_Frame));
+    return interp;
+}
+
+void freeInterpreter(Interpreter* interp) {
+    free(interp->stack);
+    free(interp->frames);
+    free(interp->blocks);
+    freeTraversal(&interp->operators);
+    free(interp->values);
+}
+
+void interpPushFrame(Interpreter* interp, int size) {
+    if (interp->stackLength + size > interp->stackCapacity) {
+        while (interp->stackLength + size > interp->stackCapacity) {
+            interp->stackCapacity *= 2;
+        }
+        interp->stack = realloc(interp->stack, interp->stackCapacity * sizeof(Value));
+    }
+    if (interp->framesLength == interp->framesCapacity) {
+        interp->framesCapacity *= 2;
+        interp->frames = realloc(interp->frames, interp->framesCapacity * sizeof(Interp_Frame));
+    }
+
+    interp->frames[interp->framesLength++] = (Interp_Frame){interp->stackLength};
+    memset(&interp->stack[interp->stackLength], 0, size * sizeof(Value));
+    interp->stackLength += size;
+}
+
+void interpPopFrame(Interpreter* interp) {
+    assert(interp->framesLength > 0);
+    interp->stackLength = interp->frames[--interp->framesLength].base;
+}
+
+// Returns a pointer to the first slot of the variable `name`, as seen from the scope with ID `scopeId`.
+// The pointer is only valid until the next frame is pushed.
+Value* interpLookupSlot(Interpreter* interp, int scopeId, String_View name, Type* type) {
+    int index = tableLookupSymbolIndex(interp->table, scopeId, name);
+    assert(index >= 0);
+    if (type != NULL) {
+        *type = interp->table->symbolTypes[index];
+    }
+    assert(interp->framesLength > 0);
+    return &interp->stack[interp->frames[interp->framesLength - 1].base + interp->table->symbolSlots[index]];
+}
+
+// Brings the result of the arithmetic operator `node` back into the range of its type. Narrow types wrap around at their
+// width, and the others at 64 bits.
+inline Value interpWrap(AST_Node* node, uint64_t value) {
+    return isNarrowType(node->data.binaryOpType) ? narrowInteger(node->data.binaryOpType, value) : (Value)value;
+}
+
+inline void interpPushValue(Interpreter* interp, Value value) {
+    if (interp->valuesLength == interp->valuesCapacity) {
+        interp->valuesCapacity = interp->valuesCapacity == 0 ? 64 : interp->valuesCapacity * 2;
+        interp->values = realloc(interp->values, interp->valuesCapacity * sizeof(Value));
+    }
+    interp->values[interp->valuesLength++] = value;
+}
+
+// Evaluates the leaves of expressions, and returns false for anything else.
+bool interpEvalLeaf(Interpreter* interp, AST_Node* node, int scopeId, Value* result) {
+    switch (node->type) {
+        case NODE_INT: {
+            *result = node->data.intValue;
+            return true;
+        }
+        case NODE_BOOL: {
+            *result = node->data.boolValue;
+            return true;
+        }
+        case NODE_IDENT: {
+            Type type;
+            Value* slot = interpLookupSlot(interp, scopeId, node->data.identName, &type);
+            if (type.size >= 0) {
+                interpError("Array \""SV_FMT"\" cannot be used as a value", SV_ARG(node->data.identName));
+            }
+            *result = *slot;
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+// Applies the operator `node` to `operands`, which hold the values of its children in order.
+Value interpApply(Interpreter* interp, AST_Node* node, Value* operands, int scopeId) {
+    switch (node->type) {
+        case NODE_ARRAY_ACCESS: {
+            Value index = operands[0];
+            Type type;
+            Value* slot = interpLookupSlot(interp, scopeId, node->data.accessArrayName, &type);
+            if (index < 0 || index >= type.size) {
+                interpError("Index %lld is out of bounds for array \""SV_FMT"\" of size %d", index, SV_ARG(node->data.accessArrayName), type.size);
+            }
+            return slot[index];
+        }
+        case NODE_PLUS: {
+            return interpWrap(node, (uint64_t)operands[0] + (uint64_t)operands[1]);
+        }
+        case NODE_MINUS: {
+            return interpWrap(node, (uint64_t)operands[0] - (uint64_t)operands[1]);
+        }
+        case NODE_TIMES: {
+            return interpWrap(node, (uint64_t)operands[0] * (uint64_t)operands[1]);
+        }
+        case NODE_DIVIDE: {
+            if (operands[1] == 0) {
+                interpError("Division by zero");
+            }
+            if (node->data.binaryOpType == TYPE_U64) {
+                return (Value)((uint64_t)operands[0] / (uint64_t)operands[1]);
+            }
+            // Dividing the smallest i64 by -1 traps on x86, so division by -1 is done as a wrapping negation.
+            if (operands[1] == -1) {
+                return interpWrap(node, 0 - (uint64_t)operands[0]);
+            }
+            return interpWrap(node, (uint64_t)(operands[0] / operands[1]));
+        }
+        case NODE_SHIFT_LEFT: {
+            return (Value)((uint64_t)operands[0] << node->data.shiftAmount);
+        }
+        case NODE_DIVIDE_CONSTANT: {
+            return divideByMagic(operands[0], node->data.divideMagic);
+        }
+        case NODE_CONVERT: {
+            // Conversions only widen, and every integer type is held sign or zero extended, so the value stays as is.
+            return operands[0];
+        }
+        case NODE_IS_EQUAL: {
+            return operands[0] == operands[1];
+        }
+        case NODE_CALL: {
+            // Arguments belong to the caller, so they are evaluated before the callee gets a frame.
+            AST_Node* function = tableLookupFunction(interp->table, node->data.callName)->function;
+            return interpRunFunction(interp, function, operands);
+        }
+        default:
+            printf("Unknown expression node: %d\n", node->type);
+            assert(false && "Not an expression type or non-exhaustive cases (interpApply)");
+    }
+    static_assert(NUM_BINOP_NODES == 5, "Non-exhaustive cases (interpApply)");
+    return 0;
+}
+
+inline bool isLeafNode(AST_Node* node) {
+    return node->type == NODE_INT || node->type == NODE_BOOL || node->type == NODE_IDENT;
+}
+
+// Evaluates `node` on the spot if it is a leaf or an operator on leaves, which covers most expressions, and returns
+// false for anything else.
+bool interpEvalShallow(Interpreter* interp, AST_Node* node, int scopeId, Value* result) {
+    if (interpEvalLeaf(interp, node, scopeId, result)) {
+        return true;
+    }
+    if (!isNodeOperator(node->type) || !isLeafNode(node->data.binaryOpLeft) || !isLeafNode(node->data.binaryOpRight)) {
+        return false;
+    }
+    Value operands[2];
+    interpEvalLeaf(interp, node->data.binaryOpLeft, scopeId, &operands[0]);
+    interpEvalLeaf(interp, node->data.binaryOpRight, scopeId, &operands[1]);
+    *result = interpApply(interp, node, operands, scopeId);
+    return true;
+}
+
+// Evaluates `root` in the scope with ID `scopeId`. Operators wait on `interp->operators` while their operands are
+// evaluated onto `interp->values`, so a call among the operands can evaluate expressions of its own on top of them.
+Value interpEvalExpr(Interpreter* interp, AST_Node* root, int scopeId) {
+    Value result;
+    if (interpEvalShallow(interp, root, scopeId, &result)) {
+        return result;
+    }
+
+    Traversal* operators = &interp->operators;
+    int base = operators->length;
+    traversalPush(operators, root, scopeId);
+    while (operators->length > base) {
+        Traversal_Frame* frame = &operators->stack[operators->length - 1];
+        AST_Node* operand = traversalNextChild(frame);
+        if (operand == NULL) {
+            // Asking for the next child counted once past the last one.
+            int first = interp->valuesLength - (frame->index - 1);
+            AST_Node* node = frame->node;
+            operators->length--;
+            // A callee binds its arguments before it evaluates anything, so they can't move while it reads them.
+            result = interpApply(interp, node, &interp->values[first], scopeId);
+            interp->valuesLength = first;
+            interpPushValue(interp, result);
+        }
+        else if (interpEvalShallow(interp, operand, scopeId, &result)) {
+            interpPushValue(interp, result);
+        }
+        else {
+            traversalPush(operators, operand, scopeId);
+        }
+    }
+    return interp->values[--interp->valuesLength];
+}
+
+void interpPushBlock(Interpreter* interp, AST_Node* scope, AST_Node* loop) {
+    assert(scope->type == NODE_SCOPE);
+    if (interp->blocksLength == interp->blocksCapacity) {
+        interp->blocksCapacity = interp->blocksCapacity == 0 ? 16 : interp->blocksCapacity * 2;
+        interp->blocks = realloc(interp->blocks, interp->blocksCapacity * sizeof(Interp_Block));
+    }
+    interp->blocks[interp->blocksLength++] = (Interp_Block){scope->data.scopeStatements, loop, scope->data.scopeId, false};
+}
+
+// Starts running the nested scope `scope`, as the body of `loop` if it isn't NULL.
+void interpEnterScope(Interpreter* interp, AST_Node* scope, AST_Node* loop) {
+    int scopeId = scope->data.scopeId;
+    if (scopeId < interp->table->scopesLength) {
+        Scope_Entry entry = interp->table->scopes[scopeId];
+        memset(&interp->stack[interp->frames[interp->framesLength - 1].base + entry.slotStart], 0, entry.slotCount * sizeof(Value));
+    }
+    interpPushBlock(interp, scope, loop);
+}
+
+// Runs the body of a function, whose frame is already set up. Nested scopes are pushed on `interp->blocks` rather
+// than run recursively. Blocks are found by index, since evaluating an expression can run a call that grows the stack.
+Exec_Result interpExecBody(Interpreter* interp, AST_Node* body) {
+    int base = interp->blocksLength;
+    interpPushBlock(interp, body, NULL);
+
+    while (interp->blocksLength > base) {
+        int top = interp->blocksLength - 1;
+        AST_Node* statements = interp->blocks[top].statements;
+        int scopeId = interp->blocks[top].scopeId;
+
+        if (statements == NULL) {
+            // A loop body runs again for as long as the condition, which is in the scope around the loop, holds.
+            AST_Node* loop = interp->blocks[top].loop;
+            interp->blocksLength--;
+            if (loop != NULL && interpEvalExpr(interp, loop->data.controlCondition, interp->blocks[top - 1].scopeId)) {
+                interpEnterScope(interp, loop->data.controlScope, loop);
+            }
+            continue;
+        }
+
+        AST_Node* statement = statements->data.statementStatement;
+        bool runElse = interp->blocks[top].runElse;
+        interp->blocks[top].statements = statements->data.statementNext;
+        interp->blocks[top].runElse = false;
+
+        switch (statement->type) {
+            case NODE_DECLARATION: {
+                break;
+            }
+            case NODE_CALL: {
+                interpEvalExpr(interp, statement, scopeId);
+                break;
+            }
+            case NODE_ASSIGNMENT: {
+                Value value = interpEvalExpr(interp, statement->data.assignmentExpr, scopeId);
+                *interpLookupSlot(interp, scopeId, statement->data.assignmentName, NULL) = value;
+                break;
+            }
+            case NODE_RETURN: {
+                interp->returnValue = interpEvalExpr(interp, statement->data.returnExpr, scopeId);
+                interp->blocksLength = base;
+                return EXEC_RETURN;
+            }
+            case NODE_SCOPE: {
+                interpEnterScope(interp, statement, NULL);
+                break;
+            }
+            case NODE_IF: {
+                if (interpEvalExpr(interp, statement->data.controlCondition, scopeId)) {
+                    interpEnterScope(interp, statement->data.controlScope, NULL);
+                }
+                else {
+                    interp->blocks[top].runElse = true;
+                }
+                break;
+            }
+            case NODE_ELSE: {
+                if (runElse) {
+                    interpEnterScope(interp, statement->data.elseScope, NULL);
+                }
+                break;
+            }
+            case NODE_WHILE: {
+                if (interpEvalExpr(interp, statement->data.controlCondition, scopeId)) {
+                    interpEnterScope(interp, statement->data.controlScope, statement);
+                }
+                break;
+            }
+            default:
+                printf("Unexpected node type: %d\n", statement->type);
+                assert(false && "Not a statement type or non-exhaustive cases (interpExecBody)");
+        }
+    }
+    return EXEC_NORMAL;
+}
+
+// Runs `function` with `args` bound to its parameters, in order. `args` may be NULL if there are no parameters.
+Value interpRunFunction(Interpreter* interp, AST_Node* function, Value* args) {
+    assert(function->type == NODE_FUNCTION);
+    AST_Node* body = function->data.functionBody;
+
+    interpPushFrame(interp, function->data.functionFrameSize);
+    // Parameters only get symbols if the body isn't empty, and nothing could read them otherwise.
+    if (body->data.scopeStatements != NULL) {
+        int i = 0;
+        for (AST_Node* param = function->data.functionArgs; param != NULL; param = param->data.argNext) {
+            *interpLookupSlot(interp, body->data.scopeId, param->data.argName, NULL) = args[i++];
+        }
+    }
+
+    interp->returnValue = 0;
+    interpExecBody(interp, body);
+    interpPopFrame(interp);
+    return interp->returnValue;
+}
+
+// Runs the `main` function of `program` and returns its result as a process exit code.
+int interpretProgram(Symbol_Table* table, Program program) {
+    AST_Node* mainFunction = NULL;
+    for (int i = 0; i < program.length; ++i) {
+        if (svEqualsCStr(program.nodes[i]->data.functionName, "main")) {
+            mainFunction = program.nodes[i];
+            break;
+        }
+    }
+    if (mainFunction == NULL) {
+        fprintf(stderr, "ERROR! Program has no \"main\" function to run\n");
+        return 1;
+    }
+    if (mainFunction->data.functionArgs != NULL) {
+        fprintf(stderr, "ERROR! The \"main\" function cannot take arguments\n");
+        return 1;
+    }
+
+    Interpreter interp = makeInterpreter(table, program);
+    Value result = interpRunFunction(&interp, mainFunction, NULL);
+    freeInterpreter(&interp);
+    return mainFunction->data.functionRetType.id == TYPE_UNIT ? 0 : (int)result;
+}
+
+
+
+//////////////////
+// Bytecode API //
+//////////////////
+
+// A compact register-based bytecode compiled from a checked `Program`.
+// Each function gets a flat register frame. Locals occupy the low registers, in the slots the symbol table gave them,
+// and expression temporaries are allocated above them. Parameters take the first slots of a function, so a call passes
+// its arguments in the callee's first registers. Once a function is compiled, registers are reallocated so that
+// values that are never live at the same time share them.
+
+typedef enum {
+    OP_LOADK,         // R[a] = K[bx]
+    OP_MOVE,          // R[a] = R[b]
+    OP_CLEAR,         // R[a .. a + bx) = 0
+    OP_ADD,           // R[a] = R[b] + R[c]
+    OP_SUB,           // R[a] = R[b] - R[c]
+    OP_MUL,           // R[a] = R[b] * R[c]
+    OP_DIV,           // R[a] = R[b] / R[c]
+    OP_DIVU,          // R[a] = R[b] / R[c], dividing as unsigned
+    OP_SEXT,          // R[a] = R[b] << c >> c, shifting right arithmetically
+    OP_ZEXT,          // R[a] = R[b] << c >> c, shifting right logically
+    OP_SHL,           // R[a] = R[b] << c
+    OP_DIVK,          // R[a] = R[b] / d, where K[c] packs the division magic for d
+    OP_EQ,            // R[a] = R[b] == R[c]
+    OP_BOUNDS,        // Raises an error unless 0 <= R[a] < bx
+    OP_INDEX,         // R[a] = R[b + R[c]]
+    OP_JUMP,          // pc = bx
+    OP_JUMP_IF_FALSE, // if (!R[a]) pc = bx
+    OP_JUMP_IF_TRUE,  // if (R[a]) pc = bx
+    OP_CALL,          // R[a] = F[b](R[a .. a + c))
+    OP_RETURN,        // return R[a]
+    OP_RETURN_UNIT,   // return 0
+
+    OP_COUNT,
+} Opcode;
+
+typedef struct {
+    uint8_t op;
+    uint16_t a;
+    union {
+        struct {
+            uint16_t b;
+            uint16_t c;
+        };
+        int32_t bx;
+    };
+} Instruction;
+
+static_assert(sizeof(Instruction) == 8, "Instructions should stay compact");
+
+typedef struct {
+    String_View name;
+    AST_Node* node;
+
+    Instruction* code;
+    int codeLength;
+    int codeCapacity;
+
+    Value* constants;
+    int constantsLength;
+    int constantsCapacity;
+
+    int localsSize; // Registers taken by arguments and locals before register allocation
+    int frameSize;  // Total registers, including temporaries
+} Bytecode_Function;
+
+typedef struct {
+    Bytecode_Function* functions;
+    int length;
+} Bytecode_Program;
+
+typedef struct {
+    Symbol_Table* table;
+
+    Bytecode_Function* function;
+    int nextTemp;
+
+    Traversal exprs;
+    Traversal statements;
+    int dest;     // Register the expression about to be reached is compiled into
+    int skipElse; // Jump over the `else` that follows the `if` just compiled, or -1
+
+    // Registers of the operands compiled so far, for the operators still waiting on the rest
+    int* operands;
+    int operandsLength;
+    int operandsCapacity;
+} Bytecode_Compiler;
+
+int bcEmit(Bytecode_Function* function, Instruction instruction) {
+    if (function->codeLength == function->codeCapacity) {
+        function->codeCapacity = function->codeCapacity == 0 ? 64 : function->codeCapacity * 2;
+        function->code = realloc(function->code, function->codeCapacity * sizeof(Instruction));
+    }
+    function->code[function->codeLength] = instruction;
+    return function->codeLength++;
+}
+
+inline int bcEmitABC(Bytecode_Function* function, Opcode op, int a, int b, int c) {
+    return bcEmit(function, (Instruction){.op = (uint8_t)op, .a = (uint16_t)a, .b = (uint16_t)b, .c = (uint16_t)c});
+}
+
+inline int bcEmitABx(Bytecode_Function* function, Opcode op, int a, int bx) {
+    return bcEmit(function, (Instruction){.op = (uint8_t)op, .a = (uint16_t)a, .bx = bx});
+}
+
+// Points the jump at `jumpIndex` to the next instruction to be emitted.
+inline void bcPatchJump(Bytecode_Function* function, int jumpIndex) {
+    function->code[jumpIndex].bx = function->codeLength;
+}
+
+int bcAddConstant(Bytecode_Function* function, Value value) {
+    for (int i = 0; i < function->constantsLength; ++i) {
+        if (function->constants[i] == value) {
+            return i;
+        }
+    }
+    if (function->constantsLength == function->constantsCapacity) {
+        function->constantsCapacity = function->constantsCapacity == 0 ? 16 : function->constantsCapacity * 2;
+        function->constants = realloc(function->constants, function->constantsCapacity * sizeof(Value));
+    }
+    function->constants[function->constantsLength] = value;
+    return function->constantsLength++;
+}
+
+int bcAllocTemp(Bytecode_Compiler* compiler) {
+    int reg = compiler->nextTemp++;
+    if (compiler->nextTemp > compiler->function->frameSize) {
+        compiler->function->frameSize = compiler->nextTemp;
+    }
+    if (reg > UINT16_MAX) {
+        fprintf(stderr, "ERROR! Function \""SV_FMT"\" needs more than %d registers\n", SV_ARG(compiler->function->name), UINT16_MAX);
+        exit(1);
+    }
+    return reg;
+}
+
+int bcSymbolRegister(Bytecode_Compiler* compiler, int scopeId, String_View name, Type* type) {
+    int index = tableLookupSymbolIndex(compiler->table, scopeId, name);
+    assert(index >= 0);
+    if (type != NULL) {
+        *type = compiler->table->symbolTypes[index];
+    }
+    return compiler->table->symbolSlots[index];
+}
+
+void bcCompileExprInto(Bytecode_Compiler* compiler, AST_Node* root, int scopeId, int dest);
+
+// Compiles `root` and returns the register holding its value. Variables are used in place rather than copied.
+int bcCompileExpr(Bytecode_Compiler* compiler, AST_Node* root, int scopeId) {
+    if (root->type == NODE_IDENT) {
+        return bcSymbolRegister(compiler, scopeId, root->data.identName, NULL);
+    }
+    int dest = bcAllocTemp(compiler);
+    bcCompileExprInto(compiler, root, scopeId, dest);
+    return dest;
+}
+
+void bcPushOperand(Bytecode_Compiler* compiler, int reg) {
+    if (compiler->operandsLength == compiler->operandsCapacity) {
+        compiler->operandsCapacity = compiler->operandsCapacity == 0 ? 64 : compiler->operandsCapacity * 2;
+        compiler->operands = realloc(compiler->operands, compiler->operandsCapacity * sizeof(int));
+    }
+    compiler->operands[compiler->operandsLength++] = reg;
+}
+
+inline int bcPopOperand(Bytecode_Compiler* compiler) {
+    assert(compiler->operandsLength > 0);
+    return compiler->operands[--compiler->operandsLength];
+}
+
+// Expressions are compiled by a traversal. Each frame's `mark` is the register its node is compiled into, which the
+// parent hands over in `compiler->dest`. Leaves are compiled as soon as they're reached.
+bool bcCompileNode(Traversal* traversal, AST_Node* node) {
+    Bytecode_Compiler* compiler = traversal->context;
+    Bytecode_Function* function = compiler->function;
+    Traversal_Frame* frame = traversalFrame(traversal);
+    int dest = compiler->dest;
+    frame->mark = dest;
+
+    switch (node->type) {
         case NODE_INT: {
-            return makeType(TYPE_INT);
+            bcEmitABx(function, OP_LOADK, dest, bcAddConstant(function, node->data.intValue));
+            return false;
+        }
+        case NODE_BOOL: {
+            bcEmitABx(function, OP_LOADK, dest, bcAddConstant(function, node->data.boolValue));
+            return false;
+        }
+        case NODE_IDENT: {
+            int src = bcSymbolRegister(compiler, frame->scopeId, node->data.identName, NULL);
+            if (src != dest) {
+                bcEmitABC(function, OP_MOVE, dest, src, 0);
+            }
+            return false;
+        }
+        case NODE_CALL: {
+            // Every argument register is taken before any argument is compiled, so that temporaries used to compute
+            // one argument can't land between them. The result comes back in the first one.
+            int argCount = 0;
+            for (AST_Node* arg = node->data.callArgs; arg != NULL; arg = arg->data.callArgNext) {
+                argCount++;
+            }
+            int first = compiler->nextTemp;
+            for (int i = 0; i < (argCount > 0 ? argCount : 1); ++i) {
+                bcAllocTemp(compiler);
+            }
+            bcPushOperand(compiler, first);
+            return true;
+        }
+        default:
+            return true;
+    }
+}
+
+// Variables are read in place. When the operator's result goes to a temporary, its first operand is computed right
+// there, so long chains like `a + b + c + ...` don't take a register per term. Other operands get a temporary of their
+// own.
+bool bcCompileOperand(Traversal* traversal, AST_Node* node, AST_Node* child, int index) {
+    (void)node;
+    Bytecode_Compiler* compiler = traversal->context;
+    Traversal_Frame* frame = traversalFrame(traversal);
+    if (child->type == NODE_IDENT) {
+        bcPushOperand(compiler, bcSymbolRegister(compiler, frame->scopeId, child->data.identName, NULL));
+        return false;
+    }
+    int reg = index == 0 && frame->mark >= compiler->function->localsSize ? frame->mark : bcAllocTemp(compiler);
+    bcPushOperand(compiler, reg);
+    compiler->dest = reg;
+    return true;
+}
+
+// Gives back the temporaries taken from `reg` on, once an operator has read its operand from `reg`. Temporaries are
+// taken in order, so everything the operand needed was taken after it.
+inline void bcReleaseOperand(Bytecode_Compiler* compiler, int reg, int dest) {
+    if (reg >= compiler->function->localsSize && reg != dest && reg < compiler->nextTemp) {
+        compiler->nextTemp = reg;
+    }
+}
+
+bool bcCompileArgument(Traversal* traversal, AST_Node* node, AST_Node* child, int index) {
+    (void)node;
+    (void)child;
+    Bytecode_Compiler* compiler = traversal->context;
+    compiler->dest = compiler->operands[compiler->operandsLength - 1] + index;
+    return true;
+}
+
+bool bcCompileConverted(Traversal* traversal, AST_Node* node, AST_Node* child, int index) {
+    (void)node;
+    (void)child;
+    (void)index;
+    // Registers hold every integer type sign or zero extended, so widening doesn't change them.
+    Bytecode_Compiler* compiler = traversal->context;
+    compiler->dest = traversalFrame(traversal)->mark;
+    return true;
+}
+
+void bcCompileArrayAccess(Traversal* traversal, AST_Node* node) {
+    Bytecode_Compiler* compiler = traversal->context;
+    Traversal_Frame* frame = traversalFrame(traversal);
+    Type type;
+    int base = bcSymbolRegister(compiler, frame->scopeId, node->data.accessArrayName, &type);
+    int index = bcPopOperand(compiler);
+    bcEmitABx(compiler->function, OP_BOUNDS, index, type.size);
+    bcEmitABC(compiler->function, OP_INDEX, frame->mark, base, index);
+    bcReleaseOperand(compiler, index, frame->mark);
+}
+
+void bcCompileBinaryOp(Traversal* traversal, AST_Node* node) {
+    Bytecode_Compiler* compiler = traversal->context;
+    Bytecode_Function* function = compiler->function;
+    int dest = traversalFrame(traversal)->mark;
+    int right = bcPopOperand(compiler);
+    int left = bcPopOperand(compiler);
+    Opcode op;
+    switch (node->type) {
+        case NODE_PLUS:   op = OP_ADD; break;
+        case NODE_MINUS:  op = OP_SUB; break;
+        case NODE_TIMES:  op = OP_MUL; break;
+        case NODE_DIVIDE: op = node->data.binaryOpType == TYPE_U64 ? OP_DIVU : OP_DIV; break;
+        default:          op = OP_EQ;  break;
+    }
+    static_assert(NUM_BINOP_NODES == 5, "Non-exhaustive cases (bcCompileBinaryOp)");
+    bcEmitABC(function, op, dest, left, right);
+    // Narrow types wrap around at their width.
+    Type_Id type = node->data.binaryOpType;
+    if (op != OP_EQ && isNarrowType(type)) {
+        bcEmitABC(function, integerTypes[type].isSigned ? OP_SEXT : OP_ZEXT, dest, dest, 64 - integerTypes[type].bits);
+    }
+    bcReleaseOperand(compiler, right, dest);
+    bcReleaseOperand(compiler, left, dest);
+}
+
+void bcCompileShiftLeft(Traversal* traversal, AST_Node* node) {
+    Bytecode_Compiler* compiler = traversal->context;
+    int dest = traversalFrame(traversal)->mark;
+    int value = bcPopOperand(compiler);
+    bcEmitABC(compiler->function, OP_SHL, dest, value, node->data.shiftAmount);
+    bcReleaseOperand(compiler, value, dest);
+}
+
+void bcCompileDivideConstant(Traversal* traversal, AST_Node* node) {
+    Bytecode_Compiler* compiler = traversal->context;
+    Bytecode_Function* function = compiler->function;
+    int dividend = bcPopOperand(compiler);
+    int constant = bcAddConstant(function, packDivisionMagic(node->data.divideMagic));
+    if (constant > UINT16_MAX) {
+        fprintf(stderr, "ERROR! Function \""SV_FMT"\" divides by more than %d different constants\n", SV_ARG(function->name), UINT16_MAX + 1);
+        exit(1);
+    }
+    int dest = traversalFrame(traversal)->mark;
+    bcEmitABC(function, OP_DIVK, dest, dividend, constant);
+    bcReleaseOperand(compiler, dividend, dest);
+}
+
+void bcCompileCall(Traversal* traversal, AST_Node* node) {
+    Bytecode_Compiler* compiler = traversal->context;
+    Bytecode_Function* function = compiler->function;
+    int dest = traversalFrame(traversal)->mark;
+    int first = bcPopOperand(compiler);
+
+    Function_Entry* entry = tableLookupFunction(compiler->table, node->data.callName);
+    assert(entry != NULL);
+    int argCount = 0;
+    for (AST_Node* arg = node->data.callArgs; arg != NULL; arg = arg->data.callArgNext) {
+        argCount++;
+    }
+    if (entry->index > UINT16_MAX) {
+        fprintf(stderr, "ERROR! Programs with more than %d functions can't be compiled to bytecode\n", UINT16_MAX + 1);
+        exit(1);
+    }
+    bcEmitABC(function, OP_CALL, first, entry->index, argCount);
+    if (dest != first) {
+        bcEmitABC(function, OP_MOVE, dest, first, 0);
+    }
+    bcReleaseOperand(compiler, first, dest);
+}
+
+void bcCompileExprInto(Bytecode_Compiler* compiler, AST_Node* root, int scopeId, int dest) {
+    compiler->dest = dest;
+    traverse(&compiler->exprs, root, scopeId);
+    assert(compiler->operandsLength == 0);
+}
+
+// Statements are compiled by a second traversal, whose hooks compile the expressions in them with the first. Each
+// frame's `mark` is the jump its node has to patch once its body is compiled.
+bool bcCompileStatement(Traversal* traversal, AST_Node* statement) {
+    Bytecode_Compiler* compiler = traversal->context;
+    Bytecode_Function* function = compiler->function;
+    Traversal_Frame* frame = traversalFrame(traversal);
+    int scopeId = frame->scopeId;
+    // Temporaries never live across statements.
+    compiler->nextTemp = function->localsSize;
+
+    switch (statement->type) {
+        case NODE_DECLARATION: {
+            Type type;
+            int reg = bcSymbolRegister(compiler, scopeId, statement->data.declarationName, &type);
+            bcEmitABx(function, OP_CLEAR, reg, typeSlotCount(type));
+            return false;
+        }
+        case NODE_ASSIGNMENT: {
+            int dest = bcSymbolRegister(compiler, scopeId, statement->data.assignmentName, NULL);
+            bcCompileExprInto(compiler, statement->data.assignmentExpr, scopeId, dest);
+            return false;
+        }
+        case NODE_RETURN: {
+            bcEmitABC(function, OP_RETURN, bcCompileExpr(compiler, statement->data.returnExpr, scopeId), 0, 0);
+            return false;
+        }
+        case NODE_CALL: {
+            bcCompileExpr(compiler, statement, scopeId);
+            return false;
+        }
+        case NODE_IF: {
+            int condition = bcCompileExpr(compiler, statement->data.controlCondition, scopeId);
+            frame->mark = bcEmitABx(function, OP_JUMP_IF_FALSE, condition, 0);
+            return true;
+        }
+        case NODE_ELSE: {
+            // An `else` is always reached right after the `if` that precedes it, which left its jump behind.
+            assert(compiler->skipElse >= 0 && "Else without a preceding if (bcCompileStatement)");
+            frame->mark = compiler->skipElse;
+            compiler->skipElse = -1;
+            return true;
+        }
+        case NODE_WHILE: {
+            // The condition is placed after the body so that each iteration only takes one branch.
+            frame->mark = bcEmitABx(function, OP_JUMP, 0, 0);
+            return true;
+        }
+        default:
+            printf("Unexpected node type: %d\n", statement->type);
+            assert(false && "Not a statement type or non-exhaustive cases (bcCompileStatement)");
+            return false;
+    }
+}
+
+void bcCompileIf(Traversal* traversal, AST_Node* node) {
+    (void)node;
+    Bytecode_Compiler* compiler = traversal->context;
+    Bytecode_Function* function = compiler->function;
+    AST_Node* next = traversalNextStatement(traversal);
+    if (next != NULL && next->type == NODE_ELSE) {
+        compiler->skipElse = bcEmitABx(function, OP_JUMP, 0, 0);
+    }
+    bcPatchJump(function, traversalFrame(traversal)->mark);
+}
+
+void bcCompileElse(Traversal* traversal, AST_Node* node) {
+    (void)node;
+    Bytecode_Compiler* compiler = traversal->context;
+    bcPatchJump(compiler->function, traversalFrame(traversal)->mark);
+}
+
+void bcCompileWhile(Traversal* traversal, AST_Node* node) {
+    Bytecode_Compiler* compiler = traversal->context;
+    Bytecode_Function* function = compiler->function;
+    Traversal_Frame* frame = traversalFrame(traversal);
+    int toCondition = frame->mark;
+    bcPatchJump(function, toCondition);
+    compiler->nextTemp = function->localsSize;
+    int condition = bcCompileExpr(compiler, node->data.controlCondition, frame->scopeId);
+    bcEmitABx(function, OP_JUMP_IF_TRUE, condition, toCondition + 1);
+}
+
+// A group of contiguous registers that are allocated together: a local (all of an array's elements), a temporary, or
+// the arguments and result of a call.
+typedef struct {
+    int start;    // Live range in half steps: instruction i reads at 2i and writes at 2i + 1
+    int end;
+    int width;    // 0 once merged into another unit
+    int fixed;    // Register the unit has to start at, or -1
+    int assigned;
+} Live_Unit;
+
+// A register's contents between one write and the next: part of a unit, at some offset.
+typedef struct {
+    int unit;
+    int offset;
+} Live_Value;
+
+typedef struct {
+    Live_Unit* units;
+    int unitsLength;
+    int unitsCapacity;
+
+    Live_Value* values;
+    int valuesLength;
+    int valuesCapacity;
+} Register_Allocator;
+
+int raAddUnit(Register_Allocator* ra, int width, int fixed) {
+    if (ra->unitsLength == ra->unitsCapacity) {
+        ra->unitsCapacity = ra->unitsCapacity == 0 ? 64 : ra->unitsCapacity * 2;
+        ra->units = realloc(ra->units, ra->unitsCapacity * sizeof(Live_Unit));
+    }
+    ra->units[ra->unitsLength] = (Live_Unit){.start = INT_MAX, .end = -1, .width = width, .fixed = fixed, .assigned = -1};
+    return ra->unitsLength++;
+}
+
+// Adds a value that starts a unit of its own.
+int raAddValue(Register_Allocator* ra, int width, int fixed) {
+    if (ra->valuesLength == ra->valuesCapacity) {
+        ra->valuesCapacity = ra->valuesCapacity == 0 ? 64 : ra->valuesCapacity * 2;
+        ra->values = realloc(ra->values, ra->valuesCapacity * sizeof(Live_Value));
+    }
+    ra->values[ra->valuesLength] = (Live_Value){raAddUnit(ra, width, fixed), 0};
+    return ra->valuesLength++;
+}
+
+// Adds a value that lives at `offset` in the existing unit `unit`.
+int raAddValueAt(Register_Allocator* ra, int unit, int offset) {
+    if (ra->valuesLength == ra->valuesCapacity) {
+        ra->valuesCapacity = ra->valuesCapacity == 0 ? 64 : ra->valuesCapacity * 2;
+        ra->values = realloc(ra->values, ra->valuesCapacity * sizeof(Live_Value));
+    }
+    ra->values[ra->valuesLength] = (Live_Value){unit, offset};
+    return ra->valuesLength++;
+}
+
+inline void raTouch(Register_Allocator* ra, int value, int position) {
+    Live_Unit* unit = &ra->units[ra->values[value].unit];
+    if (position < unit->start) {
+        unit->start = position;
+    }
+    if (position > unit->end) {
+        unit->end = position;
+    }
+}
+
+// Which operands of an instruction are registers that it reads or writes. Only `a` is ever written, along with the `bx - 1`
+// registers after it for clears.
+typedef struct {
+    bool readsA;
+    bool readsB;
+    bool readsC;
+    bool writesA;
+} Instruction_Operands;
+
+// Calls read their arguments and write their result in a block starting at `a`, which is only listed by its first
+// register.
+Instruction_Operands bcOperands(Instruction ins) {
+    switch ((Opcode)ins.op) {
+        case OP_LOADK:
+        case OP_CLEAR:
+            return (Instruction_Operands){.writesA = true};
+        case OP_MOVE:
+        case OP_SEXT:
+        case OP_ZEXT:
+        case OP_SHL:
+        case OP_DIVK:
+            return (Instruction_Operands){.readsB = true, .writesA = true};
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+        case OP_DIV:
+        case OP_DIVU:
+        case OP_EQ:
+        case OP_INDEX:
+            return (Instruction_Operands){.readsB = true, .readsC = true, .writesA = true};
+        case OP_BOUNDS:
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+        case OP_RETURN:
+            return (Instruction_Operands){.readsA = true};
+        case OP_CALL:
+            return (Instruction_Operands){.readsA = ins.c > 0, .writesA = true};
+        case OP_JUMP:
+        case OP_RETURN_UNIT:
+            return (Instruction_Operands){0};
+        default:
+            assert(false && "Unknown opcode (bcOperands)");
+            return (Instruction_Operands){0};
+    }
+    static_assert(OP_COUNT == 21, "Non-exhaustive cases (bcOperands)");
+}
+
+inline bool bitsetGet(uint64_t* set, int i) {
+    return (set[i / 64] >> (i % 64)) & 1;
+}
+
+inline void bitsetSet(uint64_t* set, int i) {
+    set[i / 64] |= (uint64_t)1 << (i % 64);
+}
+
+// Extends the live ranges of the locals with liveness analysis over the function's basic blocks, so that a local read
+// on a later iteration of a loop stays live across the jump back. `localValues` holds the value of each local unit.
+void bcExtendLocalRanges(Bytecode_Function* function, Register_Allocator* ra, int* localValues, int localCount, int* localOfRegister) {
+    int length = function->codeLength;
+    Instruction* code = function->code;
+    if (localCount == 0) {
+        return;
+    }
+
+    // Blocks start at the entry, at jump targets and after jumps and returns.
+    bool* leaders = calloc(length + 1, sizeof(bool));
+    leaders[0] = true;
+    for (int i = 0; i < length; ++i) {
+        Opcode op = code[i].op;
+        if (op == OP_JUMP || op == OP_JUMP_IF_FALSE || op == OP_JUMP_IF_TRUE) {
+            leaders[code[i].bx] = true;
+        }
+        if (op == OP_JUMP || op == OP_JUMP_IF_FALSE || op == OP_JUMP_IF_TRUE || op == OP_RETURN || op == OP_RETURN_UNIT) {
+            leaders[i + 1] = true;
+        }
+    }
+    int* blockOf = malloc((length + 1) * sizeof(int));
+    int* blockStarts = malloc((length + 1) * sizeof(int));
+    int blockCount = 0;
+    for (int i = 0; i < length; ++i) {
+        if (leaders[i]) {
+            blockStarts[blockCount++] = i;
+        }
+        blockOf[i] = blockCount - 1;
+    }
+    blockStarts[blockCount] = length;
+
+    int words = (localCount + 63) / 64;
+    uint64_t* gen = calloc((size_t)blockCount * words, sizeof(uint64_t));
+    uint64_t* kill = calloc((size_t)blockCount * words, sizeof(uint64_t));
+    uint64_t* liveIn = calloc((size_t)blockCount * words, sizeof(uint64_t));
+    uint64_t* liveOut = calloc((size_t)blockCount * words, sizeof(uint64_t));
+
+    for (int b = 0; b < blockCount; ++b) {
+        for (int i = blockStarts[b]; i < blockStarts[b + 1]; ++i) {
+            Instruction ins = code[i];
+            Instruction_Operands operands = bcOperands(ins);
+            int reads[3] = {operands.readsA ? ins.a : -1, operands.readsB ? ins.b : -1, operands.readsC ? ins.c : -1};
+            for (int k = 0; k < 3; ++k) {
+                int local = reads[k] >= 0 && reads[k] < function->localsSize ? localOfRegister[reads[k]] : -1;
+                if (local >= 0 && !bitsetGet(&kill[b * words], local)) {
+                    bitsetSet(&gen[b * words], local);
+                }
+            }
+            // Only a write to the whole of a local kills it. Arrays are only written whole by clearing, and blocks holding
+            // the locals of sibling scopes are written a register at a time, so they stay live.
+            int local = operands.writesA && ins.a < function->localsSize ? localOfRegister[ins.a] : -1;
+            int written = ins.op == OP_CLEAR ? ins.bx : 1;
+            if (local >= 0 && written == ra->units[ra->values[localValues[local]].unit].width) {
+                bitsetSet(&kill[b * words], local);
+            }
+        }
+    }
+
+    // Iterating backwards over the blocks converges quickly, since most edges go forwards.
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int b = blockCount - 1; b >= 0; --b) {
+            uint64_t* out = &liveOut[b * words];
+            Instruction last = code[blockStarts[b + 1] - 1];
+            Opcode op = last.op;
+            bool fallsThrough = op != OP_JUMP && op != OP_RETURN && op != OP_RETURN_UNIT && b + 1 < blockCount;
+            bool jumps = op == OP_JUMP || op == OP_JUMP_IF_FALSE || op == OP_JUMP_IF_TRUE;
+            for (int w = 0; w < words; ++w) {
+                uint64_t value = 0;
+                if (fallsThrough) {
+                    value |= liveIn[(b + 1) * words + w];
+                }
+                if (jumps && last.bx < length) {
+                    value |= liveIn[blockOf[last.bx] * words + w];
+                }
+                out[w] = value;
+
+                uint64_t in = gen[b * words + w] | (value & ~kill[b * words + w]);
+                if (in != liveIn[b * words + w]) {
+                    liveIn[b * words + w] = in;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    for (int b = 0; b < blockCount; ++b) {
+        for (int local = 0; local < localCount; ++local) {
+            if (bitsetGet(&liveIn[b * words], local)) {
+                raTouch(ra, localValues[local], 2 * blockStarts[b]);
+            }
+            if (bitsetGet(&liveOut[b * words], local)) {
+                raTouch(ra, localValues[local], 2 * (blockStarts[b + 1] - 1) + 1);
+            }
+        }
+    }
+
+    free(leaders);
+    free(blockOf);
+    free(blockStarts);
+    free(gen);
+    free(kill);
+    free(liveIn);
+    free(liveOut);
+}
+
+// Removes the moves that register allocation turned into no-ops, such as a call result that now comes back in the
+// register it was being moved to.
+void bcRemoveSelfMoves(Bytecode_Function* function) {
+    int* newIndex = malloc((function->codeLength + 1) * sizeof(int));
+    int length = 0;
+    for (int i = 0; i < function->codeLength; ++i) {
+        newIndex[i] = length;
+        Instruction ins = function->code[i];
+        if (ins.op != OP_MOVE || ins.a != ins.b) {
+            function->code[length++] = ins;
+        }
+    }
+    newIndex[function->codeLength] = length;
+
+    for (int i = 0; i < length; ++i) {
+        Opcode op = function->code[i].op;
+        if (op == OP_JUMP || op == OP_JUMP_IF_FALSE || op == OP_JUMP_IF_TRUE) {
+            function->code[i].bx = newIndex[function->code[i].bx];
+        }
+    }
+    function->codeLength = length;
+    free(newIndex);
+}
+
+typedef struct {
+    int start;
+    int fixed; // Whether the unit has a fixed register, which has to be handed out first
+    int unit;
+} Unit_Order;
+
+int compareUnitOrder(const void* a, const void* b) {
+    const Unit_Order* left = a;
+    const Unit_Order* right = b;
+    if (left->start != right->start) {
+        return left->start < right->start ? -1 : 1;
+    }
+    if (left->fixed != right->fixed) {
+        return right->fixed - left->fixed;
+    }
+    return left->unit - right->unit;
+}
+
+// Renumbers the registers of `function` so that values whose live ranges don't overlap share registers.
+// `blockWidths` gives the width of the block of locals starting at each register below `localsSize`, or 0 for registers
+// inside a block. A block is a single variable, an array, or the overlapping locals of sibling scopes, and is kept
+// together. The first `paramCount` registers hold the arguments, so they keep their numbers.
+void bcAllocateRegisters(Bytecode_Function* function, int* blockWidths, int paramCount) {
+    int length = function->codeLength;
+    Instruction* code = function->code;
+    Register_Allocator ra = {0};
+
+    int* localOfRegister = malloc((function->localsSize + 1) * sizeof(int));
+    int* localValues = malloc((function->localsSize + 1) * sizeof(int));
+    int* registerValues = malloc((function->localsSize + 1) * sizeof(int)); // Value of each register in its block
+    int localCount = 0;
+    for (int r = 0; r < function->localsSize; ++r) {
+        localOfRegister[r] = -1;
+        registerValues[r] = -1;
+    }
+    // Every register of a block is a value in the block's one unit, so the whole block is assigned a single base.
+    for (int r = 0; r < function->localsSize; r += blockWidths[r] > 0 ? blockWidths[r] : 1) {
+        if (blockWidths[r] > 0) {
+            int value = raAddValue(&ra, blockWidths[r], r < paramCount ? r : -1);
+            for (int k = 0; k < blockWidths[r]; ++k) {
+                localOfRegister[r + k] = localCount;
+                registerValues[r + k] = k == 0 ? value : raAddValueAt(&ra, ra.values[value].unit, k);
+            }
+            localValues[localCount++] = value;
+        }
+    }
+    // Arguments are written by the caller before the first instruction.
+    for (int local = 0; local < paramCount && local < localCount; ++local) {
+        raTouch(&ra, localValues[local], 0);
+    }
+
+    // Temporaries are only live within a statement, so every write to one starts a new value that the reads after it
+    // refer to. Locals keep a single value, whose range is extended by the liveness analysis below.
+    int temps = function->frameSize - function->localsSize;
+    int* tempValues = malloc((temps + 1) * sizeof(int));
+    int* operandValues = malloc(((size_t)length * 3 + 1) * sizeof(int)); // Value of a, b and c for each instruction
+    for (int i = 0; i < length; ++i) {
+        Instruction ins = code[i];
+        Instruction_Operands operands = bcOperands(ins);
+        int* values = &operandValues[i * 3];
+        values[0] = values[1] = values[2] = -1;
+
+        int reads[3] = {operands.readsA ? ins.a : -1, operands.readsB ? ins.b : -1, operands.readsC ? ins.c : -1};
+        for (int k = 0; k < 3; ++k) {
+            int r = reads[k];
+            if (r >= 0) {
+                values[k] = r < function->localsSize ? registerValues[r] : tempValues[r - function->localsSize];
+                raTouch(&ra, values[k], 2 * i);
+            }
+        }
+
+        if (ins.op == OP_CALL) {
+            // The arguments and the result share a block, so they are merged into one unit.
+            int block = raAddUnit(&ra, ins.c > 0 ? ins.c : 1, -1);
+            for (int k = 0; k < ins.c; ++k) {
+                Live_Value* arg = &ra.values[tempValues[ins.a + k - function->localsSize]];
+                Live_Unit* argUnit = &ra.units[arg->unit];
+                raTouch(&ra, tempValues[ins.a + k - function->localsSize], 2 * i);
+                Live_Unit* unit = &ra.units[block];
+                unit->start = argUnit->start < unit->start ? argUnit->start : unit->start;
+                unit->end = argUnit->end > unit->end ? argUnit->end : unit->end;
+                argUnit->width = 0;
+                arg->unit = block;
+                arg->offset = k;
+            }
+            int result = raAddValue(&ra, 1, -1);
+            ra.units[ra.values[result].unit].width = 0;
+            ra.values[result].unit = block;
+            tempValues[ins.a - function->localsSize] = result;
+            raTouch(&ra, result, 2 * i + 1);
+            values[0] = result;
+            continue;
+        }
+
+        if (operands.writesA) {
+            int value;
+            if (ins.a < function->localsSize) {
+                // A clear writes `bx` registers from `a` on, which all have to be free at that point too.
+                value = registerValues[ins.a];
+                int written = ins.op == OP_CLEAR ? ins.bx : 1;
+                for (int k = 1; k < written; ++k) {
+                    assert(ins.a + k < function->localsSize && ra.values[registerValues[ins.a + k]].unit == ra.values[value].unit);
+                    raTouch(&ra, registerValues[ins.a + k], 2 * i + 1);
+                }
+            }
+            else {
+                value = raAddValue(&ra, 1, -1);
+                tempValues[ins.a - function->localsSize] = value;
+            }
+            raTouch(&ra, value, 2 * i + 1);
+            values[0] = value;
+        }
+    }
+    bcExtendLocalRanges(function, &ra, localValues, localCount, localOfRegister);
+
+    // Linear scan. Every register records the end of the range it holds, and each unit takes the lowest run of
+    // registers that are all free by its start. The VM's registers are memory, so the scan never runs out of them and
+    // nothing needs to be spilled.
+    Unit_Order* order = malloc((ra.unitsLength + 1) * sizeof(Unit_Order));
+    int orderLength = 0;
+    for (int u = 0; u < ra.unitsLength; ++u) {
+        if (ra.units[u].width > 0 && ra.units[u].end >= 0) {
+            order[orderLength++] = (Unit_Order){ra.units[u].start, ra.units[u].fixed >= 0, u};
+        }
+    }
+    qsort(order, orderLength, sizeof(Unit_Order), compareUnitOrder);
+
+    // First fit can fragment the registers, so in the worst case every unit needs registers of its own.
+    int capacity = paramCount + 1;
+    for (int i = 0; i < orderLength; ++i) {
+        capacity += ra.units[order[i].unit].width;
+    }
+    int* busyUntil = malloc(capacity * sizeof(int));
+    for (int r = 0; r < capacity; ++r) {
+        busyUntil[r] = -1;
+    }
+    int frameSize = paramCount;
+    for (int i = 0; i < orderLength; ++i) {
+        Live_Unit* unit = &ra.units[order[i].unit];
+        int reg = unit->fixed;
+        if (reg < 0) {
+            for (reg = 0;; ++reg) {
+                int run = 0;
+                while (run < unit->width && busyUntil[reg + run] < unit->start) {
+                    run++;
+                }
+                if (run == unit->width) {
+                    break;
+                }
+            }
+        }
+        for (int r = reg; r < reg + unit->width; ++r) {
+            busyUntil[r] = unit->end;
+        }
+        unit->assigned = reg;
+        if (reg + unit->width > frameSize) {
+            frameSize = reg + unit->width;
+        }
+    }
+
+    // The compiler's own numbering is kept in the rare case that first fit does worse.
+    if (frameSize <= function->frameSize) {
+        for (int i = 0; i < length; ++i) {
+            Instruction* ins = &code[i];
+            int* values = &operandValues[i * 3];
+            if (values[0] >= 0) {
+                ins->a = (uint16_t)(ra.units[ra.values[values[0]].unit].assigned + ra.values[values[0]].offset);
+            }
+            if (values[1] >= 0) {
+                ins->b = (uint16_t)(ra.units[ra.values[values[1]].unit].assigned + ra.values[values[1]].offset);
+            }
+            if (values[2] >= 0) {
+                ins->c = (uint16_t)(ra.units[ra.values[values[2]].unit].assigned + ra.values[values[2]].offset);
+            }
+        }
+        function->frameSize = frameSize;
+        bcRemoveSelfMoves(function);
+    }
+
+    free(busyUntil);
+    free(order);
+    free(operandValues);
+    free(tempValues);
+    free(registerValues);
+    free(localValues);
+    free(localOfRegister);
+    free(ra.units);
+    free(ra.values);
+}
+
+Bytecode_Program compileBytecode(Symbol_Table* table, Program program) {
+    Bytecode_Compiler compiler = {
+        .table = table,
+        .exprs = {
+            .pre = {
+                [NODE_INT] = bcCompileNode,
+                [NODE_BOOL] = bcCompileNode,
+                [NODE_IDENT] = bcCompileNode,
+                [NODE_ARRAY_ACCESS] = bcCompileNode,
+                [NODE_PLUS] = bcCompileNode,
+                [NODE_MINUS] = bcCompileNode,
+                [NODE_TIMES] = bcCompileNode,
+                [NODE_DIVIDE] = bcCompileNode,
+                [NODE_IS_EQUAL] = bcCompileNode,
+                [NODE_SHIFT_LEFT] = bcCompileNode,
+                [NODE_DIVIDE_CONSTANT] = bcCompileNode,
+                [NODE_CONVERT] = bcCompileNode,
+                [NODE_CALL] = bcCompileNode,
+            },
+            .child = {
+                [NODE_ARRAY_ACCESS] = bcCompileOperand,
+                [NODE_PLUS] = bcCompileOperand,
+                [NODE_MINUS] = bcCompileOperand,
+                [NODE_TIMES] = bcCompileOperand,
+                [NODE_DIVIDE] = bcCompileOperand,
+                [NODE_IS_EQUAL] = bcCompileOperand,
+                [NODE_SHIFT_LEFT] = bcCompileOperand,
+                [NODE_DIVIDE_CONSTANT] = bcCompileOperand,
+                [NODE_CONVERT] = bcCompileConverted,
+                [NODE_CALL] = bcCompileArgument,
+            },
+            .post = {
+                [NODE_ARRAY_ACCESS] = bcCompileArrayAccess,
+                [NODE_PLUS] = bcCompileBinaryOp,
+                [NODE_MINUS] = bcCompileBinaryOp,
+                [NODE_TIMES] = bcCompileBinaryOp,
+                [NODE_DIVIDE] = bcCompileBinaryOp,
+                [NODE_IS_EQUAL] = bcCompileBinaryOp,
+                [NODE_SHIFT_LEFT] = bcCompileShiftLeft,
+                [NODE_DIVIDE_CONSTANT] = bcCompileDivideConstant,
+                [NODE_CALL] = bcCompileCall,
+            },
+        },
+        .statements = {
+            .pre = {
+                [NODE_DECLARATION] = bcCompileStatement,
+                [NODE_ASSIGNMENT] = bcCompileStatement,
+                [NODE_RETURN] = bcCompileStatement,
+                [NODE_CALL] = bcCompileStatement,
+                [NODE_IF] = bcCompileStatement,
+                [NODE_ELSE] = bcCompileStatement,
+                [NODE_WHILE] = bcCompileStatement,
+            },
+            .child = {
+                [NODE_IF] = traversalSkipCondition,
+                [NODE_WHILE] = traversalSkipCondition,
+            },
+            .post = {
+                [NODE_IF] = bcCompileIf,
+                [NODE_ELSE] = bcCompileElse,
+                [NODE_WHILE] = bcCompileWhile,
+            },
+        },
+        .skipElse = -1,
+    };
+    compiler.exprs.context = &compiler;
+    compiler.statements.context = &compiler;
+
+    Bytecode_Program result = {
+        .functions = calloc(program.length + 1, sizeof(Bytecode_Function)),
+        .length = program.length,
+    };
+    for (int i = 0; i < program.length; ++i) {
+        AST_Node* node = program.nodes[i];
+        Bytecode_Function* function = &result.functions[i];
+        function->name = node->data.functionName;
+        function->node = node;
+        function->localsSize = node->data.functionFrameSize;
+        function->frameSize = function->localsSize;
+
+        compiler.function = function;
+        compiler.nextTemp = function->localsSize;
+        AST_Node* body = node->data.functionBody;
+        traverse(&compiler.statements, body, body->data.scopeId);
+        bcEmitABC(function, OP_RETURN_UNIT, 0, 0, 0);
+
+        // Locals of sibling scopes share slots, so locals that overlap are merged into one block. `ends` holds the end
+        // of the furthest reaching local starting at each register.
+        int* ends = calloc(function->localsSize + 1, sizeof(int));
+        for (int j = node->data.functionSymbolStart; j < node->data.functionSymbolEnd; ++j) {
+            int slot = table->symbolSlots[j];
+            int end = slot + typeSlotCount(table->symbolTypes[j]);
+            assert(end <= function->localsSize);
+            if (end > slot && end > ends[slot]) {
+                ends[slot] = end;
+            }
+        }
+        int* blockWidths = calloc(function->localsSize + 1, sizeof(int));
+        for (int r = 0; r < function->localsSize;) {
+            int start = r;
+            int end = ends[r];
+            for (; r < end; ++r) {
+                end = ends[r] > end ? ends[r] : end;
+            }
+            if (end > start) {
+                blockWidths[start] = end - start;
+            }
+            else {
+                ++r;
+            }
+        }
+        free(ends);
+        int paramCount = 0;
+        for (AST_Node* param = node->data.functionArgs; param != NULL; param = param->data.argNext) {
+            paramCount++;
+        }
+        bcAllocateRegisters(function, blockWidths, paramCount);
+        free(blockWidths);
+    }
+
+    freeTraversal(&compiler.exprs);
+    freeTraversal(&compiler.statements);
+    free(compiler.operands);
+    return result;
+}
+
+void freeBytecodeProgram(Bytecode_Program* program) {
+    for (int i = 0; i < program->length; ++i) {
+        free(program->functions[i].code);
+        free(program->functions[i].constants);
+    }
+    free(program->functions);
+}
+
+char* opcodeName(Opcode op) {
+    switch (op) {
+        case OP_LOADK:         return "LOADK";
+        case OP_MOVE:          return "MOVE";
+        case OP_CLEAR:         return "CLEAR";
+        case OP_ADD:           return "ADD";
+        case OP_SUB:           return "SUB";
+        case OP_MUL:           return "MUL";
+        case OP_DIV:           return "DIV";
+        case OP_DIVU:          return "DIVU";
+        case OP_SEXT:          return "SEXT";
+        case OP_ZEXT:          return "ZEXT";
+        case OP_SHL:           return "SHL";
+        case OP_DIVK:          return "DIVK";
+        case OP_EQ:            return "EQ";
+        case OP_BOUNDS:        return "BOUNDS";
+        case OP_INDEX:         return "INDEX";
+        case OP_JUMP:          return "JUMP";
+        case OP_JUMP_IF_FALSE: return "JUMP_IF_FALSE";
+        case OP_JUMP_IF_TRUE:  return "JUMP_IF_TRUE";
+        case OP_CALL:          return "CALL";
+        case OP_RETURN:        return "RETURN";
+        case OP_RETURN_UNIT:   return "RETURN_UNIT";
+        default:               return "???";
+    }
+    static_assert(OP_COUNT == 21, "Non-exhaustive cases (opcodeName)");
+}
+
+void printBytecode(Bytecode_Program program) {
+    for (int i = 0; i < program.length; ++i) {
+        Bytecode_Function function = program.functions[i];
+        printf("function "SV_FMT" (locals=%d, frame=%d):\n", SV_ARG(function.name), function.localsSize, function.frameSize);
+        for (int pc = 0; pc < function.codeLength; ++pc) {
+            Instruction ins = function.code[pc];
+            printf("  %4d  %-14s a=%d b=%d c=%d bx=%d\n", pc, opcodeName(ins.op), ins.a, ins.b, ins.c, ins.bx);
+        }
+    }
+}
+
+
+
+////////////
+// VM API //
+////////////
+
+// Uses threaded dispatch (computed goto) where the compiler supports it, and falls back to a switch otherwise.
+#if defined(__GNUC__) || defined(__clang__)
+#define VM_THREADED_DISPATCH
+#endif
+
+typedef struct {
+    Bytecode_Program program;
+
+    Value* stack;
+    int stackCapacity;
+} VM;
+
+VM makeVM(Bytecode_Program program) {
+    return (VM){
+        .program = program,
+        .stack = NULL,
+        .stackCapacity = 0,
+    };
+}
+
+void freeVM(VM* vm) {
+    free(vm->stack);
+}
+
+// Makes room for `size` registers on the stack. Pointers into the stack are invalidated.
+void vmReserve(VM* vm, int size) {
+    if (size > vm->stackCapacity) {
+        vm->stackCapacity = vm->stackCapacity * 2 > size ? vm->stackCapacity * 2 : size;
+        vm->stack = realloc(vm->stack, vm->stackCapacity * sizeof(Value));
+    }
+}
+
+// Runs `function` with its frame starting at `stack[base]`. The first `argCount` registers already hold the arguments.
+Value vmRun(VM* vm, Bytecode_Function* function, int base, int argCount) {
+    vmReserve(vm, base + function->frameSize);
+    Value* regs = vm->stack + base;
+    if (function->frameSize > argCount) {
+        memset(&regs[argCount], 0, (function->frameSize - argCount) * sizeof(Value));
+    }
+
+    Value* constants = function->constants;
+    Instruction* code = function->code;
+    Instruction* pc = code;
+
+#ifdef VM_THREADED_DISPATCH
+    static void* dispatchTable[OP_COUNT] = {
+        [OP_LOADK]         = &&OP_LOADK_LABEL,
+        [OP_MOVE]          = &&OP_MOVE_LABEL,
+        [OP_CLEAR]         = &&OP_CLEAR_LABEL,
+        [OP_ADD]           = &&OP_ADD_LABEL,
+        [OP_SUB]           = &&OP_SUB_LABEL,
+        [OP_MUL]           = &&OP_MUL_LABEL,
+        [OP_DIV]           = &&OP_DIV_LABEL,
+        [OP_DIVU]          = &&OP_DIVU_LABEL,
+        [OP_SEXT]          = &&OP_SEXT_LABEL,
+        [OP_ZEXT]          = &&OP_ZEXT_LABEL,
+        [OP_SHL]           = &&OP_SHL_LABEL,
+        [OP_DIVK]          = &&OP_DIVK_LABEL,
+        [OP_EQ]            = &&OP_EQ_LABEL,
+        [OP_BOUNDS]        = &&OP_BOUNDS_LABEL,
+        [OP_INDEX]         = &&OP_INDEX_LABEL,
+        [OP_JUMP]          = &&OP_JUMP_LABEL,
+        [OP_JUMP_IF_FALSE] = &&OP_JUMP_IF_FALSE_LABEL,
+        [OP_JUMP_IF_TRUE]  = &&OP_JUMP_IF_TRUE_LABEL,
+        [OP_CALL]          = &&OP_CALL_LABEL,
+        [OP_RETURN]        = &&OP_RETURN_LABEL,
+        [OP_RETURN_UNIT]   = &&OP_RETURN_UNIT_LABEL,
+    };
+    static_assert(OP_COUNT == 21, "Non-exhaustive cases (vmRun)");
+#define VM_CASE(op) op##_LABEL:
+#define VM_DISPATCH() goto *dispatchTable[pc->op]
+    VM_DISPATCH();
+#else
+#define VM_CASE(op) case op:
+#define VM_DISPATCH() continue
+    for (;;) switch (pc->op) {
+#endif
+
+    VM_CASE(OP_LOADK) {
+        regs[pc->a] = constants[pc->bx];
+        pc++;
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_MOVE) {
+        regs[pc->a] = regs[pc->b];
+        pc++;
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_CLEAR) {
+        memset(&regs[pc->a], 0, pc->bx * sizeof(Value));
+        pc++;
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_ADD) {
+        regs[pc->a] = (Value)((uint64_t)regs[pc->b] + (uint64_t)regs[pc->c]);
+        pc++;
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_SUB) {
+        regs[pc->a] = (Value)((uint64_t)regs[pc->b] - (uint64_t)regs[pc->c]);
+        pc++;
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_MUL) {
+        regs[pc->a] = (Value)((uint64_t)regs[pc->b] * (uint64_t)regs[pc->c]);
+        pc++;
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_DIV) {
+        if (regs[pc->c] == 0) {
+            interpError("Division by zero");
+        }
+        // Like the interpreter, division by -1 is a wrapping negation so that the smallest i64 doesn't trap.
+        regs[pc->a] = regs[pc->c] == -1 ? (Value)(0 - (uint64_t)regs[pc->b]) : regs[pc->b] / regs[pc->c];
+        pc++;
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_DIVU) {
+        if (regs[pc->c] == 0) {
+            interpError("Division by zero");
+        }
+        regs[pc->a] = (Value)((uint64_t)regs[pc->b] / (uint64_t)regs[pc->c]);
+        pc++;
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_SEXT) {
+        regs[pc->a] = (Value)((uint64_t)regs[pc->b] << pc->c) >> pc->c;
+        pc++;
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_ZEXT) {
+        regs[pc->a] = (Value)((uint64_t)regs[pc->b] << pc->c >> pc->c);
+        pc++;
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_SHL) {
+        regs[pc->a] = (Value)((uint64_t)regs[pc->b] << pc->c);
+        pc++;
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_DIVK) {
+        regs[pc->a] = divideByMagic(regs[pc->b], unpackDivisionMagic(constants[pc->c]));
+        pc++;
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_EQ) {
+        regs[pc->a] = regs[pc->b] == regs[pc->c];
+        pc++;
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_BOUNDS) {
+        if (regs[pc->a] < 0 || regs[pc->a] >= pc->bx) {
+            interpError("Index %lld is out of bounds for an array of size %d", regs[pc->a], pc->bx);
+        }
+        pc++;
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_INDEX) {
+        regs[pc->a] = regs[pc->b + regs[pc->c]];
+        pc++;
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_JUMP) {
+        pc = code + pc->bx;
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_JUMP_IF_FALSE) {
+        pc = regs[pc->a] ? pc + 1 : code + pc->bx;
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_JUMP_IF_TRUE) {
+        pc = regs[pc->a] ? code + pc->bx : pc + 1;
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_CALL) {
+        // The callee's frame goes right after this one. Growing the stack can move it, so `regs` is refreshed.
+        Bytecode_Function* callee = &vm->program.functions[pc->b];
+        int calleeBase = base + function->frameSize;
+        vmReserve(vm, calleeBase + (callee->frameSize > pc->c ? callee->frameSize : pc->c));
+        regs = vm->stack + base;
+        memcpy(&vm->stack[calleeBase], &regs[pc->a], pc->c * sizeof(Value));
+        Value result = vmRun(vm, callee, calleeBase, pc->c);
+        regs = vm->stack + base;
+        regs[pc->a] = result;
+        pc++;
+        VM_DISPATCH();
+    }
+    VM_CASE(OP_RETURN) {
+        return regs[pc->a];
+    }
+    VM_CASE(OP_RETURN_UNIT) {
+        return 0;
+    }
+
+#ifndef VM_THREADED_DISPATCH
+    }
+#endif
+#undef VM_CASE
+#undef VM_DISPATCH
+}
+
+// Compiles `program` to bytecode and runs its `main` function, returning the result as a process exit code.
+int runProgramVM(Symbol_Table* table, Program program) {
+    Bytecode_Program bytecode = compileBytecode(table, program);
+
+    Bytecode_Function* mainFunction = NULL;
+    for (int i = 0; i < bytecode.length; ++i) {
+        if (svEqualsCStr(bytecode.functions[i].name, "main")) {
+            mainFunction = &bytecode.functions[i];
+            break;
+        }
+    }
+    if (mainFunction == NULL) {
+        fprintf(stderr, "ERROR! Program has no \"main\" function to run\n");
+        freeBytecodeProgram(&bytecode);
+        return 1;
+    }
+    if (mainFunction->node->data.functionArgs != NULL) {
+        fprintf(stderr, "ERROR! The \"main\" function cannot take arguments\n");
+        freeBytecodeProgram(&bytecode);
+        return 1;
+    }
+
+    VM vm = makeVM(bytecode);
+    Value result = vmRun(&vm, mainFunction, 0, 0);
+    bool returnsUnit = mainFunction->node->data.functionRetType.id == TYPE_UNIT;
+    freeVM(&vm);
+    freeBytecodeProgram(&bytecode);
+    return returnsUnit ? 0 : (int)result;
+}
+
+
+
+///////////////
+// Cache API //
+///////////////
+
+// Caches checked programs on disk, keyed by a hash of the source bytes. A cache file is a pointer-free image of the
+// AST and symbol table: node references are indices, and strings are offsets into the source (whose bytes are known
+// to match on a hit) or into a trailing string section. On a hit the file is mapped and the live structures are rebuilt
+// from it, so lexing, parsing, symbol table construction, verification and type checking are all skipped.
+
+#define CACHE_MAGIC "LCLC"
+#define CACHE_FORMAT_VERSION 6
+
+typedef struct {
+    int32_t offset; // Offset into the source if >= 0, otherwise `-offset - 1` is an offset into the string section.
+    int32_t length;
+} Cached_String;
+
+typedef struct {
+    Cached_String name;
+    int32_t id;
+    int32_t size;
+} Cached_Type;
+
+typedef struct {
+    int32_t type;
+    int32_t children[3]; // Node indices, -1 for NULL
+    Cached_String name;
+    Cached_Type valueType; // For literals, only the ID is used, for the literal's type
+    int64_t value;       // Literal values, scope IDs, and the types of operators and conversions
+} Cached_Node;
+
+typedef struct {
+    int32_t scopeId;
+    Cached_String name;
+    Cached_Type type;
+} Cached_Symbol;
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint64_t sourceHash;
+    uint64_t sourceLength;
+    uint64_t bodyChecksum; // `checksumBytes` of every section after the header, combined in order
+    int32_t nodeCount;
+    int32_t functionCount;
+    int32_t symbolCount;
+    int32_t scopeCount;
+    int32_t stringsLength;
+    int32_t reserved;
+} Cache_Header;
+
+// A node waiting to be written, and the child of an already written node that it is.
+typedef struct {
+    AST_Node* node;
+    int parent; // -1 for the root
+    int child;
+} Cache_Pending;
+
+typedef struct {
+    char* source;
+    size_t sourceLength;
+
+    Cached_Node* nodes;
+    int nodesLength;
+    int nodesCapacity;
+
+    Cache_Pending* pending;
+    int pendingLength;
+    int pendingCapacity;
+
+    char* strings;
+    int stringsLength;
+    int stringsCapacity;
+} Cache_Writer;
+
+Cached_String cacheString(Cache_Writer* writer, String_View sv) {
+    if (sv.start >= writer->source && sv.start + sv.length <= writer->source + writer->sourceLength) {
+        return (Cached_String){(int32_t)(sv.start - writer->source), sv.length};
+    }
+
+    if (writer->stringsLength + sv.length > writer->stringsCapacity) {
+        while (writer->stringsLength + sv.length > writer->stringsCapacity) {
+            writer->stringsCapacity = writer->stringsCapacity == 0 ? 64 : writer->stringsCapacity * 2;
+        }
+        writer->strings = realloc(writer->strings, writer->stringsCapacity);
+    }
+    memcpy(writer->strings + writer->stringsLength, sv.start, sv.length);
+    Cached_String result = {-writer->stringsLength - 1, sv.length};
+    writer->stringsLength += sv.length;
+    return result;
+}
+
+inline Cached_Type cacheType(Cache_Writer* writer, Type type) {
+    return (Cached_Type){cacheString(writer, type.name), type.id, type.size};
+}
+
+int cacheReserveNode(Cache_Writer* writer) {
+    if (writer->nodesLength == writer->nodesCapacity) {
+        writer->nodesCapacity = writer->nodesCapacity == 0 ? 256 : writer->nodesCapacity * 2;
+        writer->nodes = realloc(writer->nodes, writer->nodesCapacity * sizeof(Cached_Node));
+    }
+    return writer->nodesLength++;
+}
+
+void cachePushPending(Cache_Writer* writer, AST_Node* node, int parent, int child) {
+    if (writer->pendingLength == writer->pendingCapacity) {
+        writer->pendingCapacity = writer->pendingCapacity == 0 ? 64 : writer->pendingCapacity * 2;
+        writer->pending = realloc(writer->pending, writer->pendingCapacity * sizeof(Cache_Pending));
+    }
+    writer->pending[writer->pendingLength++] = (Cache_Pending){node, parent, child};
+}
+
+// Writes `root` and everything reachable from it, returning its index. Nodes wait on `writer->pending` rather than
+// being written recursively, so deep trees and long lists can't exhaust the C stack. A node's index is taken when it
+// is written, which is always after its parent's.
+int cacheWriteNode(Cache_Writer* writer, AST_Node* root) {
+    if (root == NULL) {
+        return -1;
+    }
+
+    int rootIndex = writer->nodesLength;
+    cachePushPending(writer, root, -1, 0);
+    while (writer->pendingLength > 0) {
+        Cache_Pending pending = writer->pending[--writer->pendingLength];
+        AST_Node* node = pending.node;
+        int index = cacheReserveNode(writer);
+        if (pending.parent >= 0) {
+            writer->nodes[pending.parent].children[pending.child] = index;
+        }
+
+        Cached_Node cached = {.type = node->type, .children = {-1, -1, -1}};
+        AST_Node* children[3] = {NULL, NULL, NULL};
+        switch (node->type) {
+            case NODE_FUNCTION: {
+                cached.name = cacheString(writer, node->data.functionName);
+                cached.valueType = cacheType(writer, node->data.functionRetType);
+                children[0] = node->data.functionArgs;
+                children[1] = node->data.functionBody;
+                break;
+            }
+            case NODE_ARGS: {
+                cached.name = cacheString(writer, node->data.argName);
+                cached.valueType = cacheType(writer, node->data.argType);
+                children[1] = node->data.argNext;
+                break;
+            }
+            case NODE_STATEMENTS: {
+                children[0] = node->data.statementStatement;
+                children[1] = node->data.statementNext;
+                break;
+            }
+            case NODE_CALL_ARGS: {
+                children[0] = node->data.callArgExpr;
+                children[1] = node->data.callArgNext;
+                break;
+            }
+            case NODE_SCOPE: {
+                cached.value = node->data.scopeId;
+                children[0] = node->data.scopeStatements;
+                break;
+            }
+            case NODE_RETURN: {
+                children[0] = node->data.returnExpr;
+                break;
+            }
+            case NODE_DECLARATION: {
+                cached.name = cacheString(writer, node->data.declarationName);
+                cached.valueType = cacheType(writer, node->data.declarationType);
+                break;
+            }
+            case NODE_ASSIGNMENT: {
+                cached.name = cacheString(writer, node->data.assignmentName);
+                children[0] = node->data.assignmentExpr;
+                break;
+            }
+            case NODE_PLUS:
+            case NODE_MINUS:
+            case NODE_TIMES:
+            case NODE_DIVIDE:
+            case NODE_IS_EQUAL: {
+                children[0] = node->data.binaryOpLeft;
+                children[1] = node->data.binaryOpRight;
+                cached.value = node->data.binaryOpType;
+                break;
+            }
+            case NODE_CONVERT: {
+                children[0] = node->data.convertExpr;
+                cached.value = node->data.convertType;
+                break;
+            }
+            case NODE_ARRAY_ACCESS: {
+                cached.name = cacheString(writer, node->data.accessArrayName);
+                children[0] = node->data.accessIndex;
+                break;
+            }
+            case NODE_CALL: {
+                cached.name = cacheString(writer, node->data.callName);
+                children[0] = node->data.callArgs;
+                break;
+            }
+            case NODE_IF:
+            case NODE_WHILE: {
+                children[0] = node->data.controlCondition;
+                children[1] = node->data.controlScope;
+                break;
+            }
+            case NODE_ELSE: {
+                children[0] = node->data.elseScope;
+                break;
+            }
+            case NODE_IDENT: {
+                cached.name = cacheString(writer, node->data.identName);
+                break;
+            }
+            case NODE_INT: {
+                cached.value = node->data.intValue;
+                cached.valueType.id = node->data.intType;
+                break;
+            }
+            case NODE_BOOL: {
+                cached.value = node->data.boolValue;
+                break;
+            }
+            case NODE_SHIFT_LEFT:
+            case NODE_DIVIDE_CONSTANT: {
+                assert(false && "Programs are cached before they are optimized (cacheWriteNode)");
+                break;
+            }
+        }
+        static_assert(NODE_COUNT == 24, "Non-exhaustive cases (cacheWriteNode)");
+        writer->nodes[index] = cached;
+
+        // Pushed last to first, so the first child is written next. The rest of a list waits under its item, so the
+        // stack only grows with nesting.
+        for (int child = 2; child >= 0; --child) {
+            if (children[child] != NULL) {
+                cachePushPending(writer, children[child], index, child);
+            }
+        }
+    }
+    return rootIndex;
+}
+
+char* makeCachePath(char* cacheDir, uint64_t hash) {
+    size_t length = strlen(cacheDir) + 32;
+    char* path = malloc(length);
+    snprintf(path, length, "%s/%016llx.lclc", cacheDir, (unsigned long long)hash);
+    return path;
+}
+
+void makeDirectory(char* path) {
+#ifdef _WIN32
+    _mkdir(path);
+#else
+    mkdir(path, 0755);
+#endif
+}
+
+// Writes `count` elements of `size` bytes from `data`, which may be NULL when there are none.
+bool writeArray(FILE* file, void* data, size_t size, int count) {
+    return count == 0 || fwrite(data, size, (size_t)count, file) == (size_t)count;
+}
+
+unsigned long currentProcessId(void) {
+#ifdef _WIN32
+    return (unsigned long)GetCurrentProcessId();
+#else
+    return (unsigned long)getpid();
+#endif
+}
+
+uint64_t cacheBodyChecksum(Cache_Header* header, Cached_Node* nodes, int32_t* functions, Cached_Symbol* symbols, int32_t* parents, char* strings) {
+    uint64_t sums[] = {
+        checksumBytes((char*)nodes, (size_t)header->nodeCount * sizeof(Cached_Node)),
+        checksumBytes((char*)functions, (size_t)header->functionCount * sizeof(int32_t)),
+        checksumBytes((char*)symbols, (size_t)header->symbolCount * sizeof(Cached_Symbol)),
+        checksumBytes((char*)parents, (size_t)header->scopeCount * sizeof(int32_t)),
+        checksumBytes(strings, (size_t)header->stringsLength),
+    };
+    return hashBytes((char*)sums, sizeof(sums));
+}
+
+// Writes the checked `program` and `table` to the cache. Failures are ignored, since the cache is only an optimization.
+void storeCachedProgram(char* cacheDir, char* source, Program program, Symbol_Table* table) {
+    size_t sourceLength = strlen(source);
+    Cache_Writer writer = {.source = source, .sourceLength = sourceLength};
+
+    int32_t* functions = malloc((program.length + 1) * sizeof(int32_t));
+    for (int i = 0; i < program.length; ++i) {
+        functions[i] = cacheWriteNode(&writer, program.nodes[i]);
+    }
+
+    Cached_Symbol* symbols = malloc((table->symbolsLength + 1) * sizeof(Cached_Symbol));
+    for (int i = 0; i < table->symbolsLength; ++i) {
+        Symbol_Entry entry = tableSymbol(table, i);
+        symbols[i] = (Cached_Symbol){entry.scopeId, cacheString(&writer, entry.name), cacheType(&writer, entry.type)};
+    }
+
+    // Only the parent of each scope is stored. The symbol slices are rebuilt by adding the symbols in the same order.
+    int32_t* parents = malloc((table->scopesLength + 1) * sizeof(int32_t));
+    for (int i = 0; i < table->scopesLength; ++i) {
+        parents[i] = table->scopes[i].parentId;
+    }
+
+    Cache_Header header = {
+        .magic = CACHE_MAGIC,
+        .version = CACHE_FORMAT_VERSION,
+        .sourceHash = hashBytes(source, sourceLength),
+        .sourceLength = sourceLength,
+        .nodeCount = writer.nodesLength,
+        .functionCount = program.length,
+        .symbolCount = table->symbolsLength,
+        .scopeCount = table->scopesLength,
+        .stringsLength = writer.stringsLength,
+    };
+    header.bodyChecksum = cacheBodyChecksum(&header, writer.nodes, functions, symbols, parents, writer.strings);
+
+    makeDirectory(cacheDir);
+    char* path = makeCachePath(cacheDir, header.sourceHash);
+    // Written under a temporary name and renamed into place, so concurrent compilers never map a partial file.
+    char* tempPath = malloc(strlen(path) + 64);
+    // The process ID tells apart compilers that store the same source at the same time, and the writer's address the
+    // threads of a batch compile that do.
+    sprintf(tempPath, "%s.%lu.%p.tmp", path, currentProcessId(), (void*)&writer);
+    FILE* file = fopen(tempPath, "wb");
+    if (file != NULL) {
+        bool written = writeArray(file, &header, sizeof(header), 1)
+            && writeArray(file, writer.nodes, sizeof(Cached_Node), writer.nodesLength)
+            && writeArray(file, functions, sizeof(int32_t), program.length)
+            && writeArray(file, symbols, sizeof(Cached_Symbol), table->symbolsLength)
+            && writeArray(file, parents, sizeof(int32_t), table->scopesLength)
+            && writeArray(file, writer.strings, 1, writer.stringsLength);
+        written = fclose(file) == 0 && written;
+        if (!written || rename(tempPath, path) != 0) {
+            remove(tempPath);
+        }
+    }
+
+    free(tempPath);
+    free(path);
+    free(parents);
+    free(symbols);
+    free(functions);
+    free(writer.pending);
+    free(writer.nodes);
+    free(writer.strings);
+}
+
+typedef struct {
+    char* data;
+    size_t size;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#endif
+} Mapped_File;
+
+bool mapFile(char* path, Mapped_File* mapped) {
+#ifdef _WIN32
+    mapped->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (mapped->file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(mapped->file, &size) || size.QuadPart == 0) {
+        CloseHandle(mapped->file);
+        return false;
+    }
+    mapped->size = (size_t)size.QuadPart;
+    mapped->mapping = CreateFileMappingA(mapped->file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapped->mapping == NULL) {
+        CloseHandle(mapped->file);
+        return false;
+    }
+    mapped->data = MapViewOfFile(mapped->mapping, FILE_MAP_READ, 0, 0, 0);
+    if (mapped->data == NULL) {
+        CloseHandle(mapped->mapping);
+        CloseHandle(mapped->file);
+        return false;
+    }
+    return true;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    mapped->size = (size_t)info.st_size;
+    mapped->data = mmap(NULL, mapped->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    return mapped->data != MAP_FAILED;
+#endif
+}
+
+void unmapFile(Mapped_File* mapped) {
+#ifdef _WIN32
+    UnmapViewOfFile(mapped->data);
+    CloseHandle(mapped->mapping);
+    CloseHandle(mapped->file);
+#else
+    munmap(mapped->data, mapped->size);
+#endif
+}
+
+inline String_View uncacheString(Cached_String cached, char* source, char* strings) {
+    if (cached.offset >= 0) {
+        return (String_View){source + cached.offset, cached.length};
+    }
+    return (String_View){strings + (-cached.offset - 1), cached.length};
+}
+
+inline Type uncacheType(Cached_Type cached, char* source, char* strings) {
+    return (Type){uncacheString(cached.name, source, strings), cached.id, cached.size};
+}
+
+bool cachedStringIsValid(Cached_String cached, Cache_Header* header) {
+    if (cached.length < 0) {
+        return false;
+    }
+    if (cached.offset >= 0) {
+        return (uint64_t)cached.offset + (uint64_t)cached.length <= header->sourceLength;
+    }
+    return (int64_t)(-(int64_t)cached.offset - 1) + cached.length <= header->stringsLength;
+}
+
+bool cachedTypeIsValid(Cached_Type cached, Cache_Header* header) {
+    return cached.id >= 0 && cached.id <= TYPE_UNKNOWN && cached.size >= -1 && cachedStringIsValid(cached.name, header);
+}
+
+// Checks that every index, type and string in a cache file is in range, so that a damaged file is rejected rather
+// than crashing the compiler. Children must come after their parent and belong to no other node, which rules out
+// cycles. The checksum catches damage that still looks valid.
+bool cacheIsValid(Cache_Header* header, Cached_Node* nodes, int32_t* functions, Cached_Symbol* symbols, int32_t* parents) {
+    bool* hasParent = calloc(header->nodeCount + 1, sizeof(bool));
+    bool valid = true;
+    for (int i = 0; i < header->nodeCount && valid; ++i) {
+        Cached_Node cached = nodes[i];
+        valid = cached.type >= 0 && cached.type < NODE_COUNT
+            && cached.type != NODE_SHIFT_LEFT && cached.type != NODE_DIVIDE_CONSTANT
+            && cachedStringIsValid(cached.name, header)
+            && cachedTypeIsValid(cached.valueType, header);
+        for (int c = 0; c < 3 && valid; ++c) {
+            int32_t child = cached.children[c];
+            if (child != -1) {
+                valid = child > i && child < header->nodeCount && !hasParent[child];
+                if (valid) {
+                    hasParent[child] = true;
+                }
+            }
+        }
+        if (!valid) {
+            break;
+        }
+        switch (cached.type) {
+            case NODE_SCOPE: {
+                valid = cached.value >= 0 && cached.value < header->scopeCount;
+                break;
+            }
+            case NODE_PLUS:
+            case NODE_MINUS:
+            case NODE_TIMES:
+            case NODE_DIVIDE:
+            case NODE_IS_EQUAL: {
+                valid = cached.value >= 0 && cached.value <= TYPE_UNKNOWN;
+                break;
+            }
+            case NODE_CONVERT: {
+                valid = cached.value >= 0 && cached.value <= TYPE_UNKNOWN && integerTypes[cached.value].bits != 0;
+                break;
+            }
+            default: {
+                break;
+            }
         }
-        case NODE_BOOL: {
-            return makeType(TYPE_BOOL);
+    }
+    for (int i = 0; i < header->functionCount && valid; ++i) {
+        valid = functions[i] >= 0 && functions[i] < header->nodeCount
+            && nodes[functions[i]].type == NODE_FUNCTION && !hasParent[functions[i]];
+    }
+    for (int i = 0; i < header->symbolCount && valid; ++i) {
+        valid = symbols[i].scopeId >= 0 && symbols[i].scopeId < header->scopeCount
+            && cachedStringIsValid(symbols[i].name, header)
+            && cachedTypeIsValid(symbols[i].type, header);
+    }
+    // Scopes are numbered as they're parsed, so a parent always comes before its children.
+    for (int i = 0; i < header->scopeCount && valid; ++i) {
+        valid = parents[i] >= -1 && parents[i] < i;
+    }
+    free(hasParent);
+    return valid;
+}
+
+// Looks `source` up in the cache. On a hit, the nodes are added to `list` and `program` and `table` are filled in.
+bool loadCachedProgram(char* cacheDir, char* source, AST_Node_List* list, Program* program, Symbol_Table* table) {
+    size_t sourceLength = strlen(source);
+    uint64_t hash = hashBytes(source, sourceLength);
+    char* path = makeCachePath(cacheDir, hash);
+    Mapped_File mapped;
+    bool isMapped = mapFile(path, &mapped);
+    free(path);
+    if (!isMapped) {
+        return false;
+    }
+
+    Cache_Header header;
+    if (mapped.size < sizeof(header)) {
+        unmapFile(&mapped);
+        return false;
+    }
+    memcpy(&header, mapped.data, sizeof(header));
+    if (header.nodeCount < 0 || header.functionCount < 0 || header.symbolCount < 0 || header.scopeCount < 0
+        || header.stringsLength < 0) {
+        unmapFile(&mapped);
+        return false;
+    }
+    size_t expectedSize = sizeof(header)
+        + (size_t)header.nodeCount * sizeof(Cached_Node)
+        + (size_t)header.functionCount * sizeof(int32_t)
+        + (size_t)header.symbolCount * sizeof(Cached_Symbol)
+        + (size_t)header.scopeCount * sizeof(int32_t)
+        + (size_t)header.stringsLength;
+    if (memcmp(header.magic, CACHE_MAGIC, 4) != 0
+        || header.version != CACHE_FORMAT_VERSION
+        || header.sourceHash != hash
+        || header.sourceLength != sourceLength
+        || mapped.size != expectedSize) {
+        unmapFile(&mapped);
+        return false;
+    }
+
+    Cached_Node* nodes = (Cached_Node*)(mapped.data + sizeof(header));
+    int32_t* functions = (int32_t*)(nodes + header.nodeCount);
+    Cached_Symbol* symbols = (Cached_Symbol*)(functions + header.functionCount);
+    int32_t* parents = (int32_t*)(symbols + header.symbolCount);
+    char* cachedStrings = (char*)(parents + header.scopeCount);
+    if (cacheBodyChecksum(&header, nodes, functions, symbols, parents, cachedStrings) != header.bodyChecksum
+        || !cacheIsValid(&header, nodes, functions, symbols, parents)) {
+        unmapFile(&mapped);
+        return false;
+    }
+
+    // Strings that don't come from the source outlive the mapping, like the source itself.
+    char* strings = malloc(header.stringsLength + 1);
+    memcpy(strings, cachedStrings, header.stringsLength);
+
+    // Allocate every node first so that child indices can be resolved in any order.
+    AST_Node** pointers = malloc((header.nodeCount + 1) * sizeof(AST_Node*));
+    for (int i = 0; i < header.nodeCount; ++i) {
+        pointers[i] = nodeListAddNode(list, (AST_Node){.type = nodes[i].type});
+    }
+#define CHILD(n) ((n) >= 0 ? pointers[n] : NULL)
+    for (int i = 0; i < header.nodeCount; ++i) {
+        Cached_Node cached = nodes[i];
+        Node_Data* data = &pointers[i]->data;
+        String_View name = uncacheString(cached.name, source, strings);
+        Type valueType = uncacheType(cached.valueType, source, strings);
+        switch (cached.type) {
+            case NODE_FUNCTION: {
+                data->functionName = name;
+                data->functionRetType = valueType;
+                data->functionArgs = CHILD(cached.children[0]);
+                data->functionBody = CHILD(cached.children[1]);
+                break;
+            }
+            case NODE_ARGS: {
+                data->argName = name;
+                data->argType = valueType;
+                data->argNext = CHILD(cached.children[1]);
+                break;
+            }
+            case NODE_STATEMENTS: {
+                data->statementStatement = CHILD(cached.children[0]);
+                data->statementNext = CHILD(cached.children[1]);
+                break;
+            }
+            case NODE_SCOPE: {
+                data->scopeId = (int)cached.value;
+                if (data->scopeId >= list->nextScopeId) {
+                    list->nextScopeId = data->scopeId + 1;
+                }
+                data->scopeStatements = CHILD(cached.children[0]);
+                break;
+            }
+            case NODE_RETURN: {
+                data->returnExpr = CHILD(cached.children[0]);
+                break;
+            }
+            case NODE_DECLARATION: {
+                data->declarationName = name;
+                data->declarationType = valueType;
+                break;
+            }
+            case NODE_ASSIGNMENT: {
+                data->assignmentName = name;
+                data->assignmentExpr = CHILD(cached.children[0]);
+                break;
+            }
+            case NODE_PLUS:
+            case NODE_MINUS:
+            case NODE_TIMES:
+            case NODE_DIVIDE:
+            case NODE_IS_EQUAL: {
+                data->binaryOpLeft = CHILD(cached.children[0]);
+                data->binaryOpRight = CHILD(cached.children[1]);
+                data->binaryOpType = (Type_Id)cached.value;
+                break;
+            }
+            case NODE_CONVERT: {
+                data->convertExpr = CHILD(cached.children[0]);
+                data->convertType = (Type_Id)cached.value;
+                break;
+            }
+            case NODE_ARRAY_ACCESS: {
+                data->accessArrayName = name;
+                data->accessIndex = CHILD(cached.children[0]);
+                break;
+            }
+            case NODE_CALL: {
+                data->callName = name;
+                data->callArgs = CHILD(cached.children[0]);
+                break;
+            }
+            case NODE_CALL_ARGS: {
+                data->callArgExpr = CHILD(cached.children[0]);
+                data->callArgNext = CHILD(cached.children[1]);
+                break;
+            }
+            case NODE_IF:
+            case NODE_WHILE: {
+                data->controlCondition = CHILD(cached.children[0]);
+                data->controlScope = CHILD(cached.children[1]);
+                break;
+            }
+            case NODE_ELSE: {
+                data->elseScope = CHILD(cached.children[0]);
+                break;
+            }
+            case NODE_IDENT: {
+                data->identName = name;
+                break;
+            }
+            case NODE_INT: {
+                data->intValue = cached.value;
+                data->intType = (Type_Id)cached.valueType.id;
+                break;
+            }
+            case NODE_BOOL: {
+                data->boolValue = cached.value != 0;
+                break;
+            }
+            case NODE_SHIFT_LEFT:
+            case NODE_DIVIDE_CONSTANT: {
+                assert(false && "Programs are cached before they are optimized (loadCachedProgram)");
+                break;
+            }
         }
-        case NODE_IDENT: {
-            Symbol_Lookup_Result result = tableLookupSymbol(table, scopeId, root->data.identName);
-            assert(result.exists);
-            return result.entry.type;
+        static_assert(NODE_COUNT == 24, "Non-exhaustive cases (loadCachedProgram)");
+    }
+#undef CHILD
+
+    *program = makeProgram();
+    for (int i = 0; i < header.functionCount; ++i) {
+        programAddNode(program, pointers[functions[i]]);
+    }
+    tableAddFunctions(table, *program);
+    for (int i = 0; i < header.symbolCount; ++i) {
+        addSymbol(table, symbols[i].scopeId, uncacheString(symbols[i].name, source, strings), uncacheType(symbols[i].type, source, strings));
+    }
+    for (int i = 0; i < header.scopeCount; ++i) {
+        addScopeParent(table, i, parents[i]);
+    }
+    tableAssignSlots(table, *program);
+
+    free(pointers);
+    unmapFile(&mapped);
+    return true;
+}
+
+
+
+///////////////////////////
+// Incremental build API //
+///////////////////////////
+
+// Incremental builds keep the C emitted for each function in a build state file next to the output, keyed by a
+// fingerprint of the function's source text. Function boundaries are found with a lexer-only scan, so only functions
+// whose text changed are parsed, checked and emitted again. The rest are spliced in from the build state, and the
+// output is byte-identical to a clean build. Calls are checked against signatures, so a change to any signature
+// rebuilds every function.
+
+#define BUILD_STATE_MAGIC "LCLB"
+#define BUILD_STATE_VERSION 2
+
+typedef struct {
+    Token start; // First token of the function. Lexing resumes here when the function has to be parsed.
+    int length;  // Length of the function's source text in bytes
+    uint64_t fingerprint;
+} Function_Range;
+
+typedef struct {
+    uint64_t fingerprint;
+    String_View text; // The emitted C for the function
+} Build_State_Entry;
+
+typedef struct {
+    Build_State_Entry* entries;
+    int length;
+    int capacity;
+    uint64_t signatureHash; // Hash of every function signature, in order
+} Build_State;
+
+void buildStateAdd(Build_State* state, uint64_t fingerprint, String_View text) {
+    if (state->length == state->capacity) {
+        state->capacity = state->capacity == 0 ? 64 : state->capacity * 2;
+        state->entries = realloc(state->entries, state->capacity * sizeof(Build_State_Entry));
+    }
+    state->entries[state->length++] = (Build_State_Entry){fingerprint, text};
+}
+
+int compareBuildStateEntries(const void* a, const void* b) {
+    uint64_t left = ((Build_State_Entry*)a)->fingerprint;
+    uint64_t right = ((Build_State_Entry*)b)->fingerprint;
+    return left < right ? -1 : left > right;
+}
+
+// Entries must have been sorted with `compareBuildStateEntries`.
+Build_State_Entry* buildStateFind(Build_State* state, uint64_t fingerprint) {
+    Build_State_Entry key = {.fingerprint = fingerprint};
+    return bsearch(&key, state->entries, state->length, sizeof(Build_State_Entry), compareBuildStateEntries);
+}
+
+char* makeBuildStatePath(char* outputPath) {
+    size_t length = strlen(outputPath) + 16;
+    char* path = malloc(length);
+    snprintf(path, length, "%s.lclstate", outputPath);
+    return path;
+}
+
+// Loads the build state, leaving it empty if there is none or it can't be read.
+Build_State loadBuildState(char* path) {
+    Build_State state = {0};
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        return state;
+    }
+
+    char magic[4];
+    uint32_t version;
+    uint32_t count;
+    if (fread(magic, 1, 4, file) != 4 || memcmp(magic, BUILD_STATE_MAGIC, 4) != 0
+        || fread(&version, sizeof(version), 1, file) != 1 || version != BUILD_STATE_VERSION
+        || fread(&state.signatureHash, sizeof(state.signatureHash), 1, file) != 1
+        || fread(&count, sizeof(count), 1, file) != 1) {
+        fclose(file);
+        return state;
+    }
+
+    for (uint32_t i = 0; i < count; ++i) {
+        uint64_t fingerprint;
+        uint32_t length;
+        if (fread(&fingerprint, sizeof(fingerprint), 1, file) != 1 || fread(&length, sizeof(length), 1, file) != 1) {
+            break;
         }
-        case NODE_PLUS:
-        case NODE_MINUS:
-        case NODE_TIMES:
-        case NODE_DIVIDE: {
-            Type left = getExprType(table, root->data.binaryOpLeft, scopeId);
-            Type right = getExprType(table, root->data.binaryOpRight, scopeId);
-            if (left.id == TYPE_UNKNOWN || right.id == TYPE_UNKNOWN) {
-                fprintf(stderr, "ERROR! Could not evaluate expression type\n");
-                return makeType(TYPE_UNKNOWN);
+        char* text = malloc(length + 1);
+        if (fread(text, 1, length, file) != length) {
+            free(text);
+            break;
+        }
+        buildStateAdd(&state, fingerprint, (String_View){text, (int)length});
+    }
+    fclose(file);
+
+    qsort(state.entries, state.length, sizeof(Build_State_Entry), compareBuildStateEntries);
+    return state;
+}
+
+void storeBuildState(char* path, Build_State* state) {
+    char* tempPath = malloc(strlen(path) + 16);
+    sprintf(tempPath, "%s.tmp", path);
+    FILE* file = fopen(tempPath, "wb");
+    if (file == NULL) {
+        free(tempPath);
+        return;
+    }
+
+    uint32_t version = BUILD_STATE_VERSION;
+    uint32_t count = state->length;
+    bool written = fwrite(BUILD_STATE_MAGIC, 1, 4, file) == 4
+        && fwrite(&version, sizeof(version), 1, file) == 1
+        && fwrite(&state->signatureHash, sizeof(state->signatureHash), 1, file) == 1
+        && fwrite(&count, sizeof(count), 1, file) == 1;
+    for (int i = 0; written && i < state->length; ++i) {
+        uint32_t length = state->entries[i].text.length;
+        written = fwrite(&state->entries[i].fingerprint, sizeof(uint64_t), 1, file) == 1
+            && fwrite(&length, sizeof(length), 1, file) == 1
+            && fwrite(state->entries[i].text.start, 1, length, file) == length;
+    }
+    written = fclose(file) == 0 && written;
+
+    // `rename` won't replace an existing file on Windows.
+    remove(path);
+    if (!written || rename(tempPath, path) != 0) {
+        remove(tempPath);
+    }
+    free(tempPath);
+}
+
+// Splits the source into top-level functions by matching braces. Returns false if the source doesn't split cleanly,
+// in which case the caller should do a full build so that the parser can report the problem.
+bool scanFunctionRanges(Lexer* lexer, Function_Range** ranges, int* rangesLength) {
+    int capacity = 16;
+    *ranges = malloc(capacity * sizeof(Function_Range));
+    *rangesLength = 0;
+
+    int depth = 0;
+    bool inFunction = false;
+    Token start;
+    Token token = getToken(lexer);
+    while (token.type != TOKEN_EOF) {
+        if (!inFunction) {
+            start = token;
+            inFunction = true;
+        }
+
+        if (token.type == TOKEN_LBRACE) {
+            depth++;
+        }
+        else if (token.type == TOKEN_RBRACE) {
+            depth--;
+            if (depth < 0) {
+                return false;
             }
-            if (!typeEquals(left, right)) {
-                fprintf(stderr, "ERROR! Type mismatch. Left is "SV_FMT", right is "SV_FMT"\n", SV_ARG(left.name), SV_ARG(right.name));
-                return makeType(TYPE_UNKNOWN);
+            if (depth == 0) {
+                if (*rangesLength == capacity) {
+                    capacity *= 2;
+                    *ranges = realloc(*ranges, capacity * sizeof(Function_Range));
+                }
+                int length = (int)(token.text.start + token.text.length - start.text.start);
+                (*ranges)[(*rangesLength)++] = (Function_Range){
+                    .start = start,
+                    .length = length,
+                    .fingerprint = hashBytes(start.text.start, length),
+                };
+                inFunction = false;
             }
-            return left;
         }
-        case NODE_IS_EQUAL: {
-            Type left = getExprType(table, root->data.binaryOpLeft, scopeId);
-            Type right = getExprType(table, root->data.binaryOpRight, scopeId);
-            if (left.id == TYPE_UNKNOWN || right.id == TYPE_UNKNOWN) {
-                fprintf(stderr, "ERROR! Could not evaluate expression type\n");
-                return makeType(TYPE_UNKNOWN);
+        token = getToken(lexer);
+    }
+    return !inFunction;
+}
+
+typedef enum {
+    INCREMENTAL_SUCCESS,
+    INCREMENTAL_FAILURE,
+    INCREMENTAL_NEEDS_FULL_BUILD,
+} Incremental_Result;
+
+// Builds `fileName` into `outputPath`, reusing the C emitted for unchanged functions by the previous build.
+Incremental_Result compileIncremental(char* fileName, char* code, char* outputPath) {
+    Lexer lexer = makeLexer(code, fileName);
+    Function_Range* ranges;
+    int rangesLength;
+    if (!scanFunctionRanges(&lexer, &ranges, &rangesLength)) {
+        free(ranges);
+        return INCREMENTAL_NEEDS_FULL_BUILD;
+    }
+
+    // Every signature is needed to check calls, even from functions that are otherwise left alone.
+    AST_Node_List signatureList = makeNodeList(64);
+    Program signatures = makeProgram();
+    uint64_t signatureHash = 14695981039346656037ull;
+    for (int i = 0; i < rangesLength; ++i) {
+        Token start = ranges[i].start;
+        Lexer signatureLexer = {
+            .code = start.text.start,
+            .fileName = fileName,
+            .lineNum = start.lineNum,
+            .charNum = start.charNum,
+            .line = start.line,
+        };
+        AST_Node signature;
+        if (!parseFunctionSignature(&signatureList, &signatureLexer, &signature)) {
+            free(ranges);
+            return INCREMENTAL_FAILURE;
+        }
+        programAddNode(&signatures, nodeListAddNode(&signatureList, signature));
+        signatureHash = (signatureHash ^ hashBytes(start.text.start, signatureLexer.code - start.text.start)) * 1099511628211ull;
+    }
+
+    char* statePath = makeBuildStatePath(outputPath);
+    Build_State oldState = loadBuildState(statePath);
+    bool signaturesChanged = oldState.signatureHash != signatureHash;
+
+    // Parse every function that the previous build didn't see.
+    AST_Node_List list = makeNodeList(512);
+    Program changed = makeProgram();
+    int* changedIndices = malloc((rangesLength + 1) * sizeof(int));
+    bool success = true;
+    for (int i = 0; i < rangesLength; ++i) {
+        if (!signaturesChanged && buildStateFind(&oldState, ranges[i].fingerprint) != NULL) {
+            continue;
+        }
+
+        Token start = ranges[i].start;
+        Lexer functionLexer = {
+            .code = start.text.start,
+            .fileName = fileName,
+            .lineNum = start.lineNum,
+            .charNum = start.charNum,
+            .line = start.line,
+        };
+        AST_Node* function = parseFunction(&list, &functionLexer);
+        if (function == NULL) {
+            success = false;
+            continue;
+        }
+        changedIndices[changed.length] = i;
+        programAddNode(&changed, function);
+    }
+
+    Symbol_Table table = makeSymbolTable(8);
+    if (success) {
+        tableAddFunctions(&table, signatures);
+        initSymbolTable(&table, changed);
+        success = verifyProgram(&table, changed) && typeCheckProgram(&table, changed);
+    }
+
+    if (success) {
+        Build_State newState = {.signatureHash = signatureHash};
+        String_Builder functionText = {0};
+        String_Builder out = {0};
+        emitPrelude(&out);
+        emitPrototypes(&out, signatures);
+
+        int changedIndex = 0;
+        for (int i = 0; i < rangesLength; ++i) {
+            String_View text;
+            if (changedIndex < changed.length && changedIndices[changedIndex] == i) {
+                sbReset(&functionText);
+                emitFunction(&functionText, changed.nodes[changedIndex++]);
+                char* copy = malloc(functionText.length + 1);
+                memcpy(copy, functionText.data, functionText.length);
+                text = (String_View){copy, functionText.length};
+            }
+            else {
+                text = buildStateFind(&oldState, ranges[i].fingerprint)->text;
+            }
+
+            if (i > 0) {
+                sbAppend(&out, "\n");
+            }
+            sbAppendBytes(&out, text.start, text.length);
+            buildStateAdd(&newState, ranges[i].fingerprint, text);
+        }
+
+        FILE* output = tryFOpen(outputPath, "wb");
+        sbTryFWrite(&out, output);
+        fclose(output);
+        storeBuildState(statePath, &newState);
+    }
+
+    free(changedIndices);
+    free(ranges);
+    free(statePath);
+    return success ? INCREMENTAL_SUCCESS : INCREMENTAL_FAILURE;
+}
+
+
+
+///////////////
+// Stats API //
+///////////////
+
+// `--stats` reports where a compile spends its time, along with counters kept by the lexer, node list, symbol table
+// and emitter. Timings use a monotonic clock so they aren't thrown off by changes to the system time.
+
+typedef enum {
+    STATS_NONE,
+    STATS_TEXT,
+    STATS_JSON, // One JSON object per input, on a single line
+} Stats_Format;
+
+typedef enum {
+    PHASE_LEX, // Only run on its own when stats are enabled. Parsing lexes as it goes, so its time includes lexing too.
+    PHASE_PARSE,
+    PHASE_SYMBOLS,
+    PHASE_VERIFY,
+    PHASE_TYPE_CHECK,
+    PHASE_OPTIMIZE,
+    PHASE_CACHE_LOAD,
+    PHASE_CACHE_STORE,
+    PHASE_EMIT,
+    PHASE_RUN,
+
+    // Used for static asserts
+    PHASE_COUNT,
+} Compile_Phase;
+
+typedef struct {
+    uint64_t phaseNanos[PHASE_COUNT];
+    int tokens;
+    int peeks;
+} Compile_Stats;
+
+char* phaseName(Compile_Phase phase) {
+    switch (phase) {
+        case PHASE_LEX: return "lex";
+        case PHASE_PARSE: return "parse";
+        case PHASE_SYMBOLS: return "symbols";
+        case PHASE_VERIFY: return "verify";
+        case PHASE_TYPE_CHECK: return "typeCheck";
+        case PHASE_OPTIMIZE: return "optimize";
+        case PHASE_CACHE_LOAD: return "cacheLoad";
+        case PHASE_CACHE_STORE: return "cacheStore";
+        case PHASE_EMIT: return "emit";
+        case PHASE_RUN: return "run";
+    }
+    static_assert(PHASE_COUNT == 10, "Non-exhaustive cases (phaseName)");
+    assert(false && "Unreachable (phaseName)");
+    return NULL;
+}
+
+char* nodeTypeName(Node_Type type) {
+    switch (type) {
+        case NODE_FUNCTION: return "function";
+        case NODE_ARGS: return "args";
+        case NODE_SCOPE: return "scope";
+        case NODE_STATEMENTS: return "statements";
+        case NODE_RETURN: return "return";
+        case NODE_DECLARATION: return "declaration";
+        case NODE_ASSIGNMENT: return "assignment";
+        case NODE_PLUS: return "plus";
+        case NODE_MINUS: return "minus";
+        case NODE_TIMES: return "times";
+        case NODE_DIVIDE: return "divide";
+        case NODE_ARRAY_ACCESS: return "arrayAccess";
+        case NODE_CALL: return "call";
+        case NODE_CALL_ARGS: return "callArgs";
+        case NODE_CONVERT: return "convert";
+        case NODE_IS_EQUAL: return "isEqual";
+        case NODE_INT: return "int";
+        case NODE_BOOL: return "bool";
+        case NODE_IF: return "if";
+        case NODE_ELSE: return "else";
+        case NODE_WHILE: return "while";
+        case NODE_IDENT: return "ident";
+        case NODE_SHIFT_LEFT: return "shiftLeft";
+        case NODE_DIVIDE_CONSTANT: return "divideConstant";
+    }
+    static_assert(NODE_COUNT == 24, "Non-exhaustive cases (nodeTypeName)");
+    assert(false && "Unreachable (nodeTypeName)");
+    return NULL;
+}
+
+// Reports the stats for one input through `diagnosticf`, so they end up wherever that input's diagnostics go.
+void printCompileStats(Stats_Format format, char* inputPath, Compile_Stats* stats, AST_Node_List* list, Symbol_Table* table, String_Builder* out) {
+    int nodes = 0;
+    for (int i = 0; i < NODE_COUNT; ++i) {
+        nodes += list->nodeCounts[i];
+    }
+    uint64_t totalNanos = 0;
+    for (int i = 0; i < PHASE_COUNT; ++i) {
+        totalNanos += stats->phaseNanos[i];
+    }
+    size_t astBytes = (size_t)nodes * sizeof(AST_Node);
+    size_t astReservedBytes = (size_t)list->allocatedLength * list->bucketCapacity * sizeof(AST_Node);
+
+    if (format == STATS_JSON) {
+        // Windows paths are full of backslashes, which need escaping in JSON.
+        diagnosticf("{\"input\": \"");
+        for (char* c = inputPath; *c != '\0'; ++c) {
+            diagnosticf(*c == '\\' || *c == '"' ? "\\%c" : "%c", *c);
+        }
+        diagnosticf("\", \"phasesMs\": {");
+        for (int i = 0; i < PHASE_COUNT; ++i) {
+            diagnosticf("%s\"%s\": %.3f", i == 0 ? "" : ", ", phaseName(i), stats->phaseNanos[i] / 1e6);
+        }
+        diagnosticf("}, \"totalMs\": %.3f, \"tokens\": %d, \"peeks\": %d, \"nodes\": %d, \"nodesByType\": {",
+            totalNanos / 1e6, stats->tokens, stats->peeks, nodes);
+        for (int i = 0; i < NODE_COUNT; ++i) {
+            diagnosticf("%s\"%s\": %d", i == 0 ? "" : ", ", nodeTypeName(i), list->nodeCounts[i]);
+        }
+        diagnosticf("}, \"astBytes\": %zu, \"astReservedBytes\": %zu, \"symbolProbes\": %lld, \"bytesEmitted\": %d}\n",
+            astBytes, astReservedBytes, table->probes, out->length);
+        return;
+    }
+
+    diagnosticf("Stats for %s:\n", inputPath);
+    for (int i = 0; i < PHASE_COUNT; ++i) {
+        if (stats->phaseNanos[i] > 0) {
+            diagnosticf("  %-12s %10.3f ms\n", phaseName(i), stats->phaseNanos[i] / 1e6);
+        }
+    }
+    diagnosticf("  %-12s %10.3f ms\n", "total", totalNanos / 1e6);
+    diagnosticf("  tokens lexed:    %d\n", stats->tokens);
+    diagnosticf("  peeks:           %d\n", stats->peeks);
+    diagnosticf("  nodes:           %d\n", nodes);
+    for (int i = 0; i < NODE_COUNT; ++i) {
+        if (list->nodeCounts[i] > 0) {
+            diagnosticf("    %-15s%d\n", nodeTypeName(i), list->nodeCounts[i]);
+        }
+    }
+    diagnosticf("  AST bytes:       %zu (%zu reserved)\n", astBytes, astReservedBytes);
+    diagnosticf("  symbol probes:   %lld\n", table->probes);
+    diagnosticf("  bytes emitted:   %d\n", out->length);
+}
+
+
+
+////////////////
+// Driver API //
+////////////////
+
+typedef enum {
+    EMIT_C,
+    EMIT_AST,
+    EMIT_TOKENS,
+    EMIT_SYMBOLS,
+    EMIT_BYTECODE,
+} Emit_Kind;
+
+typedef struct {
+    Emit_Kind emit;
+    char* outputPath; // Only valid with a single input. NULL to derive the output path from the input path.
+    bool run;
+    bool useVM;
+    bool optimize;
+    char* cacheDir;   // NULL if caching is disabled
+    bool incremental;
+    Stats_Format stats;
+    char* tracePath;     // NULL unless writing a Chrome trace
+    bool memoryStats;
+    bool stream;         // Parse, check and emit one function at a time
+    char* serverSocket;  // Run as a compile server listening on this socket
+    char* connectSocket; // Send inputs to the compile server listening on this socket
+    int jobs;            // Number of threads compiling inputs in parallel
+
+    char** inputs;
+    int inputsLength;
+} Driver_Options;
+
+void printUsage(FILE* stream) {
+    fprintf(stream,
+        "Usage: lcom [options] <input.lcl>...\n"
+        "\n"
+        "Options:\n"
+        "  -o <path>                        Write the output to <path>. Only allowed with a single input.\n"
+        "                                   By default, foo.lcl is compiled to foo.c.\n"
+        "  --emit=c|ast|tokens|symbols|bytecode\n"
+        "                                   What to produce (default: c). Everything but c is printed to stdout.\n"
+        "  --run                            Run the program's main function instead of emitting C.\n"
+        "  --vm                             With --run, use the bytecode VM rather than the AST interpreter.\n"
+        "  -O                               Inline small functions, fold constants, hoist loop-invariant expressions and\n"
+        "                                   replace multiplication and division by constants with cheaper operations.\n"
+        "  --cache                          Cache checked programs in .lcl-cache.\n"
+        "  --cache-dir=<dir>                Cache checked programs in <dir>.\n"
+        "  --incremental                    Only rebuild the functions that changed since the last build.\n"
+        "  --stream                         Parse, check and emit one function at a time, so memory use is bounded\n"
+        "                                   by the largest function rather than the whole file.\n"
+        "  --stats[=text|json]              Report time spent in each phase, and counters, to stderr.\n"
+        "  --trace=<path>                   Write a Chrome trace of each phase and function to <path>.\n"
+        "  --mem-stats                      Report peak memory use by each part of the compiler to stderr.\n"
+        "  --server=<socket>                Run as a compile server listening on the Unix socket <socket>.\n"
+        "  --connect=<socket>               Compile the inputs with the server listening on <socket>.\n"
+        "  -j <n>, --jobs=<n>               Compile up to <n> inputs in parallel. Only allowed when emitting C.\n"
+        "  -h, --help                       Print this message.\n");
+}
+
+// Returns false and prints a message if the arguments are invalid.
+bool parseDriverOptions(int argc, char** argv, Driver_Options* options) {
+    *options = (Driver_Options){
+        .emit = EMIT_C,
+        .jobs = 1,
+        .inputs = malloc(argc * sizeof(char*)),
+    };
+
+    for (int i = 1; i < argc; ++i) {
+        char* arg = argv[i];
+        if (strcmp(arg, "-o") == 0) {
+            if (i + 1 == argc) {
+                fprintf(stderr, "ERROR! Expected a path after \"-o\"\n");
+                return false;
             }
-            if (!typeEquals(left, right)) {
-                fprintf(stderr, "ERROR! Type mismatch. Left is "SV_FMT", right is "SV_FMT"\n", SV_ARG(left.name), SV_ARG(right.name));
-                return makeType(TYPE_UNKNOWN);
+            options->outputPath = argv[++i];
+        }
+        else if (strncmp(arg, "--emit=", 7) == 0) {
+            char* kind = arg + 7;
+            if (strcmp(kind, "c") == 0) {
+                options->emit = EMIT_C;
+            }
+            else if (strcmp(kind, "ast") == 0) {
+                options->emit = EMIT_AST;
+            }
+            else if (strcmp(kind, "tokens") == 0) {
+                options->emit = EMIT_TOKENS;
+            }
+            else if (strcmp(kind, "symbols") == 0) {
+                options->emit = EMIT_SYMBOLS;
+            }
+            else if (strcmp(kind, "bytecode") == 0) {
+                options->emit = EMIT_BYTECODE;
+            }
+            else {
+                fprintf(stderr, "ERROR! Unknown emit kind \"%s\"\n", kind);
+                return false;
+            }
+        }
+        else if (strcmp(arg, "--run") == 0) {
+            options->run = true;
+        }
+        else if (strcmp(arg, "--vm") == 0) {
+            options->useVM = true;
+        }
+        else if (strcmp(arg, "-O") == 0) {
+            options->optimize = true;
+        }
+        else if (strcmp(arg, "--cache") == 0) {
+            options->cacheDir = ".lcl-cache";
+        }
+        else if (strncmp(arg, "--cache-dir=", 12) == 0) {
+            options->cacheDir = arg + 12;
+        }
+        else if (strcmp(arg, "--incremental") == 0) {
+            options->incremental = true;
+        }
+        else if (strcmp(arg, "--stats") == 0 || strcmp(arg, "--stats=text") == 0) {
+            options->stats = STATS_TEXT;
+        }
+        else if (strcmp(arg, "--stats=json") == 0) {
+            options->stats = STATS_JSON;
+        }
+        else if (strncmp(arg, "--trace=", 8) == 0) {
+            options->tracePath = arg + 8;
+        }
+        else if (strcmp(arg, "--mem-stats") == 0) {
+            options->memoryStats = true;
+        }
+        else if (strcmp(arg, "--stream") == 0) {
+            options->stream = true;
+        }
+        else if (strncmp(arg, "--server=", 9) == 0) {
+            options->serverSocket = arg + 9;
+        }
+        else if (strncmp(arg, "--connect=", 10) == 0) {
+            options->connectSocket = arg + 10;
+        }
+        else if (strcmp(arg, "-j") == 0 || strncmp(arg, "--jobs=", 7) == 0 || (strncmp(arg, "-j", 2) == 0 && isdigit(arg[2]))) {
+            char* count = NULL;
+            if (strcmp(arg, "-j") == 0) {
+                if (i + 1 == argc) {
+                    fprintf(stderr, "ERROR! Expected a job count after \"-j\"\n");
+                    return false;
+                }
+                count = argv[++i];
             }
-            return makeType(TYPE_BOOL);
+            else {
+                count = arg[1] == 'j' ? arg + 2 : arg + 7;
+            }
+            char* end;
+            long jobs = strtol(count, &end, 10);
+            if (*count == '\0' || *end != '\0' || jobs < 1 || jobs > 1024) {
+                fprintf(stderr, "ERROR! Invalid job count \"%s\"\n", count);
+                return false;
+            }
+            options->jobs = (int)jobs;
+        }
+        else if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
+            printUsage(stdout);
+            exit(0);
+        }
+        else if (arg[0] == '-') {
+            fprintf(stderr, "ERROR! Unknown option \"%s\"\n", arg);
+            return false;
+        }
+        else {
+            options->inputs[options->inputsLength++] = arg;
         }
-        case NODE_ARRAY_ACCESS: {
-            Symbol_Lookup_Result result = tableLookupSymbol(table, scopeId, root->data.accessArrayName);
-            assert(result.exists);
-            assert(result.entry.type.size >= 0);
-            Type elemType = result.entry.type;
-            elemType.size = -1;
-            return elemType;
+    }
+
+    if (options->serverSocket != NULL) {
+        if (options->inputsLength > 0 || options->connectSocket != NULL || options->run || options->emit != EMIT_C || options->tracePath != NULL || options->stream) {
+            fprintf(stderr, "ERROR! \"--server\" takes no inputs and only emits C\n");
+            return false;
         }
-        default:
-            printf("Unknown expression node: %d\n", root->type);
-            assert(false && "Not an expression type or non-exhaustive cases (getExprType)");
+        return true;
+    }
+    if (options->inputsLength == 0) {
+        fprintf(stderr, "ERROR! No input files\n");
+        return false;
+    }
+    if (options->connectSocket != NULL && (options->run || options->emit != EMIT_C || options->incremental || options->stats != STATS_NONE || options->tracePath != NULL || options->memoryStats || options->stream)) {
+        fprintf(stderr, "ERROR! \"--connect\" can only be used to emit C\n");
+        return false;
+    }
+    if (options->outputPath != NULL && options->inputsLength > 1) {
+        fprintf(stderr, "ERROR! \"-o\" can only be used with a single input\n");
+        return false;
+    }
+    if (options->stream && (options->run || options->emit != EMIT_C || options->incremental || options->cacheDir != NULL || options->stats != STATS_NONE)) {
+        fprintf(stderr, "ERROR! \"--stream\" only emits C, and can't be combined with caching, incremental builds or \"--stats\"\n");
+        return false;
+    }
+    if (options->optimize && (options->incremental || options->stream)) {
+        fprintf(stderr, "ERROR! \"-O\" needs the whole program, so it can't be used with \"--incremental\" or \"--stream\"\n");
+        return false;
+    }
+    if (options->optimize && options->connectSocket != NULL) {
+        fprintf(stderr, "ERROR! With \"--connect\", the server's options are used, so pass \"-O\" to \"--server\" instead\n");
+        return false;
+    }
+    if (options->stats != STATS_NONE && options->incremental) {
+        fprintf(stderr, "ERROR! \"--stats\" measures full builds, so it can't be used with \"--incremental\"\n");
+        return false;
+    }
+    if (options->run && options->inputsLength > 1) {
+        fprintf(stderr, "ERROR! \"--run\" can only be used with a single input\n");
+        return false;
+    }
+    if (options->jobs > 1 && (options->run || options->emit != EMIT_C || options->connectSocket != NULL)) {
+        fprintf(stderr, "ERROR! \"-j\" can only be used to emit C\n");
+        return false;
     }
+    return true;
 }
 
+// foo.lcl becomes foo.c. Any other name just has .c appended.
+char* makeOutputPath(char* inputPath) {
+    size_t length = strlen(inputPath);
+    char* path = malloc(length + 3);
+    memcpy(path, inputPath, length + 1);
+    if (length > 4 && strcmp(inputPath + length - 4, ".lcl") == 0) {
+        length -= 4;
+    }
+    strcpy(path + length, ".c");
+    return path;
+}
 
+// Per-compile working memory. It is reset rather than freed between compiles, so a process that compiles many inputs
+// only pays for growing it once.
+typedef struct {
+    AST_Node_List list;
+    Symbol_Table table;
+    Program program;
+    String_Builder out; // The emitted C
+    Compile_Stats stats;
+
+    // Used by `compileStreaming`, which keeps the signature of every function while `list` only holds one at a time.
+    AST_Node_List signatureList;
+    Program signatures;
+} Compiler;
+
+Compiler makeCompiler(void) {
+    return (Compiler){
+        .list = makeNodeList(512),
+        .table = makeSymbolTable(8),
+        .program = makeProgram(),
+        .out = {0},
+        .signatureList = makeNodeList(64),
+        .signatures = makeProgram(),
+    };
+}
 
-/////////////////
-// Emitter API //
-/////////////////
+void resetCompiler(Compiler* compiler) {
+    nodeListReset(&compiler->list);
+    symbolTableReset(&compiler->table);
+    // Parsing and loading from the cache both build a fresh `Program`, so the old one has to go.
+    memFree(compiler->program.nodes);
+    compiler->program = makeProgram();
+    sbReset(&compiler->out);
+    compiler->stats = (Compile_Stats){0};
+    nodeListReset(&compiler->signatureList);
+    compiler->signatures.length = 0;
+}
 
-void emitTerm(FILE* file, AST_Node* root);
-void emitExpr(FILE* file, AST_Node* root, int precedence);
-void emitStatement(int indent, FILE* file, AST_Node* root);
-void emitStatements(int indent, FILE* file, AST_Node* root);
-void emitScope(int leadingIndent, int indent, FILE* file, AST_Node* root);
-void emitArgs(FILE* file, AST_Node* root);
-void emitFunction(FILE* file, AST_Node* root);
-void emitProgram(FILE* file, Program program);
-
-void emitTerm(FILE* file, AST_Node* root) {
-    switch (root->type) {
-        case NODE_INT: {
-            tryFPrintf(file, "%d", root->data.intValue);
-            break;
+// Frees everything `resetCompiler` keeps for reuse, for when the compiler won't be used again.
+void freeCompiler(Compiler* compiler) {
+    freeNodeList(&compiler->list);
+    freeSymbolTable(&compiler->table);
+    memFree(compiler->program.nodes);
+    free(compiler->out.data);
+    freeNodeList(&compiler->signatureList);
+    memFree(compiler->signatures.nodes);
+    *compiler = (Compiler){0};
+}
+
+// Runs the compiler over `code` according to `options`. When emitting C, the output is left in `compiler->out`.
+// Returns the exit code for this input.
+int compileCode(Driver_Options* options, Compiler* compiler, char* inputPath, char* code) {
+    resetCompiler(compiler);
+
+    if (options->emit == EMIT_TOKENS) {
+        Lexer lexer = makeLexer(code, inputPath);
+        Token token;
+        do {
+            token = getToken(&lexer);
+            printToken(token);
+        } while (token.type != TOKEN_EOF);
+        return 0;
+    }
+
+    bool measure = options->stats != STATS_NONE;
+    Compile_Stats* stats = &compiler->stats;
+    uint64_t phaseStart = 0;
+    // Phases are timed for `--stats` and marked in the trace for `--trace`.
+    #define BEGIN_PHASE(phase) do { traceBegin("phase", svFromCStr(phaseName(phase))); if (measure) { phaseStart = monotonicNanos(); } } while (0)
+    #define END_PHASE(phase) do { if (measure) { stats->phaseNanos[phase] += monotonicNanos() - phaseStart; } traceEnd("phase", svFromCStr(phaseName(phase))); } while (0)
+
+    bool useCache = options->cacheDir != NULL && (options->emit == EMIT_C || options->run);
+    bool cached = false;
+    if (useCache) {
+        BEGIN_PHASE(PHASE_CACHE_LOAD);
+        cached = loadCachedProgram(options->cacheDir, code, &compiler->list, &compiler->program, &compiler->table);
+        END_PHASE(PHASE_CACHE_LOAD);
+    }
+    if (!cached) {
+        if (measure) {
+            BEGIN_PHASE(PHASE_LEX);
+            Lexer lexer = makeLexer(code, inputPath);
+            while (getToken(&lexer).type != TOKEN_EOF);
+            stats->tokens = lexer.tokensLexed;
+            END_PHASE(PHASE_LEX);
         }
-        case NODE_BOOL: {
-            tryFPrintf(file, "%d", root->data.boolValue);
-            break;
+
+        BEGIN_PHASE(PHASE_PARSE);
+        Lexer lexer = makeLexer(code, inputPath);
+        bool parseSuccess;
+        compiler->program = parseProgram(&compiler->list, &lexer, &parseSuccess);
+        stats->peeks = lexer.peeks;
+        END_PHASE(PHASE_PARSE);
+        if (!parseSuccess) {
+            return 1;
         }
-        case NODE_IDENT: {
-            tryFPrintf(file, SV_FMT, SV_ARG(root->data.identName));
-            break;
+        if (options->emit == EMIT_AST) {
+            printProgram(compiler->program);
+            return 0;
         }
-        case NODE_ARRAY_ACCESS: {
-            tryFPrintf(file, SV_FMT"[", SV_ARG(root->data.accessArrayName));
-            emitExpr(file, root->data.accessIndex, -1);
-            tryFPuts("]", file);
-            break;
+
+        BEGIN_PHASE(PHASE_SYMBOLS);
+        initSymbolTable(&compiler->table, compiler->program);
+        END_PHASE(PHASE_SYMBOLS);
+        if (options->emit == EMIT_SYMBOLS) {
+            printSymbolTable(compiler->table);
+            return 0;
         }
-        default:
-            printf("Unknown node term type: %d\n", root->type);
-            assert(false && "Called with a non-term node or non-exhaustive cases (emitTerm)");
+
+        BEGIN_PHASE(PHASE_VERIFY);
+        bool verified = verifyProgram(&compiler->table, compiler->program);
+        END_PHASE(PHASE_VERIFY);
+        if (!verified) {
+            return 1;
+        }
+
+        BEGIN_PHASE(PHASE_TYPE_CHECK);
+        bool typeChecked = typeCheckProgram(&compiler->table, compiler->program);
+        END_PHASE(PHASE_TYPE_CHECK);
+        if (!typeChecked) {
+            return 1;
+        }
+
+        if (useCache) {
+            BEGIN_PHASE(PHASE_CACHE_STORE);
+            storeCachedProgram(options->cacheDir, code, compiler->program, &compiler->table);
+            END_PHASE(PHASE_CACHE_STORE);
+        }
+    }
+
+    // The cache holds the program as written, so optimizing happens after it.
+    if (options->optimize) {
+        BEGIN_PHASE(PHASE_OPTIMIZE);
+        optimizeProgram(&compiler->list, &compiler->table, compiler->program);
+        END_PHASE(PHASE_OPTIMIZE);
     }
+
+    if (options->emit == EMIT_BYTECODE) {
+        Bytecode_Program bytecode = compileBytecode(&compiler->table, compiler->program);
+        printBytecode(bytecode);
+        freeBytecodeProgram(&bytecode);
+        return 0;
+    }
+
+    if (options->run) {
+        BEGIN_PHASE(PHASE_RUN);
+        int result = options->useVM ? runProgramVM(&compiler->table, compiler->program) : interpretProgram(&compiler->table, compiler->program);
+        END_PHASE(PHASE_RUN);
+        return result;
+    }
+
+    BEGIN_PHASE(PHASE_EMIT);
+    emitProgram(&compiler->out, compiler->program);
+    END_PHASE(PHASE_EMIT);
+    #undef BEGIN_PHASE
+    #undef END_PHASE
+    return 0;
 }
 
-void emitExpr(FILE* file, AST_Node* root, int precedence) {
-    if (isNodeOperator(root->type)) {
-        int thisPrecedence = getNodePrecedence(root->type);
-        if (thisPrecedence < precedence) {
-            tryFPuts("(", file);
+// Parses, checks and emits one function at a time, writing C to `outputPath` as it goes. The node list and symbol
+// table are reset between functions, so they only ever grow to fit the largest function instead of the whole file.
+// Returns the exit code for this input.
+int compileStreaming(Compiler* compiler, char* inputPath, char* code, char* outputPath) {
+    resetCompiler(compiler);
+
+    Lexer lexer = makeLexer(code, inputPath);
+    Function_Range* ranges;
+    int rangesLength;
+    if (!scanFunctionRanges(&lexer, &ranges, &rangesLength)) {
+        // The braces don't match up, so let the parser find the problem and report it properly.
+        free(ranges);
+        lexer = makeLexer(code, inputPath);
+        bool parseSuccess;
+        compiler->program = parseProgram(&compiler->list, &lexer, &parseSuccess);
+        return 1;
+    }
+
+    // Functions can be used before they are defined, so collect every signature before checking any bodies.
+    bool success = true;
+    for (int i = 0; i < rangesLength; ++i) {
+        Token start = ranges[i].start;
+        Lexer signatureLexer = {
+            .code = start.text.start,
+            .fileName = inputPath,
+            .lineNum = start.lineNum,
+            .charNum = start.charNum,
+            .line = start.line,
+        };
+        AST_Node signature;
+        if (parseFunctionSignature(&compiler->signatureList, &signatureLexer, &signature)) {
+            programAddNode(&compiler->signatures, nodeListAddNode(&compiler->signatureList, signature));
+        }
+        else {
+            success = false;
+        }
+    }
+    if (!success) {
+        free(ranges);
+        return 1;
+    }
+    tableAddFunctions(&compiler->table, compiler->signatures);
+
+    // Written under a temporary name, so a failed compile leaves the previous output alone like a full build does.
+    char* tempPath = malloc(strlen(outputPath) + 16);
+    sprintf(tempPath, "%s.tmp", outputPath);
+    FILE* output = tryFOpen(tempPath, "wb");
+    emitPrelude(&compiler->out);
+    emitPrototypes(&compiler->out, compiler->signatures);
+    for (int i = 0; i < rangesLength; ++i) {
+        nodeListReset(&compiler->list);
+        symbolTableResetScopes(&compiler->table);
+        compiler->program.length = 0;
+
+        Token start = ranges[i].start;
+        Lexer functionLexer = {
+            .code = start.text.start,
+            .fileName = inputPath,
+            .lineNum = start.lineNum,
+            .charNum = start.charNum,
+            .line = start.line,
+        };
+        AST_Node* function = parseFunction(&compiler->list, &functionLexer);
+        if (function == NULL) {
+            success = false;
+            continue;
+        }
+        programAddNode(&compiler->program, function);
+        initSymbolTable(&compiler->table, compiler->program);
+        if (!verifyProgram(&compiler->table, compiler->program) || !typeCheckProgram(&compiler->table, compiler->program)) {
+            success = false;
+            continue;
         }
 
-        switch (root->type) {
-            case NODE_PLUS: {
-                emitExpr(file, root->data.binaryOpLeft, thisPrecedence);
-                tryFPuts(" + ", file);
-                emitExpr(file, root->data.binaryOpRight, thisPrecedence);
-                break;
-            }
-            case NODE_MINUS: {
-                emitExpr(file, root->data.binaryOpLeft, thisPrecedence);
-                tryFPuts(" - ", file);
-                emitExpr(file, root->data.binaryOpRight, thisPrecedence);
-                break;
-            }
-            case NODE_TIMES: {
-                emitExpr(file, root->data.binaryOpLeft, thisPrecedence);
-                tryFPuts(" * ", file);
-                emitExpr(file, root->data.binaryOpRight, thisPrecedence);
-                break;
-            }
-            case NODE_DIVIDE: {
-                emitExpr(file, root->data.binaryOpLeft, thisPrecedence);
-                tryFPuts(" / ", file);
-                emitExpr(file, root->data.binaryOpRight, thisPrecedence);
-                break;
-            }
-            case NODE_IS_EQUAL: {
-                emitExpr(file, root->data.binaryOpLeft, thisPrecedence);
-                tryFPuts(" == ", file);
-                emitExpr(file, root->data.binaryOpRight, thisPrecedence);
-                break;
+        // Once anything has failed, the remaining functions are only checked.
+        if (success) {
+            if (i > 0) {
+                sbAppend(&compiler->out, "\n");
             }
+            emitFunction(&compiler->out, function);
+            sbTryFWrite(&compiler->out, output);
+            sbReset(&compiler->out);
         }
-        static_assert(NUM_BINOP_NODES == 5, "Non-exhaustive cases (emitExpr)");
+    }
+    if (success) {
+        // The prelude is still buffered if the file has no functions.
+        sbTryFWrite(&compiler->out, output);
+    }
+    fclose(output);
+    free(ranges);
+
+    if (success) {
+        // `rename` won't replace an existing file on Windows.
+        remove(outputPath);
+        if (rename(tempPath, outputPath) != 0) {
+            diagnosticf("[ERROR]: Could not write %s.\nReason: %s\n", outputPath, strerror(errno));
+            success = false;
+        }
+    }
+    if (!success) {
+        remove(tempPath);
+    }
+    free(tempPath);
+    return success ? 0 : 1;
+}
 
-        if (thisPrecedence < precedence) {
-            tryFPuts(")", file);
+// Compiles the file at `inputPath` according to `options`, writing C to `outputPath`. Returns the exit code for this input.
+int compileFile(Driver_Options* options, Compiler* compiler, char* inputPath, char* outputPath) {
+    traceBegin("input", svFromCStr(inputPath));
+    char* code = readEntireFile(inputPath);
+
+    bool emitC = options->emit == EMIT_C && !options->run;
+    if (emitC && options->incremental) {
+        Incremental_Result result = compileIncremental(inputPath, code, outputPath);
+        if (result != INCREMENTAL_NEEDS_FULL_BUILD) {
+            memFree(code);
+            traceEnd("input", svFromCStr(inputPath));
+            return result == INCREMENTAL_SUCCESS ? 0 : 1;
         }
     }
+
+    if (emitC && options->stream) {
+        int result = compileStreaming(compiler, inputPath, code, outputPath);
+        memFree(code);
+        traceEnd("input", svFromCStr(inputPath));
+        return result;
+    }
+
+    int result = compileCode(options, compiler, inputPath, code);
+    if (options->stats != STATS_NONE) {
+        printCompileStats(options->stats, inputPath, &compiler->stats, &compiler->list, &compiler->table, &compiler->out);
+    }
+    if (result == 0 && emitC) {
+        FILE* output = tryFOpen(outputPath, "wb");
+        sbTryFWrite(&compiler->out, output);
+        fclose(output);
+    }
+    memFree(code);
+    traceEnd("input", svFromCStr(inputPath));
+    return result;
+}
+
+
+
+///////////////
+// Batch API //
+///////////////
+
+// `-j` compiles the inputs on a pool of threads. Each worker owns a deque of inputs and a `Compiler`, so the only
+// state shared between threads is the deques themselves. A worker pops inputs from the bottom of its own deque, and
+// once that runs dry it steals from the top of the others, so one long input doesn't leave the rest of the pool idle.
+// Diagnostics are collected per input and printed in input order once everything is done, so the output doesn't
+// depend on scheduling.
+
+#ifdef _WIN32
+typedef HANDLE Thread;
+typedef CRITICAL_SECTION Mutex;
+#define THREAD_FUNCTION(name) DWORD WINAPI name(LPVOID argument)
+#define THREAD_RETURN return 0
+
+bool threadStart(Thread* thread, LPTHREAD_START_ROUTINE function, void* argument) {
+    *thread = CreateThread(NULL, 0, function, argument, 0, NULL);
+    return *thread != NULL;
+}
+
+void threadJoin(Thread thread) {
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+}
+
+inline void mutexInit(Mutex* mutex) { InitializeCriticalSection(mutex); }
+inline void mutexDestroy(Mutex* mutex) { DeleteCriticalSection(mutex); }
+inline void mutexLock(Mutex* mutex) { EnterCriticalSection(mutex); }
+inline void mutexUnlock(Mutex* mutex) { LeaveCriticalSection(mutex); }
+#else
+#include <pthread.h>
+
+typedef pthread_t Thread;
+typedef pthread_mutex_t Mutex;
+#define THREAD_FUNCTION(name) void* name(void* argument)
+#define THREAD_RETURN return NULL
+
+bool threadStart(Thread* thread, void* (*function)(void*), void* argument) {
+    return pthread_create(thread, NULL, function, argument) == 0;
+}
+
+void threadJoin(Thread thread) {
+    pthread_join(thread, NULL);
+}
+
+inline void mutexInit(Mutex* mutex) { pthread_mutex_init(mutex, NULL); }
+inline void mutexDestroy(Mutex* mutex) { pthread_mutex_destroy(mutex); }
+inline void mutexLock(Mutex* mutex) { pthread_mutex_lock(mutex); }
+inline void mutexUnlock(Mutex* mutex) { pthread_mutex_unlock(mutex); }
+#endif
+
+typedef struct {
+    char* inputPath;
+    char* outputPath;
+    String_Builder diagnostics;
+    int result;
+} Batch_Task;
+
+// Indices into the batch's tasks. The owner takes from `bottom` and thieves take from `top`. No tasks are added once
+// the workers start, so a worker can stop as soon as every deque is empty.
+typedef struct {
+    int* tasks;
+    int top;
+    int bottom;
+    Mutex mutex;
+} Work_Deque;
+
+typedef struct Batch Batch;
+
+typedef struct {
+    Batch* batch;
+    int index;
+    Work_Deque deque;
+    Thread thread;
+    Trace trace;
+    Memory_Stats memoryStats; // The worker thread's counts, for merging into the main thread's
+} Batch_Worker;
+
+struct Batch {
+    Driver_Options* options;
+    Batch_Task* tasks;
+    Batch_Worker* workers;
+    int workersLength;
+};
+
+// Returns -1 if the deque is empty.
+int dequePopBottom(Work_Deque* deque) {
+    mutexLock(&deque->mutex);
+    int task = deque->top < deque->bottom ? deque->tasks[--deque->bottom] : -1;
+    mutexUnlock(&deque->mutex);
+    return task;
+}
+
+// Returns -1 if the deque is empty.
+int dequeStealTop(Work_Deque* deque) {
+    mutexLock(&deque->mutex);
+    int task = deque->top < deque->bottom ? deque->tasks[deque->top++] : -1;
+    mutexUnlock(&deque->mutex);
+    return task;
+}
+
+int batchNextTask(Batch_Worker* worker) {
+    int task = dequePopBottom(&worker->deque);
+    Batch* batch = worker->batch;
+    for (int i = 1; task == -1 && i < batch->workersLength; ++i) {
+        Batch_Worker* victim = &batch->workers[(worker->index + i) % batch->workersLength];
+        task = dequeStealTop(&victim->deque);
+    }
+    return task;
+}
+
+void runBatchTask(Driver_Options* options, Compiler* compiler, Batch_Task* task) {
+    diagnosticsBuffer = &task->diagnostics;
+
+    jmp_buf fatalJump;
+    fatalErrorJump = &fatalJump;
+    if (setjmp(fatalJump) == 0) {
+        task->result = compileFile(options, compiler, task->inputPath, task->outputPath);
+    }
     else {
-        emitTerm(file, root);
+        // A fatal error abandoned this input. Its message has already been collected.
+        task->result = 1;
+    }
+
+    fatalErrorJump = NULL;
+    diagnosticsBuffer = NULL;
+}
+
+THREAD_FUNCTION(batchWorkerMain) {
+    Batch_Worker* worker = argument;
+    // The first worker runs on the main thread, so restore its trace afterwards.
+    Trace* callerTrace = activeTrace;
+    if (worker->batch->options->tracePath != NULL) {
+        activeTrace = &worker->trace;
+    }
+    Compiler compiler = makeCompiler();
+    int task;
+    while ((task = batchNextTask(worker)) != -1) {
+        runBatchTask(worker->batch->options, &compiler, &worker->batch->tasks[task]);
     }
+    freeCompiler(&compiler);
+    activeTrace = callerTrace;
+    worker->memoryStats = memoryStats;
+    THREAD_RETURN;
 }
 
-void emitStatement(int indent, FILE* file, AST_Node* root) {
-    switch (root->type) {
-        case NODE_RETURN: {
-            tryFPutsIndented(indent, "return ", file);
-            emitExpr(file, root->data.returnExpr, -1);
-            tryFPuts(";\n", file);
-            break;
+int runBatch(Driver_Options* options) {
+    Batch batch = {
+        .options = options,
+        .tasks = calloc(options->inputsLength, sizeof(Batch_Task)),
+        .workersLength = options->jobs < options->inputsLength ? options->jobs : options->inputsLength,
+    };
+    batch.workers = calloc(batch.workersLength, sizeof(Batch_Worker));
+
+    for (int i = 0; i < options->inputsLength; ++i) {
+        batch.tasks[i].inputPath = options->inputs[i];
+        batch.tasks[i].outputPath = options->outputPath != NULL ? options->outputPath : makeOutputPath(options->inputs[i]);
+    }
+
+    // Inputs are dealt out in contiguous runs, so neighbouring inputs are compiled by the same worker unless stolen.
+    for (int i = 0; i < batch.workersLength; ++i) {
+        Batch_Worker* worker = &batch.workers[i];
+        int start = (int)((long long)options->inputsLength * i / batch.workersLength);
+        int end = (int)((long long)options->inputsLength * (i + 1) / batch.workersLength);
+        worker->batch = &batch;
+        worker->index = i;
+        worker->trace.threadId = i + 1;
+        worker->deque.tasks = malloc((end - start) * sizeof(int));
+        // The owner pops from the bottom, so store the run reversed to compile it front to back.
+        for (int j = start; j < end; ++j) {
+            worker->deque.tasks[end - 1 - j] = j;
         }
-        case NODE_DECLARATION: {
-            tryFPrintfIndented(indent, file, SV_FMT" "SV_FMT, SV_ARG(root->data.declarationType.name), SV_ARG(root->data.declarationName));
-            if (root->data.declarationType.size >= 0) {
-                tryFPrintf(file, "[%d]", root->data.declarationType.size);
-            }
-            tryFPuts(";\n", file);
+        worker->deque.top = 0;
+        worker->deque.bottom = end - start;
+        mutexInit(&worker->deque.mutex);
+    }
+
+    // The calling thread does the work of the first worker.
+    int started = 1;
+    for (; started < batch.workersLength; ++started) {
+        if (!threadStart(&batch.workers[started].thread, batchWorkerMain, &batch.workers[started])) {
+            // The workers that did start steal its tasks. The first one only returns once every deque is empty.
             break;
         }
-        case NODE_ASSIGNMENT: {
-            tryFPrintfIndented(indent, file, SV_FMT" = ", SV_ARG(root->data.assignmentName));
-            emitExpr(file, root->data.assignmentExpr, -1);
-            tryFPuts(";\n", file);
-            break;
+    }
+    batchWorkerMain(&batch.workers[0]);
+    for (int i = 1; i < started; ++i) {
+        threadJoin(batch.workers[i].thread);
+    }
+
+    int exitCode = 0;
+    for (int i = 0; i < options->inputsLength; ++i) {
+        Batch_Task* task = &batch.tasks[i];
+        if (task->diagnostics.length > 0) {
+            fwrite(task->diagnostics.data, 1, task->diagnostics.length, stderr);
         }
-        case NODE_IF: {
-            tryFPutsIndented(indent, "if (", file);
-            emitExpr(file, root->data.controlCondition, -1);
-            tryFPuts(") ", file);
-            emitScope(0, indent, file, root->data.controlScope);
-            break;
+        if (task->result != 0) {
+            exitCode = task->result;
         }
-        case NODE_ELSE: {
-            tryFPutsIndented(indent, "else ", file);
-            emitScope(0, indent, file, root->data.elseScope);
-            break;
+        free(task->diagnostics.data);
+        if (task->outputPath != options->outputPath) {
+            free(task->outputPath);
         }
-        case NODE_WHILE: {
-            tryFPutsIndented(indent, "while (", file);
-            emitExpr(file, root->data.controlCondition, -1);
-            tryFPuts(") ", file);
-            emitScope(0, indent, file, root->data.controlScope);
-            break;
+    }
+    free(batch.tasks);
+
+    for (int i = 0; i < batch.workersLength; ++i) {
+        Trace* trace = &batch.workers[i].trace;
+        if (activeTrace != NULL && trace->events.length > 0) {
+            if (activeTrace->events.length > 0) {
+                sbAppend(&activeTrace->events, ",\n");
+            }
+            sbAppendBytes(&activeTrace->events, trace->events.data, trace->events.length);
         }
-        case NODE_SCOPE: {
-            emitScope(indent, indent, file, root);
-            break;
+        free(trace->events.data);
+        // The first worker ran on this thread, so its counts are already here.
+        if (i > 0) {
+            memMergeStats(&batch.workers[i].memoryStats);
         }
-        default:
-            printf("Unexpected node type: %d\n", root->type);
-            assert(false && "Not a statement type or non-exhaustive cases (emitStatement)");
+        mutexDestroy(&batch.workers[i].deque.mutex);
+        free(batch.workers[i].deque.tasks);
     }
+    free(batch.workers);
+    return exitCode;
 }
 
-void emitStatements(int indent, FILE* file, AST_Node* root) {
-    if (root == NULL) {
-        return;
+
+
+/////////////////////////
+// Compile server API //
+/////////////////////////
+
+// A long-running compile server keeps one warm `Compiler` between requests, so small inputs don't pay for process
+// startup or for growing the node list, symbol table and output buffers from scratch. Clients talk to it over a Unix
+// socket. Every request is answered before the next one is read.
+//
+// Request:  kind (1 byte: 'P' = compile the file at a path, 'S' = compile the given source bytes),
+//           name (the path, or the file name used in diagnostics), payload (the source for 'S', empty for 'P')
+// Response: status (1 byte: 0 = success, 1 = errors), emitted C, diagnostics
+// Strings are sent as a 4-byte length followed by that many bytes.
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <signal.h>
+
+bool writeAll(int fd, void* buffer, size_t length) {
+    char* bytes = buffer;
+    while (length > 0) {
+        ssize_t written = write(fd, bytes, length);
+        if (written <= 0) {
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        bytes += written;
+        length -= written;
     }
-    do {
-        assert(root->type == NODE_STATEMENTS);
+    return true;
+}
 
-        emitStatement(indent, file, root->data.statementStatement);
+bool readAll(int fd, void* buffer, size_t length) {
+    char* bytes = buffer;
+    while (length > 0) {
+        ssize_t bytesRead = read(fd, bytes, length);
+        if (bytesRead <= 0) {
+            if (bytesRead < 0 && errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        bytes += bytesRead;
+        length -= bytesRead;
+    }
+    return true;
+}
 
-        root = root->data.statementNext;
-    } while (root != NULL);
+bool sendString(int fd, char* bytes, uint32_t length) {
+    return writeAll(fd, &length, sizeof(length)) && (length == 0 || writeAll(fd, bytes, length));
 }
 
-void emitScope(int leadingIndent, int indent, FILE* file, AST_Node* root) {
-    assert(root->type == NODE_SCOPE);
+// Reads a string into `sb`, replacing its contents.
+bool receiveString(int fd, String_Builder* sb) {
+    uint32_t length;
+    if (!readAll(fd, &length, sizeof(length))) {
+        return false;
+    }
+    sbReset(sb);
+    sbReserve(sb, length);
+    if (!readAll(fd, sb->data, length)) {
+        return false;
+    }
+    sb->length = length;
+    sb->data[length] = '\0';
+    return true;
+}
 
-    tryFPutsIndented(leadingIndent, "{\n", file);
-    emitStatements(indent + 1, file, root->data.scopeStatements);
-    tryFPutsIndented(indent, "}\n", file);
+bool makeSocketAddress(char* path, struct sockaddr_un* address) {
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address->sun_path)) {
+        fprintf(stderr, "ERROR! Socket path \"%s\" is too long\n", path);
+        return false;
+    }
+    strcpy(address->sun_path, path);
+    return true;
 }
 
-void emitArgs(FILE* file, AST_Node* root) {
-    if (root == NULL) {
-        tryFPuts("()", file);
-        return;
+// Compiles one request with the warm `compiler`. The response's C and diagnostics are left in `compiler->out` and
+// `diagnostics`.
+bool serveRequest(Driver_Options* options, Compiler* compiler, char kind, String_Builder* name, String_Builder* source, String_Builder* diagnostics) {
+    sbReset(diagnostics);
+    diagnosticsBuffer = diagnostics;
+
+    // Set after `setjmp`, so it has to be volatile to still be freed when a fatal error jumps back.
+    char* volatile fileCode = NULL;
+    jmp_buf fatalJump;
+    fatalErrorJump = &fatalJump;
+    bool success = false;
+    if (setjmp(fatalJump) == 0) {
+        char* code = source->data;
+        if (kind == 'P') {
+            FILE* file = fopen(name->data, "rb");
+            if (file == NULL) {
+                diagnosticf("ERROR! Could not open file %s: %s\n", name->data, strerror(errno));
+                code = NULL;
+            }
+            else {
+                fclose(file);
+                code = fileCode = readEntireFile(name->data);
+            }
+        }
+
+        if (code != NULL) {
+            success = compileCode(options, compiler, name->data, code) == 0;
+            if (options->stats != STATS_NONE) {
+                printCompileStats(options->stats, name->data, &compiler->stats, &compiler->list, &compiler->table, &compiler->out);
+            }
+        }
+    }
+    else {
+        // A fatal error (such as a parse error at the end of the file) abandoned the compile. Its message has
+        // already been collected, and the compiler is reset before the next request.
+        success = false;
+    }
+    if (fileCode != NULL) {
+        memFree(fileCode);
     }
 
-    tryFPuts("(", file);
-    tryFPrintf(file, SV_FMT" "SV_FMT, SV_ARG(root->data.argType.name), SV_ARG(root->data.argName));
-    root = root->data.argNext;
-    while (root != NULL) {
-        tryFPrintf(file, ", "SV_FMT" "SV_FMT, SV_ARG(root->data.argType.name), SV_ARG(root->data.argName));
-        root = root->data.argNext;
+    fatalErrorJump = NULL;
+    diagnosticsBuffer = NULL;
+    if (!success) {
+        sbReset(&compiler->out);
     }
-    tryFPuts(")", file);
+    return success;
 }
 
-void emitFunction(FILE* file, AST_Node* root) {
-    assert(root->type == NODE_FUNCTION);
+int runCompileServer(Driver_Options* options) {
+    struct sockaddr_un address;
+    if (!makeSocketAddress(options->serverSocket, &address)) {
+        return 1;
+    }
 
-    if (svEqualsCStr(root->data.functionName, "main")) {
-        tryFPuts("int ", file);
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        fprintf(stderr, "[ERROR]: Could not create socket.\nReason: %s\n", strerror(errno));
+        return 1;
     }
-    else if (svEqualsCStr(root->data.functionRetType.name, "unit")) {
-        tryFPuts("void ", file);
+    unlink(options->serverSocket); // Remove the socket left behind by a previous server, if any
+    if (bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 16) != 0) {
+        fprintf(stderr, "[ERROR]: Could not listen on %s.\nReason: %s\n", options->serverSocket, strerror(errno));
+        close(listener);
+        return 1;
     }
-    else {
-        tryFPrintf(file, SV_FMT" ", SV_ARG(root->data.functionRetType.name));
+
+    // A client that hangs up before reading its response makes writes fail with EPIPE, which only drops that client,
+    // instead of raising SIGPIPE and killing the server.
+    signal(SIGPIPE, SIG_IGN);
+
+    // Everything below is reused for the lifetime of the server.
+    Compiler compiler = makeCompiler();
+    String_Builder name = {0};
+    String_Builder source = {0};
+    String_Builder diagnostics = {0};
+
+    for (;;) {
+        int connection = accept(listener, NULL, NULL);
+        if (connection < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "[ERROR]: Could not accept a connection.\nReason: %s\n", strerror(errno));
+            break;
+        }
+
+        char kind;
+        while (readAll(connection, &kind, 1)) {
+            if ((kind != 'P' && kind != 'S') || !receiveString(connection, &name) || !receiveString(connection, &source)) {
+                break;
+            }
+            bool success = serveRequest(options, &compiler, kind, &name, &source, &diagnostics);
+            char status = success ? 0 : 1;
+            if (!writeAll(connection, &status, 1)
+                || !sendString(connection, compiler.out.data, compiler.out.length)
+                || !sendString(connection, diagnostics.data, diagnostics.length)) {
+                break;
+            }
+        }
+        close(connection);
     }
-    tryFPrintf(file, SV_FMT, SV_ARG(root->data.functionName));
-    emitArgs(file, root->data.functionArgs);
-    tryFPuts(" ", file);
-    emitScope(0, 0, file, root->data.functionBody);
+
+    close(listener);
+    unlink(options->serverSocket);
+    return 1;
 }
 
-void emitProgram(FILE* file, Program program) {
-    tryFPuts("#include <stdbool.h>\n\n", file); // Needed for bool types in the emitted C program
+// Sends every input to the compile server and writes the results as a normal compile would.
+int runCompileClient(Driver_Options* options) {
+    struct sockaddr_un address;
+    if (!makeSocketAddress(options->connectSocket, &address)) {
+        return 1;
+    }
 
-    if (program.length == 0) {
-        return;
+    int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connection < 0 || connect(connection, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        fprintf(stderr, "[ERROR]: Could not connect to the compile server at %s.\nReason: %s\n", options->connectSocket, strerror(errno));
+        if (connection >= 0) {
+            close(connection);
+        }
+        return 1;
     }
 
-    emitFunction(file, program.nodes[0]);
-    for (int i = 1; i < program.length; ++i) {
-        tryFPuts("\n", file);
-        emitFunction(file, program.nodes[i]);
+    String_Builder output = {0};
+    String_Builder diagnostics = {0};
+    int exitCode = 0;
+    for (int i = 0; i < options->inputsLength; ++i) {
+        char* inputPath = options->inputs[i];
+        char* code = readEntireFile(inputPath);
+        char kind = 'S';
+        char status;
+        bool ok = writeAll(connection, &kind, 1)
+            && sendString(connection, inputPath, (uint32_t)strlen(inputPath))
+            && sendString(connection, code, (uint32_t)strlen(code))
+            && readAll(connection, &status, 1)
+            && receiveString(connection, &output)
+            && receiveString(connection, &diagnostics);
+        memFree(code);
+        if (!ok) {
+            fprintf(stderr, "[ERROR]: Lost the connection to the compile server.\n");
+            close(connection);
+            return 1;
+        }
+
+        fputs(diagnostics.data, stderr);
+        if (status != 0) {
+            exitCode = 1;
+            continue;
+        }
+        char* outputPath = options->outputPath != NULL ? options->outputPath : makeOutputPath(inputPath);
+        FILE* file = tryFOpen(outputPath, "wb");
+        sbTryFWrite(&output, file);
+        fclose(file);
     }
+
+    close(connection);
+    return exitCode;
 }
+#else
+int runCompileServer(Driver_Options* options) {
+    (void)options;
+    fprintf(stderr, "ERROR! The compile server is not supported on this platform\n");
+    return 1;
+}
+
+int runCompileClient(Driver_Options* options) {
+    (void)options;
+    fprintf(stderr, "ERROR! The compile server is not supported on this platform\n");
+    return 1;
+}
+#endif
+
+
 
 // Read in file simple.lcl - DONE
 // Have an iterator lexer - DONE
@@ -2461,37 +9739,52 @@ void emitProgram(FILE* file, Program program) {
 // Convert to C code - DONE
 // Compile C code to executable
 
-int main() {
-    char* fileName = "examples/simple.lcl";
-    char* code = readEntireFile(fileName);
-    Lexer lexer = makeLexer(code, fileName);
-    AST_Node_List list = makeNodeList(512);
-
-    bool parseSuccess;
-    Program program = parseProgram(&list, &lexer, &parseSuccess);
-    if (!parseSuccess) {
+// Tools that build on the compiler, like bench/bench.c, include this file with LCOM_NO_MAIN defined.
+#ifndef LCOM_NO_MAIN
+int main(int argc, char** argv) {
+    Driver_Options options;
+    if (!parseDriverOptions(argc, argv, &options)) {
+        printUsage(stderr);
         return 1;
     }
-    printProgram(program);
-    
-    Symbol_Table table = makeSymbolTable(8);
-    initSymbolTable(&table, program);
 
-    printf("\n\n\n");
-    printSymbolTable(table);
-    printf("\n\n\n");
+    if (options.serverSocket != NULL) {
+        return runCompileServer(&options);
+    }
+    if (options.connectSocket != NULL) {
+        return runCompileClient(&options);
+    }
 
-    bool verified = verifyProgram(&table, program);
-    if (!verified) {
-        return 1;
+    Trace trace = {0};
+    if (options.tracePath != NULL) {
+        traceStartNanos = monotonicNanos();
+        activeTrace = &trace;
     }
 
-    bool typeChecked = typeCheckProgram(&table, program);
-    if (!typeChecked) {
-        return 1;
+    int exitCode = 0;
+    if (options.jobs > 1 && options.inputsLength > 1) {
+        exitCode = runBatch(&options);
+    }
+    else {
+        // Inputs are compiled one after another in the same process, so a batch only pays for startup once.
+        Compiler compiler = makeCompiler();
+        for (int i = 0; i < options.inputsLength; ++i) {
+            char* inputPath = options.inputs[i];
+            char* outputPath = options.outputPath != NULL ? options.outputPath : makeOutputPath(inputPath);
+            int result = compileFile(&options, &compiler, inputPath, outputPath);
+            if (result != 0) {
+                exitCode = result;
+            }
+        }
     }
 
-    FILE* output = tryFOpen("examples/simple.c", "wb");
-    emitProgram(output, program);
-    return 0;
+    if (options.memoryStats) {
+        printMemoryStats(stderr);
+    }
+    if (options.tracePath != NULL && !writeTraceFile(options.tracePath, &trace)) {
+        fprintf(stderr, "ERROR! Could not write trace to %s: %s\n", options.tracePath, strerror(errno));
+        exitCode = 1;
+    }
+    return exitCode;
 }
+#endif